@@ -0,0 +1,54 @@
+/* abs2sectsym_pass for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static int ELFN(abs2sectsym_pass)(struct elfimage *img, struct nameset *maybe_names)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	const char *shstrtab = img->shstrtab;
+	/* Do one pass where we map section names to section indices.
+	 * If two sections share a name, the later one wins, so we add them
+	 * last first. */
+	struct nameset section_names = { 0 };
+	Elf64_Word *shndx_of = malloc((img->shnum ? img->shnum : 1) * sizeof (Elf64_Word));
+	if (!shndx_of) err(1, "allocating section names table");
+	for (unsigned i = img->shnum; i-- > 0; )
+	{
+		if (!shdrs[i].sh_name) continue;
+		shndx_of[section_names.nnames] = i;
+		nameset_add(&section_names, &shstrtab[GET(shdrs[i].sh_name)]);
+	}
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_SYMTAB)
+		{
+			const char *strtab = ELFN_SECTION_DATA(img, shdrs[GET(shdr->sh_link)]);
+			ElfN(Sym) *syms = ELFN_SECTION_DATA(img, *shdr);
+			ElfN(Word) *xindex = elfimage_symtab_xindex(img, shdr);
+			for (ElfN(Sym) *sym = syms;
+					sym != (ElfN(Sym) *) ((char*) syms + GET(shdr->sh_size));
+					++sym)
+			{
+				if (GET(sym->st_shndx) == SHN_ABS && sym->st_value == 0)
+				{
+					/* So far so good, but is it in our list? */
+					const char *name = &strtab[GET(sym->st_name)];
+					if (maybe_names && !nameset_contains(maybe_names, name)) continue;
+					long found = nameset_find(&section_names, name);
+					if (found != -1)
+					{
+						/* OK, make it point to that section */
+						if (0 != ELFN(elfimage_set_sym_section)(syms, sym, xindex, shndx_of[found]))
+						{
+							elfimage_warnx(img, "cannot point `%s' at section %u without a "
+								"SHT_SYMTAB_SHNDX section", name, (unsigned) shndx_of[found]);
+						}
+						else elfimage_count(img, ELFIMAGE_SYMBOLS_PATCHED, 1);
+					}
+				}
+			}
+		}
+	}
+	nameset_destroy(&section_names);
+	free(shndx_of);
+	return 0;
+}
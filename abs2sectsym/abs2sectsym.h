@@ -0,0 +1,11 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+struct nameset;
+int abs2sectsym(char *filename, char *maybe_symbol);
+int abs2sectsym_multi(char *filename, char **maybe_symbols, unsigned nsymbols);
+int abs2sectsym_pass(struct elfimage *img, struct nameset *maybe_names);
+#ifdef __cplusplus
+}
+#endif
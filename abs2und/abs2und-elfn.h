@@ -0,0 +1,32 @@
+/* abs2und_pass for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static int ELFN(abs2und_pass)(struct elfimage *img, struct nameset *maybe_names)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_SYMTAB)
+		{
+			const char *strtab = ELFN_SECTION_DATA(img, shdrs[GET(shdr->sh_link)]);
+			ElfN(Sym) *syms = ELFN_SECTION_DATA(img, *shdr);
+			for (ElfN(Sym) *sym = syms;
+					sym != (ElfN(Sym) *) ((char*) syms + GET(shdr->sh_size));
+					++sym)
+			{
+				if (sym->st_name &&
+					// ELFN_ST_TYPE(sym->st_info) != STT_SECTION &&
+					GET(sym->st_shndx) == SHN_ABS &&
+					(!maybe_names || nameset_contains(maybe_names, &strtab[GET(sym->st_name)])))
+				{
+					SET(sym->st_shndx, SHN_UNDEF);
+					sym->st_size = 0;
+					sym->st_value = 0;
+					sym->st_info = ELFN_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+					elfimage_count(img, ELFIMAGE_SYMBOLS_PATCHED, 1);
+				}
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,11 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+struct nameset;
+int abs2und(char *filename, char *maybe_symbol);
+int abs2und_multi(char *filename, char **maybe_symbols, unsigned nsymbols);
+int abs2und_pass(struct elfimage *img, struct nameset *maybe_names);
+#ifdef __cplusplus
+}
+#endif
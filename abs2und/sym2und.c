@@ -3,103 +3,122 @@
 #include <libgen.h>
 #include <elf.h>
 #include <stdio.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/mman.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <err.h>
 
-#ifdef SYM2UND_AS_LIBRARY
+#include "elfimage.h"
+#include "nameset.h"
+#include "batch.h"
 #include "sym2und.h"
-#endif
 
 /*
- Here we rewrite an ELF file so that the given symbol
- becomes an undefined symbol
+ Here we rewrite an ELF file so that the given symbols
+ become undefined symbols. The names can be given as arguments
+ or in list files (-f), and we handle them all in one pass
+ over the symtab.
  */
 
-static void usage(const char *basename)
+static int sym2und_file(char *filename, const char *output, struct nameset *names)
 {
-	fprintf(stderr, "Usage: %s <filename> <sym>\n", basename);
+	struct elfimage img;
+	int ret = elfimage_open_partial(&img, filename, output);
+	if (ret) return ret;
+	ret = sym2und_pass(&img, names);
+	if (!ret) ret = elfimage_commit(&img);
+	elfimage_close(&img);
+	return ret;
 }
 #ifdef SYM2UND_AS_LIBRARY
 int sym2und(char *filename, char *symbol)
 {
+	return sym2und_multi(filename, &symbol, 1);
+}
 #else
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-o <output>] [-f <listfile>]... <filename> [<sym>...]\n"
+		"       %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-f <listfile>]... -F|--files-from <filelist> [<sym>...]\n",
+		basename, basename);
+}
+static int run_pass(struct elfimage *img, void *arg)
+{ return sym2und_pass(img, arg); }
 int main(int argc, char **argv)
 {
-	if (argc < 3)
-	{
-		usage(basename(argv[0]));
-		return 1;
-	}
-
-	char *filename = argv[1];
-	char *symbol = argv[2];
-#endif
-	int fd = open(filename, O_RDWR);
-	if (fd == -1)
-	{
-		warnx("could not open %s", filename);
-		return 2;
-	}
-
-	struct stat buf;
-	int ret = fstat(fd, &buf);
-
-	long page_size = sysconf(_SC_PAGESIZE);
-
-	if (ret)
+	struct nameset names = { 0 };
+	_Bool have_list = 0;
+	struct elftin_batch batch = { .njobs = 1, .partial = 1, .pass = run_pass };
+	elftin_batch_stamp_word(&batch, "sym2und");
+	static const struct option longopts[] = { ELFTIN_BATCH_OPTIONS, { 0 } };
+	_Bool have_files = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+f:o:j:F:nSv", longopts, NULL)))
 	{
-		warnx("could not stat %s", filename);
-		return 3;
+		switch (opt)
+		{
+			case 'f':
+				if (0 != nameset_add_file(&names, optarg)) return 1;
+				have_list = 1;
+				elftin_batch_stamp_word(&batch, "-f");
+				elftin_batch_stamp_word(&batch, optarg);
+				break;
+			case 'o': batch.output = optarg; break;
+			case 'j': batch.njobs = atoi(optarg); break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_files = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: usage(basename(argv[0])); return 1;
+		}
 	}
-
-	size_t length = (buf.st_size % page_size == 0) ? buf.st_size
-				: page_size * (buf.st_size / page_size + 1);
-
-	void *mapping = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-	if (mapping == MAP_FAILED)
+	/* Given a file list, every argument is a symbol. */
+	if (!have_files && argc - optind >= 1) elftin_batch_add(&batch, argv[optind++]);
+	if ((!batch.files.nnames && !have_files) || (argc - optind < 1 && !have_list))
 	{
-		warnx("could not mmap %s", filename);
-		return 4;
+		usage(basename(argv[0]));
+		return 1;
 	}
 
-	/* Okay, now do the sym2unding.
-	 * FIXME: don't assume 64-bit and native-endianness. */
-	Elf64_Ehdr *ehdr = (Elf64_Ehdr *) mapping;
-	if (0 != strncmp(ehdr->e_ident, "\x7F""ELF", 4))
+	for (int i = optind; i < argc; ++i)
 	{
-		warnx("not an ELF file: %s", filename);
-		return 5;
+		nameset_add(&names, argv[i]);
+		elftin_batch_stamp_word(&batch, argv[i]);
 	}
-#define SECTION_DATA(shdr) ((void*)((uintptr_t) mapping + (shdr).sh_offset))
-	Elf64_Shdr *shdrs = (Elf64_Shdr *) (ehdr->e_shoff ? (char*) mapping + ehdr->e_shoff : NULL);
-	const char *shstrtab = SECTION_DATA(shdrs[ehdr->e_shstrndx]);
-	for (Elf64_Shdr *shdr = shdrs; shdr < shdrs + ehdr->e_shnum; ++shdr)
-	{
-		if (shdr->sh_type == SHT_SYMTAB)
-		{
-			const char *strtab = SECTION_DATA(shdrs[shdr->sh_link]);
-			for (Elf64_Sym *sym = SECTION_DATA(*shdr);
-					sym != (Elf64_Sym *) ((char*) SECTION_DATA(*shdr) + shdr->sh_size);
-					++sym)
-			{
-				if (sym->st_name &&
-					// ELF64_ST_TYPE(sym->st_info) != STT_SECTION &&
-					0 == strcmp(&strtab[sym->st_name], symbol))
-				{
-					sym->st_shndx = SHN_UNDEF;
-					sym->st_size = 0;
-					sym->st_value = 0;
-					sym->st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
-				}
-			}
-		}
-	}
-
-	munmap(mapping, length);
-	close(fd);
+	nameset_freeze(&names); // the files may be done in parallel
+	batch.arg = &names;
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	nameset_destroy(&names);
+	return ret;
+}
+#endif
+int sym2und_multi(char *filename, char **symbols, unsigned nsymbols)
+{
+	struct nameset names = { 0 };
+	for (unsigned i = 0; i < nsymbols; ++i) nameset_add(&names, symbols[i]);
+	int ret = sym2und_file(filename, NULL, &names);
+	nameset_destroy(&names);
+	return ret;
+}
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "sym2und-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "sym2und-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "sym2und-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "sym2und-elfn.h"
+int sym2und_pass(struct elfimage *img, struct nameset *names)
+{
+	return ELFIMAGE_DISPATCH(img, sym2und_pass, img, names);
 }
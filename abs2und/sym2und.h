@@ -1,7 +1,11 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+struct elfimage;
+struct nameset;
 int sym2und(char *filename, char *symbol);
+int sym2und_multi(char *filename, char **symbols, unsigned nsymbols);
+int sym2und_pass(struct elfimage *img, struct nameset *names);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <err.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/*
+ Time one run of a rewriter tool, reporting one line of CSV or JSON.
+ We run the command given after '--' some number of times, each time
+ after deleting the output file, and report the fastest run's wall time
+ along with its peak RSS, page faults and blocks written (all from
+ wait4()'s rusage). Given the input and output files, we also count how
+ many bytes of the output differ from the input, which is the number
+ that matters for an in-place rewrite. With -J we also append the JSON
+ line to a file, so one run can feed both formats.
+ */
+
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-n <reps>] [-f csv|json] [-J <jsonfile>] [-H] -t <tool> -s <scale> "
+		"[-i <input> -O <output>] -- <command>...\n", basename);
+	fprintf(stderr, "       %s -f csv -H   (print the CSV header only)\n", basename);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char csv_header[] = "tool,scale,input_bytes,reps,status,wall_s,"
+	"maxrss_kb,minflt,majflt,oublock_bytes,bytes_changed";
+
+struct result
+{
+	int status;
+	double wall;
+	struct rusage ru;
+};
+
+static struct result run_once(char **cmd)
+{
+	struct result r = { 0 };
+	double start = now();
+	pid_t pid = fork();
+	if (pid == -1) err(EXIT_FAILURE, "fork");
+	if (pid == 0)
+	{
+		/* The tools are chatty; we only want our own line on stdout. */
+		int devnull = open("/dev/null", O_WRONLY);
+		if (devnull != -1) { dup2(devnull, 1); dup2(devnull, 2); }
+		execvp(cmd[0], cmd);
+		_exit(127);
+	}
+	int status;
+	if (-1 == wait4(pid, &status, 0, &r.ru)) err(EXIT_FAILURE, "wait4");
+	r.wall = now() - start;
+	r.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	return r;
+}
+
+static void *map_whole(const char *filename, size_t *size_out)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) return NULL;
+	struct stat s;
+	void *mapping = NULL;
+	if (0 == fstat(fd, &s) && s.st_size > 0)
+	{
+		mapping = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) mapping = NULL;
+	}
+	close(fd);
+	*size_out = mapping ? s.st_size : 0;
+	return mapping;
+}
+
+/* Bytes that differ, plus any by which the output is longer or shorter. */
+static long bytes_changed(const char *input, const char *output)
+{
+	size_t in_size, out_size;
+	unsigned char *in = map_whole(input, &in_size);
+	unsigned char *out = map_whole(output, &out_size);
+	if (!in || !out)
+	{
+		if (in) munmap(in, in_size);
+		if (out) munmap(out, out_size);
+		return -1;
+	}
+	size_t common = (in_size < out_size) ? in_size : out_size;
+	long n = (in_size > out_size) ? in_size - out_size : out_size - in_size;
+	for (size_t i = 0; i < common; ++i) n += (in[i] != out[i]);
+	munmap(in, in_size);
+	munmap(out, out_size);
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned reps = 3;
+	const char *format = "csv";
+	_Bool header = 0;
+	const char *tool = NULL;
+	const char *scale = NULL;
+	const char *input = NULL;
+	const char *output = NULL;
+	const char *json_filename = NULL;
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "+n:f:J:Ht:s:i:O:")))
+	{
+		switch (opt)
+		{
+			case 'n': reps = atoi(optarg); break;
+			case 'f': format = optarg; break;
+			case 'J': json_filename = optarg; break;
+			case 'H': header = 1; break;
+			case 't': tool = optarg; break;
+			case 's': scale = optarg; break;
+			case 'i': input = optarg; break;
+			case 'O': output = optarg; break;
+			default: usage(basename(argv[0])); return 1;
+		}
+	}
+	_Bool json = (0 == strcmp(format, "json"));
+	if (!json && 0 != strcmp(format, "csv"))
+	{
+		usage(basename(argv[0]));
+		return 1;
+	}
+	if (header && !json) puts(csv_header);
+	if (header && optind == argc && !tool) return 0;
+	if (!tool || !scale || reps < 1 || optind == argc || (!input != !output))
+	{
+		usage(basename(argv[0]));
+		return 1;
+	}
+	char **cmd = &argv[optind];
+
+	struct result best = { .wall = -1 };
+	for (unsigned i = 0; i < reps; ++i)
+	{
+		if (output) unlink(output);
+		struct result r = run_once(cmd);
+		if (r.status != 0)
+		{
+			/* Report the failure, not a time. */
+			best = r;
+			break;
+		}
+		if (best.wall < 0 || r.wall < best.wall) best = r;
+	}
+	struct stat s;
+	long input_bytes = (input && 0 == stat(input, &s)) ? (long) s.st_size : -1;
+	long changed = (input && best.status == 0) ? bytes_changed(input, output) : -1;
+	FILE *json_f = NULL;
+	if (json_filename && !(json_f = fopen(json_filename, "a"))) err(EXIT_FAILURE, "opening %s", json_filename);
+	for (FILE *f = stdout; f; f = (f == stdout) ? json_f : NULL)
+	{
+		if (json || f == json_f)
+		{
+			fprintf(f, "{\"tool\": \"%s\", \"scale\": \"%s\", \"input_bytes\": %ld, \"reps\": %u, "
+				"\"status\": %d, \"wall_s\": %.6f, \"maxrss_kb\": %ld, \"minflt\": %ld, "
+				"\"majflt\": %ld, \"oublock_bytes\": %ld, \"bytes_changed\": %ld}\n",
+				tool, scale, input_bytes, reps, best.status, best.wall,
+				best.ru.ru_maxrss, best.ru.ru_minflt, best.ru.ru_majflt,
+				best.ru.ru_oublock * 512, changed);
+		}
+		else
+		{
+			fprintf(f, "%s,%s,%ld,%u,%d,%.6f,%ld,%ld,%ld,%ld,%ld\n",
+				tool, scale, input_bytes, reps, best.status, best.wall,
+				best.ru.ru_maxrss, best.ru.ru_minflt, best.ru.ru_majflt,
+				best.ru.ru_oublock * 512, changed);
+		}
+	}
+	if (json_f) fclose(json_f);
+	return 0; // a failing tool shows up in the status column
+}
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# Write x86-64 assembly for a synthetic object, to be assembled (ET_REL)
+# and perhaps linked -shared (ET_DYN). The knobs are
+#
+# - nsections: one .text.sN section per N, each a few bytes long
+# - nsyms: global symbols, round-robin over the sections; the first
+#     nzero of them are at offset 0 in their section ('bench_zN') and
+#     the rest are part-way in ('bench_sN')
+# - nrelocs: section-relative .data relocs, pointing at offset 0 in
+#     some section (so normrelocs has a symbol to switch each one to)
+# - ndebugrelocs: section-relative .debug_info relocs, at offset 0
+#     and elsewhere (which normrelocs must leave alone)
+#
+# All symbols are global so a shared link exports them to the dynsym.
+
+if [[ $# -ne 5 ]]; then
+    echo "Usage: $0 <nsections> <nsyms> <nzero> <nrelocs> <ndebugrelocs>" 1>&2
+    exit 1
+fi
+if [[ $1 -lt 1 || $3 -gt $1 || $3 -gt $2 ]]; then
+    echo "$0: need at least one section, and no more zero-offset symbols than sections or symbols" 1>&2
+    exit 1
+fi
+
+exec awk -v nsections="$1" -v nsyms="$2" -v nzero="$3" \
+    -v nrelocs="$4" -v ndebugrelocs="$5" 'BEGIN {
+    # Each section is 8 bytes of nops; non-zero-offset symbols sit at +4.
+    for (i = 0; i < nsections; ++i)
+    {
+        printf ".section .text.s%d,\"ax\",@progbits\n", i
+        for (j = i; j < nsyms; j += nsections)
+        {
+            if (j < nzero) printf ".globl bench_z%d\nbench_z%d:\n", j, j
+        }
+        printf "\t.nops 4\n"
+        for (j = i; j < nsyms; j += nsections)
+        {
+            if (j >= nzero) printf ".globl bench_s%d\nbench_s%d:\n", j, j
+        }
+        printf "\t.nops 4\n"
+    }
+    # Point relocs only at sections that have a zero-offset symbol.
+    printf ".data\n"
+    if (nzero > 0) for (i = 0; i < nrelocs; ++i) printf "\t.quad .text.s%d\n", i % nzero
+    printf ".section .debug_info,\"\",@progbits\n"
+    for (i = 0; i < ndebugrelocs; ++i) printf "\t.quad .text.s%d + %d\n", i % nsections, (i % 2) * 4
+}'
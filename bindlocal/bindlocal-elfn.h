@@ -0,0 +1,162 @@
+/* The body of bindlocal.c, for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static ElfN(Dyn) *ELFN(find_dyn)(struct elfimage *img, Elf64_Sxword tag)
+{
+	ElfN(Shdr) *shdr = img->dynamic_shdr;
+	if (!shdr) return NULL;
+	for (ElfN(Dyn) *d = SECTION_DATA(*shdr);
+			d < (ElfN(Dyn) *) ((char*) SECTION_DATA(*shdr) + GET(shdr->sh_size))
+				&& d->d_tag != DT_NULL;
+			++d)
+	{
+		if (GET(d->d_tag) == tag) return d;
+	}
+	return NULL;
+}
+
+/* Can references to 'sym' be bound to its definition here? It must be
+ * defined, relative to the load address (not SHN_ABS), and not something
+ * that needs more than adding that address (TLS, an ifunc). */
+static _Bool ELFN(bindable)(const ElfN(Sym) *sym)
+{
+	if (GET(sym->st_shndx) == SHN_UNDEF || GET(sym->st_shndx) == SHN_ABS
+			|| GET(sym->st_shndx) == SHN_COMMON) return 0;
+	switch (ELFN_ST_TYPE(sym->st_info))
+	{
+		case STT_NOTYPE:
+		case STT_OBJECT:
+		case STT_FUNC:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* Move the RELATIVE relocs to the front, keeping the order otherwise, and
+ * return how many there are. */
+static Elf64_Word ELFN(partition_relative)(ElfN(Rela) *relas, Elf64_Word n, Elf64_Word relative)
+{
+	ElfN(Rela) *others = malloc(n * sizeof (ElfN(Rela)));
+	if (!others) err(1, "allocating relocs");
+	Elf64_Word nrelative = 0, nothers = 0;
+	for (Elf64_Word i = 0; i < n; ++i)
+	{
+		if (ELFN_R_TYPE(GET(relas[i].r_info)) == relative) relas[nrelative++] = relas[i];
+		else others[nothers++] = relas[i];
+	}
+	memcpy(relas + nrelative, others, nothers * sizeof (ElfN(Rela)));
+	free(others);
+	return nrelative;
+}
+
+static int ELFN(bindlocal_pass)(struct elfimage *img, struct nameset *names, _Bool protect)
+{
+	double t = elfimage_clock();
+	ElfN(Ehdr) *ehdr = img->ehdr;
+	const struct reloc_types *types = NULL;
+	for (unsigned i = 0; i < sizeof reloc_types / sizeof reloc_types[0]; ++i)
+	{
+		if (reloc_types[i].elfclass == ELFN_CLASS
+				&& reloc_types[i].machine == GET(ehdr->e_machine)) types = &reloc_types[i];
+	}
+	ElfN(Shdr) *shdrs = img->shdrs;
+	ElfN(Shdr) *dynsym_shdr = img->dynsym_shdr;
+	if (!dynsym_shdr) return 0; // nothing to do
+	if (!types)
+	{
+		elfimage_warnx(img, "don't know the dynamic relocs of machine %u (ELF%d)",
+			(unsigned) GET(ehdr->e_machine), ELFN_CLASS == ELFCLASS32 ? 32 : 64);
+		return 1;
+	}
+	unsigned dynsym_shndx = dynsym_shdr - shdrs;
+	Elf64_Word nsyms = GET(dynsym_shdr->sh_size) / sizeof (ElfN(Sym));
+	ElfN(Sym) *dynsyms = SECTION_DATA(*dynsym_shdr);
+	const char *dynstr = SECTION_DATA(shdrs[GET(dynsym_shdr->sh_link)]);
+
+	/* 1 for the symbols we may bind, 2 once we have. */
+	unsigned char *status = calloc(nsyms ? nsyms : 1, 1);
+	if (!status) err(1, "allocating symbol flags");
+	for (Elf64_Word i = 1; i < nsyms; ++i)
+	{
+		if (dynsyms[i].st_name && ELFN(bindable)(&dynsyms[i])
+				&& nameset_contains(names, &dynstr[GET(dynsyms[i].st_name)]))
+		{
+			status[i] = 1;
+		}
+	}
+	elfimage_phase(img, "match_symbols", &t);
+
+	ElfN(Dyn) *jmprel = ELFN(find_dyn)(img, DT_JMPREL);
+	ElfN(Dyn) *rela = ELFN(find_dyn)(img, DT_RELA);
+	ElfN(Dyn) *relacount = ELFN(find_dyn)(img, DT_RELACOUNT);
+	unsigned long nrewritten = 0;
+	unsigned nbound = 0;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) != SHT_RELA || GET(shdr->sh_link) != dynsym_shndx
+				|| !(GET(shdr->sh_flags) & SHF_ALLOC)) continue;
+		if (jmprel && GET(shdr->sh_addr) == GET(jmprel->d_un.d_ptr)) continue;
+		ElfN(Rela) *relas = SECTION_DATA(*shdr);
+		Elf64_Word nrelas = GET(shdr->sh_size) / sizeof (ElfN(Rela));
+		unsigned long nhere = 0;
+		for (ElfN(Rela) *r = relas; r < relas + nrelas; ++r)
+		{
+			Elf64_Word type = ELFN_R_TYPE(GET(r->r_info));
+			Elf64_Word symind = ELFN_R_SYM(GET(r->r_info));
+			if (type != types->abs && type != types->glob_dat) continue;
+			if (symind >= nsyms || !status[symind]) continue;
+			ElfN(Sym) *sym = &dynsyms[symind];
+			Elf64_Sxword addend = (type == types->glob_dat && !types->glob_dat_has_addend)
+				? 0 : GET(r->r_addend);
+			if (ELFIMAGE_VERBOSE(img, 1))
+			{
+				elfimage_note(img, "binding reloc at 0x%lx against `%s'+%ld locally",
+					(unsigned long) GET(r->r_offset), &dynstr[GET(sym->st_name)], (long) addend);
+			}
+			SET(r->r_info, ELFN_R_INFO(0, types->relative));
+			SET(r->r_addend, GET(sym->st_value) + addend);
+			if (status[symind] == 1) { status[symind] = 2; ++nbound; }
+			++nhere;
+		}
+		elfimage_count(img, ELFIMAGE_RELOCS_SCANNED, nrelas);
+		nrewritten += nhere;
+		if (nhere && relacount && rela && GET(shdr->sh_addr) == GET(rela->d_un.d_ptr))
+		{
+			Elf64_Word nrelative = ELFN(partition_relative)(relas, nrelas, types->relative);
+			if (ELFIMAGE_VERBOSE(img, 1))
+			{
+				elfimage_note(img, "DT_RELACOUNT was %lu, now %lu",
+					(unsigned long) GET(relacount->d_un.d_val), (unsigned long) nrelative);
+			}
+			SET(relacount->d_un.d_val, nrelative);
+		}
+	}
+	elfimage_count(img, ELFIMAGE_RELOCS_REWRITTEN, nrewritten);
+	elfimage_phase(img, "rewrite_relocs", &t);
+
+	if (protect)
+	{
+		for (Elf64_Word i = 1; i < nsyms; ++i)
+		{
+			if (!status[i] || ELFN_ST_BIND(dynsyms[i].st_info) == STB_LOCAL
+					|| ELFN_ST_VISIBILITY(dynsyms[i].st_other) == STV_PROTECTED) continue;
+			if (ELFIMAGE_VERBOSE(img, 1))
+			{
+				elfimage_note(img, "making `%s' protected", &dynstr[GET(dynsyms[i].st_name)]);
+			}
+			dynsyms[i].st_other = (dynsyms[i].st_other & ~0x3) | STV_PROTECTED;
+			elfimage_count(img, ELFIMAGE_SYMBOLS_PATCHED, 1);
+		}
+	}
+	free(status);
+
+	/* ld.so remembers the last symbol it looked up, so this is the most we
+	 * save: some of these relocs would have hit that cache. */
+	if (nrewritten)
+	{
+		elfimage_note(img, "%lu relocs against %u symbols now RELATIVE: up to %lu "
+			"fewer symbol lookups at load time", nrewritten, nbound, nrewritten);
+	}
+	return 0;
+}
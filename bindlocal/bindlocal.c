@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <libgen.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "elfimage.h"
+#include "nameset.h"
+#include "batch.h"
+#include "bindlocal.h"
+
+/*
+ Here we take a linked shared object (or PIE) and some of its dynamic
+ symbols that we are told nobody will interpose on, and bind references
+ to them locally, as -Bsymbolic would have done at link time but only
+ for those symbols. Each absolute or GOT reloc (R_X86_64_64, _GLOB_DAT)
+ against one of them that the object defines becomes a RELATIVE reloc
+ with the symbol's value folded into the addend. ld.so then just adds
+ the load address, rather than looking the symbol up in every object in
+ scope. With -p we also make the symbols STV_PROTECTED, so that the
+ object says what it now assumes.
+
+ The symbols can be named on the command line or in list files (-f), and
+ the names can be glob patterns, e.g. 'mylib_*'.
+
+ Where DT_RELACOUNT is in use, we move the RELATIVE relocs to the front of
+ .rela.dyn, in their original order, and count them in, so that ld.so
+ takes its fast path for them.
+
+ We leave the PLT relocs (JUMP_SLOT) alone: ld.so expects nothing else in
+ DT_JMPREL, and binds them lazily anyway, unless told otherwise.
+
+ FIXME: do REL too (i386, ARM). */
+
+#ifdef BINDLOCAL_AS_LIBRARY
+int bindlocal(char *filename, char **symbols, unsigned nsymbols, _Bool protect)
+{
+	struct nameset names = { .globs = 1 };
+	for (unsigned i = 0; i < nsymbols; ++i) nameset_add(&names, symbols[i]);
+	struct elfimage img;
+	int ret = elfimage_open_partial(&img, filename, NULL);
+	if (!ret)
+	{
+		ret = bindlocal_pass(&img, &names, protect);
+		if (!ret) ret = elfimage_commit(&img);
+		elfimage_close(&img);
+	}
+	nameset_destroy(&names);
+	return ret;
+}
+#else
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-p] [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-o <output>] [-f <listfile>]... <filename> [<sym>|<pattern>...]\n"
+		"       %s [-p] [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-f <listfile>]... -F|--files-from <filelist> [<sym>|<pattern>...]\n",
+		basename, basename);
+}
+struct bindlocal_args
+{
+	struct nameset *names;
+	_Bool protect;
+};
+static int run_pass(struct elfimage *img, void *arg)
+{
+	struct bindlocal_args *a = arg;
+	return bindlocal_pass(img, a->names, a->protect);
+}
+int main(int argc, char **argv)
+{
+	struct nameset names = { .globs = 1 };
+	struct bindlocal_args args = { .names = &names };
+	_Bool have_list = 0;
+	struct elftin_batch batch = { .njobs = 1, .partial = 1, .pass = run_pass, .arg = &args };
+	elftin_batch_stamp_word(&batch, "bindlocal");
+	static const struct option longopts[] = {
+		{ "protect", no_argument, NULL, 'p' },
+		ELFTIN_BATCH_OPTIONS, { 0 }
+	};
+	_Bool have_files = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+pf:o:j:F:nSv", longopts, NULL)))
+	{
+		switch (opt)
+		{
+			case 'p':
+				args.protect = 1;
+				elftin_batch_stamp_word(&batch, "-p");
+				break;
+			case 'f':
+				if (0 != nameset_add_file(&names, optarg)) return 1;
+				have_list = 1;
+				elftin_batch_stamp_word(&batch, "-f");
+				elftin_batch_stamp_word(&batch, optarg);
+				break;
+			case 'o': batch.output = optarg; break;
+			case 'j': batch.njobs = atoi(optarg); break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_files = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: usage(basename(argv[0])); return 1;
+		}
+	}
+	/* Given a file list, every argument is a symbol. */
+	if (!have_files && argc - optind >= 1) elftin_batch_add(&batch, argv[optind++]);
+	if ((!batch.files.nnames && !have_files) || (argc - optind < 1 && !have_list))
+	{
+		usage(basename(argv[0]));
+		return 1;
+	}
+
+	for (int i = optind; i < argc; ++i)
+	{
+		nameset_add(&names, argv[i]);
+		elftin_batch_stamp_word(&batch, argv[i]);
+	}
+	nameset_freeze(&names); // the files may be done in parallel
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	nameset_destroy(&names);
+	return ret;
+}
+#endif
+
+#define SECTION_DATA(shdr) ELFN_SECTION_DATA(img, (shdr))
+
+/* The relocs we rewrite, per machine and class: the ELF32 rows are x32
+ * and AArch64 ILP32. 'abs' is the address-sized absolute reloc. Some
+ * psABIs (x86-64) define GLOB_DAT as plain S; others (AArch64) as S + A. */
+static const struct reloc_types
+{
+	unsigned char elfclass;
+	Elf64_Half machine;
+	Elf64_Word abs;
+	Elf64_Word glob_dat;
+	Elf64_Word relative;
+	_Bool glob_dat_has_addend;
+} reloc_types[] = {
+	{ ELFCLASS64, EM_X86_64,  R_X86_64_64,         R_X86_64_GLOB_DAT,      R_X86_64_RELATIVE,      0 },
+	{ ELFCLASS64, EM_AARCH64, R_AARCH64_ABS64,     R_AARCH64_GLOB_DAT,     R_AARCH64_RELATIVE,     1 },
+	{ ELFCLASS32, EM_X86_64,  R_X86_64_32,         R_X86_64_GLOB_DAT,      R_X86_64_RELATIVE,      0 },
+	{ ELFCLASS32, EM_AARCH64, R_AARCH64_P32_ABS32, R_AARCH64_P32_GLOB_DAT, R_AARCH64_P32_RELATIVE, 1 }
+};
+
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "bindlocal-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "bindlocal-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "bindlocal-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "bindlocal-elfn.h"
+
+int bindlocal_pass(struct elfimage *img, struct nameset *names, _Bool protect)
+{
+	return ELFIMAGE_DISPATCH(img, bindlocal_pass, img, names, protect);
+}
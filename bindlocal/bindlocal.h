@@ -0,0 +1,10 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+struct nameset;
+int bindlocal(char *filename, char **symbols, unsigned nsymbols, _Bool protect);
+int bindlocal_pass(struct elfimage *img, struct nameset *names, _Bool protect);
+#ifdef __cplusplus
+}
+#endif
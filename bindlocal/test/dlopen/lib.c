@@ -0,0 +1,12 @@
+/* Data and functions reached through the GOT and through pointers, so
+ * with symbolic dynamic relocs against them. We bind the lib_ ones. */
+int lib_counter = 1;
+int other_counter = 2;
+int *lib_ptrs[] = { &lib_counter, &other_counter };
+int lib_get(void) { return lib_counter; }
+int (*lib_getter)(void) = lib_get;
+int check(void)
+{
+	return lib_ptrs[0] == &lib_counter && lib_ptrs[1] == &other_counter
+		&& lib_getter == lib_get && lib_getter() == 1 && other_counter == 2;
+}
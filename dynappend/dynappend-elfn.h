@@ -0,0 +1,31 @@
+/* dynappend_pass for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static int ELFN(dynappend_pass)(struct elfimage *img, const char *tagnum_string, long *maybe_tagval)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	_Bool done_it = 0;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_DYNAMIC)
+		{
+			ElfN(Dyn) *end = (ElfN(Dyn) *) ((char*) ELFN_SECTION_DATA(img, *shdr) + GET(shdr->sh_size));
+			for (ElfN(Dyn) *d = ELFN_SECTION_DATA(img, *shdr);
+					(uintptr_t) d <= (uintptr_t) end;
+					++d)
+			{
+				if (!d->d_tag && (uintptr_t)(d+1) <= (uintptr_t) end)
+				{
+					/* We've found our insertion point. */
+					*d = (ElfN(Dyn)) { 0 };
+					SET(d->d_tag, atoi(tagnum_string));
+					if (maybe_tagval) SET(d->d_un.d_val, *maybe_tagval);
+					*(d+1) = (ElfN(Dyn)) { .d_tag = DT_NULL };
+					done_it = 1;
+					break;
+				}
+			}
+		}
+	}
+	return !(done_it == 1);
+}
@@ -3,115 +3,110 @@
 #include <libgen.h>
 #include <elf.h>
 #include <stdio.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/mman.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <err.h>
 
-#ifdef DYNAPPEND_AS_LIBRARY
-#if 0 /* no header yet */
+#include "elfimage.h"
+#include "batch.h"
 #include "dynappend.h"
-#endif
-#endif
 
 /*
  Here we rewrite an ELF file so that
  a spare ELF dynamic section tag is instantiated with 
  */
 
-static void usage(const char *basename)
-{
-	fprintf(stderr, "Usage: %s <filename> <tagnum> [tagval-as-decimal-number]\n", basename);
-}
 #ifdef DYNAPPEND_AS_LIBRARY
 int dynappend(char *filename, char *tagnum_string, long *maybe_tagval)
 {
+	const char *output = NULL;
+	struct elfimage img;
+	int ret = elfimage_open_partial(&img, filename, output);
+	if (ret) return ret;
+	ret = dynappend_pass(&img, tagnum_string, maybe_tagval);
+	if (!ret) ret = elfimage_commit(&img);
+	elfimage_close(&img);
+	return ret;
+}
 #else
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-o <output>] <filename> <tagnum> [tagval-as-decimal-number]\n"
+		"       %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] -F|--files-from <filelist> <tagnum> [tagval-as-decimal-number]\n",
+		basename, basename);
+}
+struct pass_args
+{
+	char *tagnum_string;
+	long *maybe_tagval;
+};
+static int run_pass(struct elfimage *img, void *arg)
+{
+	struct pass_args *a = arg;
+	return dynappend_pass(img, a->tagnum_string, a->maybe_tagval);
+}
 int main(int argc, char **argv)
 {
-	if (argc < 3)
+	struct pass_args args = { 0 };
+	struct elftin_batch batch = { .njobs = 1, .partial = 1, .pass = run_pass, .arg = &args };
+	elftin_batch_stamp_word(&batch, "dynappend");
+	static const struct option longopts[] = { ELFTIN_BATCH_OPTIONS, { 0 } };
+	_Bool have_files = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+j:o:F:nSv", longopts, NULL)))
+	{
+		switch (opt)
+		{
+			case 'j': batch.njobs = atoi(optarg); break;
+			case 'o': batch.output = optarg; break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_files = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: usage(basename(argv[0])); return 1;
+		}
+	}
+	/* Given a file list, there is no <filename> argument. */
+	if (!have_files && argc - optind >= 1) elftin_batch_add(&batch, argv[optind++]);
+	if ((!batch.files.nnames && !have_files) || argc - optind < 1)
 	{
 		usage(basename(argv[0]));
 		return 1;
 	}
 
-	char *filename = argv[1];
-	char *tagnum_string = argv[2];
+	args.tagnum_string = argv[optind];
+	for (int i = optind; i < argc; ++i) elftin_batch_stamp_word(&batch, argv[i]);
 	long tagval_if_needed;
-	long *maybe_tagval = NULL;
-	if (argc >= 4)
+	if (argc - optind >= 2)
 	{
-		int ret = sscanf(argv[3], "%ld", &tagval_if_needed);
-		if (ret > 0) maybe_tagval = &tagval_if_needed;
+		int ret = sscanf(argv[optind + 1], "%ld", &tagval_if_needed);
+		if (ret > 0) args.maybe_tagval = &tagval_if_needed;
 	}
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	return ret;
+}
 #endif
-	int fd = open(filename, O_RDWR);
-	if (fd == -1)
-	{
-		warnx("could not open %s", filename);
-		return 2;
-	}
-
-	struct stat buf;
-	int ret = fstat(fd, &buf);
-
-	long page_size = sysconf(_SC_PAGESIZE);
-
-	if (ret)
-	{
-		warnx("could not stat %s", filename);
-		return 3;
-	}
-
-	size_t length = (buf.st_size % page_size == 0) ? buf.st_size
-				: page_size * (buf.st_size / page_size + 1);
-
-	void *mapping = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-	if (mapping == MAP_FAILED)
-	{
-		warnx("could not mmap %s", filename);
-		return 4;
-	}
-
-	/* Okay, now do the dynappending.
-	 * FIXME: don't assume 64-bit and native-endianness. */
-	Elf64_Ehdr *ehdr = (Elf64_Ehdr *) mapping;
-	if (0 != strncmp(ehdr->e_ident, "\x7F""ELF", 4))
-	{
-		warnx("not an ELF file: %s", filename);
-		return 5;
-	}
-#define SECTION_DATA(shdr) ((void*)((uintptr_t) mapping + (shdr).sh_offset))
-	Elf64_Shdr *shdrs = (Elf64_Shdr *) (ehdr->e_shoff ? (char*) mapping + ehdr->e_shoff : NULL);
-	const char *shstrtab = SECTION_DATA(shdrs[ehdr->e_shstrndx]);
-	_Bool done_it = 0;
-	for (Elf64_Shdr *shdr = shdrs; shdr < shdrs + ehdr->e_shnum; ++shdr)
-	{
-		if (shdr->sh_type == SHT_DYNAMIC)
-		{
-			const char *strtab = SECTION_DATA(shdrs[shdr->sh_link]);
-			Elf64_Dyn *end = (Elf64_Dyn *) ((char*) SECTION_DATA(*shdr) + shdr->sh_size);
-			for (Elf64_Dyn *d = SECTION_DATA(*shdr);
-					(uintptr_t) d <= (uintptr_t) end;
-					++d)
-			{
-				if (!d->d_tag && (uintptr_t)(d+1) <= (uintptr_t) end)
-				{
-					/* We've found our insertion point. */
-					*d = (Elf64_Dyn) { .d_tag = atoi(tagnum_string) };
-					if (maybe_tagval) d->d_un.d_val = *maybe_tagval;
-					*(d+1) = (Elf64_Dyn) { .d_tag = DT_NULL };
-					done_it = 1;
-					break;
-				}
-			}
-		}
-	}
-
-	munmap(mapping, length);
-	close(fd);
-	return !(done_it == 1);
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "dynappend-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "dynappend-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "dynappend-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "dynappend-elfn.h"
+/* Returns 1 if there was no spare slot. */
+int dynappend_pass(struct elfimage *img, const char *tagnum_string, long *maybe_tagval)
+{
+	return ELFIMAGE_DISPATCH(img, dynappend_pass, img, tagnum_string, maybe_tagval);
 }
@@ -0,0 +1,9 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+int dynappend(char *filename, char *tagnum_string, long *maybe_tagval);
+int dynappend_pass(struct elfimage *img, const char *tagnum_string, long *maybe_tagval);
+#ifdef __cplusplus
+}
+#endif
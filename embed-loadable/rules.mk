@@ -17,10 +17,10 @@ $(warning "You will need a special/hacked ld.so for the embedded file to be load
 
 %-shifted.so: %.so $(OBJ_NAME) $(SHIFT_ELF)
 	offset=$$( printf "%d" "$$( $(ELFTIN)/custom-phdrs/predict-meta-offset.sh $(OBJ_NAME) )" ); \
-	cp "$<" "$@" && $(SHIFT_ELF) "$@" $$offset || (rm -f "$@"; false)
+	$(SHIFT_ELF) -o "$@" "$<" $$offset
 %-shifted: % $(OBJ_NAME) $(SHIFT_ELF)
 	offset=$$( printf "%d" "$$( $(ELFTIN)/custom-phdrs/predict-meta-offset.sh $(OBJ_NAME) )" ); \
-	cp "$<" "$@" && $(SHIFT_ELF) "$@" $$offset || (rm -f "$@"; false)
+	$(SHIFT_ELF) -o "$@" "$<" $$offset
 
 clean::
 	rm -f $(OBJ_NAME) $(OBJ_NAME).with-$(PHDR_NAME)-phdr
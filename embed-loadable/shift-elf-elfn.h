@@ -0,0 +1,22 @@
+/* shift_elf_pass for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static int ELFN(shift_elf_pass)(struct elfimage *img, long offset)
+{
+	ElfN(Ehdr) *ehdr = img->ehdr;
+	if (GET(ehdr->e_phoff)) SET(ehdr->e_phoff, GET(ehdr->e_phoff) + offset);
+	if (GET(ehdr->e_shoff)) SET(ehdr->e_shoff, GET(ehdr->e_shoff) + offset);
+	
+	ElfN(Shdr) *shdrs = img->shdrs;
+	for (unsigned i = 0; i < img->shnum; ++i)
+	{
+		SET(shdrs[i].sh_offset, GET(shdrs[i].sh_offset) + offset);
+	}
+	
+	ElfN(Phdr) *phdrs = img->phdrs;
+	for (unsigned i = 0; i < img->phnum; ++i)
+	{
+		SET(phdrs[i].p_offset, GET(phdrs[i].p_offset) + offset);
+	}
+	return 0;
+}
@@ -3,13 +3,12 @@
 #include <libgen.h>
 #include <elf.h>
 #include <stdio.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/mman.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <err.h>
+#include "elfimage.h"
+#include "batch.h"
+#include "shift-elf.h"
 
 /*
  Here we rewrite an ELF file so that all the file offsets
@@ -18,76 +17,87 @@
  The only structures which *should* contain file offsets
  are the ELF header, program headers and section headers.
  So the easiest way to implement this is a C program which
- uses mmap() to traverse and update those structures.
+ maps just those structures and updates them.
  */
 
+#ifdef SHIFT_ELF_AS_LIBRARY
+int shift_elf(char *filename, long offset)
+{
+	const char *output = NULL;
+	
+	/* We need only the headers, so we map only those. */
+	struct elfimage img;
+	int ret = elfimage_open_partial(&img, filename, output);
+	if (ret) return ret;
+	ret = shift_elf_pass(&img, offset);
+	if (!ret) ret = elfimage_commit(&img);
+	elfimage_close(&img);
+	return ret;
+}
+#else
 static void usage(const char *basename)
 {
-	fprintf(stderr, "Usage: %s <filename> <offset>\n", basename);
+	fprintf(stderr, "Usage: %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-o <output>] <filename> <offset>\n"
+		"       %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] -F|--files-from <filelist> <offset>\n", basename, basename);
 }
+static int run_pass(struct elfimage *img, void *arg)
+{ return shift_elf_pass(img, *(long *) arg); }
 int main(int argc, char **argv)
 {
-	if (argc < 3)
+	long offset;
+	struct elftin_batch batch = { .njobs = 1, .partial = 1, .pass = run_pass, .arg = &offset };
+	elftin_batch_stamp_word(&batch, "shift-elf");
+	static const struct option longopts[] = { ELFTIN_BATCH_OPTIONS, { 0 } };
+	_Bool have_files = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+j:o:F:nSv", longopts, NULL)))
 	{
-		usage(basename(argv[0]));
-		return 1;
+		switch (opt)
+		{
+			case 'j': batch.njobs = atoi(optarg); break;
+			case 'o': batch.output = optarg; break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_files = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: usage(basename(argv[0])); return 1;
+		}
 	}
-	
-	char *filename = argv[1];
-	char *offset_str = argv[2];
-	int offset = atoi(offset_str);
-	
-	int fd = open(filename, O_RDWR);
-	if (fd == -1)
+	/* Given a file list, there is no <filename> argument. */
+	if (!have_files && argc - optind >= 1) elftin_batch_add(&batch, argv[optind++]);
+	if ((!batch.files.nnames && !have_files) || argc - optind < 1)
 	{
-		warnx("could not open %s", filename);
-		return 2;
-	}
-	
-	struct stat buf;
-	int ret = fstat(fd, &buf);
-
-	long page_size = sysconf(_SC_PAGESIZE);
-	
-	if (ret)
-	{
-		warnx("could not stat %s", filename);
-		return 3;
-	}
-	
-	size_t length = (buf.st_size % page_size == 0) ? buf.st_size
-				: page_size * (buf.st_size / page_size + 1);
-	
-	void *mapping = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-	if (mapping == MAP_FAILED)
-	{
-		warnx("could not mmap %s", filename);
-		return 4;
-	}
-	
-	/* Okay, now do the shifting.
-	 * FIXME: don't assume 64-bit and native-endianness. */
-	Elf64_Ehdr *ehdr = (Elf64_Ehdr *) mapping;
-	if (0 != strncmp(ehdr->e_ident, "\x7F""ELF", 4))
-	{
-		warnx("not an ELF file: %s", filename);
-		return 5;
-	}
-	Elf64_Shdr *shdrs = (Elf64_Shdr *) (ehdr->e_shoff ? (char*) mapping + ehdr->e_shoff : NULL);
-	Elf64_Phdr *phdrs = (Elf64_Phdr *) (ehdr->e_phoff ? (char*) mapping + ehdr->e_phoff : NULL);
-	if (ehdr->e_phoff) ehdr->e_phoff += offset;
-	if (ehdr->e_shoff) ehdr->e_shoff += offset;
-	
-	for (int i = 0; i < ehdr->e_shnum; ++i)
-	{
-		shdrs[i].sh_offset += offset;
-	}
-	
-	for (int i = 0; i < ehdr->e_phnum; ++i)
-	{
-		phdrs[i].p_offset += offset;
+		usage(basename(argv[0]));
+		return 1;
 	}
 	
-	munmap(mapping, length);
-	close(fd);
+	char *offset_str = argv[optind];
+	offset = atoi(offset_str);
+	elftin_batch_stamp_word(&batch, offset_str);
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	return ret;
+}
+#endif
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "shift-elf-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "shift-elf-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "shift-elf-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "shift-elf-elfn.h"
+int shift_elf_pass(struct elfimage *img, long offset)
+{
+	return ELFIMAGE_DISPATCH(img, shift_elf_pass, img, offset);
 }
@@ -0,0 +1,9 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+int shift_elf(char *filename, long offset);
+int shift_elf_pass(struct elfimage *img, long offset);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+/* find_hash_tables for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static void ELFN(find_hash_tables)(struct elfimage *img, struct hash_tables *t)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	ElfN(Shdr) *dynsym_shdr = img->dynsym_shdr;
+	*t = (struct hash_tables) { .dynsym = dynsym_shdr - shdrs };
+	t->nsyms = GET(dynsym_shdr->sh_size) / sizeof (ElfN(Sym));
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_link) != t->dynsym) continue;
+		if (GET(shdr->sh_type) == SHT_GNU_HASH && !t->gnu) t->gnu = shdr - shdrs;
+		if (GET(shdr->sh_type) == SHT_HASH && !t->sysv) t->sysv = shdr - shdrs;
+	}
+	/* The stats say whether these are any good. */
+	if (t->gnu && GET(shdrs[t->gnu].sh_size) >= sizeof (struct gnu_hash_header))
+	{
+		struct gnu_hash_header *hdr = ELFN_SECTION_DATA(img, shdrs[t->gnu]);
+		t->symoffset = GET(hdr->symoffset);
+	}
+	if (t->sysv && GET(shdrs[t->sysv].sh_size) >= 2 * sizeof (Elf64_Word))
+	{
+		Elf64_Word *words = ELFN_SECTION_DATA(img, shdrs[t->sysv]);
+		t->sysv_nchain = GET(words[1]);
+	}
+}
@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <libgen.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "elfimage.h"
+#include "batch.h"
+#include "gnuhash.h"
+#include "hashopt.h"
+
+/*
+ Here we re-size the buckets of a shared object's dynamic symbol hash
+ tables (.gnu.hash and .hash), within the space they already have.
+
+ The linker picks a bucket count from a fixed table keyed on the number
+ of symbols, and a Bloom filter size from a rule of thumb, and that is
+ that. For a big DSO this can leave long chains, or a filter that lets
+ most misses through -- and since ld.so tries each DSO in turn, most of
+ its lookups in any one DSO are misses. So we measure the tables as
+ they are, then try every split of the same bytes between Bloom words
+ and buckets (and, for .hash, the few largest bucket counts that fit),
+ and rebuild them if we can expect fewer probes per lookup.
+
+ A new GNU bucket count means the dynsyms have to be regrouped by bucket,
+ which moves them, and the SysV table is then rebuilt to match.
+
+ FIXME: we could do better still by growing the tables, but they live
+ in a loaded segment, so that means moving them (and the dynsyms) to a
+ new one, as sym2dyn does for .dynstr.
+ */
+
+#ifdef HASHOPT_AS_LIBRARY
+int hashopt(char *filename)
+{
+	struct elfimage img;
+	int ret = elfimage_open_partial(&img, filename, NULL);
+	if (ret) return ret;
+	ret = hashopt_pass(&img);
+	if (!ret) ret = elfimage_commit(&img);
+	elfimage_close(&img);
+	return ret;
+}
+#else
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-o <output>] [-F|--files-from <listfile>] "
+		"<filename>...\n", basename);
+}
+static int run_pass(struct elfimage *img, void *arg)
+{ (void) arg; return hashopt_pass(img); }
+int main(int argc, char **argv)
+{
+	struct elftin_batch batch = { .njobs = 1, .partial = 1, .pass = run_pass };
+	elftin_batch_stamp_word(&batch, "hashopt");
+	static const struct option longopts[] = { ELFTIN_BATCH_OPTIONS, { 0 } };
+	_Bool have_list = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+j:o:F:nSv", longopts, NULL)))
+	{
+		switch (opt)
+		{
+			case 'j': batch.njobs = atoi(optarg); break;
+			case 'o': batch.output = optarg; break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_list = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: usage(basename(argv[0])); return 1;
+		}
+	}
+	if (argc - optind < 1 && !have_list)
+	{
+		usage(basename(argv[0]));
+		return 1;
+	}
+
+	for (int i = optind; i < argc; ++i) elftin_batch_add(&batch, argv[i]);
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	return ret;
+}
+#endif
+
+/* The dynsym's hash tables, by section index (0 for none), with its
+ * symbol count, and the counts the tables give. */
+struct hash_tables
+{
+	unsigned dynsym, gnu, sysv;
+	Elf64_Word nsyms, symoffset, sysv_nchain;
+};
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "hashopt-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "hashopt-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "hashopt-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "hashopt-elfn.h"
+
+static void note_stats(struct elfimage *img, const char *table, const char *when,
+	const struct hash_table_stats *s)
+{
+	if (s->bloom_size)
+	{
+		elfimage_note(img, "%s %s: %u buckets (%u empty, longest chain %u), %u Bloom words "
+			"(shift %u, %.1f%% false positives): %.3f probes per hit, %.3f per miss, %.3f expected",
+			table, when, (unsigned) s->nbuckets, (unsigned) s->empty_buckets,
+			(unsigned) s->longest_chain, (unsigned) s->bloom_size, (unsigned) s->bloom_shift,
+			100 * s->bloom_false_positive_rate, s->probes_per_hit,
+			s->bloom_false_positive_rate * s->probes_per_miss, hash_table_expected_probes(s));
+	}
+	else
+	{
+		elfimage_note(img, "%s %s: %u buckets (%u empty, longest chain %u): "
+			"%.3f probes per hit, %.3f per miss, %.3f expected",
+			table, when, (unsigned) s->nbuckets, (unsigned) s->empty_buckets,
+			(unsigned) s->longest_chain, s->probes_per_hit, s->probes_per_miss,
+			hash_table_expected_probes(s));
+	}
+}
+
+/* Returns 6 if a table is malformed or cannot be rebuilt, like sym2dyn. */
+int hashopt_pass(struct elfimage *img)
+{
+	double t = elfimage_clock();
+	if (!img->dynsym_shdr) return 0; // nothing to do
+	struct hash_tables tables;
+	ELFIMAGE_DISPATCH(img, find_hash_tables, img, &tables);
+	unsigned dynsym_shndx = tables.dynsym;
+	Elf64_Word nsyms = tables.nsyms;
+
+	struct hash_table_stats gnu_before, gnu_best, sysv_before, sysv_best;
+	_Bool rebuild_gnu = 0, rebuild_sysv = 0;
+	unsigned gnu_hash = tables.gnu, sysv_hash = tables.sysv;
+	Elf64_Word symoffset = 0;
+	if (gnu_hash)
+	{
+		if (0 != gnu_hash_stats(img, gnu_hash, nsyms, &gnu_before))
+		{
+			elfimage_warnx(img, "GNU hash table does not match the dynsym");
+			return 6;
+		}
+		symoffset = tables.symoffset;
+		note_stats(img, "GNU hash table", "as it was", &gnu_before);
+		rebuild_gnu = (0 == gnu_hash_tune(img, gnu_hash, dynsym_shndx, symoffset, &gnu_best))
+			&& hash_table_expected_probes(&gnu_best) < hash_table_expected_probes(&gnu_before);
+	}
+	if (sysv_hash)
+	{
+		if (0 != sysv_hash_stats(img, sysv_hash, &sysv_before) || tables.sysv_nchain != nsyms)
+		{
+			elfimage_warnx(img, "SysV hash table does not match the dynsym");
+			return 6;
+		}
+		note_stats(img, "SysV hash table", "as it was", &sysv_before);
+		if (0 == sysv_hash_tune(img, sysv_hash, dynsym_shndx, &sysv_best)
+			&& hash_table_expected_probes(&sysv_best) < hash_table_expected_probes(&sysv_before))
+		{
+			rebuild_sysv = 1;
+		}
+		else sysv_best = sysv_before;
+	}
+	elfimage_phase(img, "tune", &t);
+
+	if (rebuild_gnu)
+	{
+		Elf64_Word *new_to_old = malloc((nsyms ? nsyms : 1) * sizeof (Elf64_Word));
+		if (!new_to_old) err(EXIT_FAILURE, "allocating dynsym permutation");
+		gnu_hash_order(img, dynsym_shndx, symoffset, gnu_best.nbuckets, new_to_old);
+		Elf64_Word nmoved = 0;
+		for (Elf64_Word i = 0; i < nsyms; ++i) nmoved += (new_to_old[i] != i);
+		if (nmoved)
+		{
+			if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "Moving %u dynsyms into GNU hash bucket order", (unsigned) nmoved);
+			if (0 != dynsym_permute(img, dynsym_shndx, new_to_old))
+			{
+				free(new_to_old);
+				return 6;
+			}
+			/* The SysV chains go by symbol index, so must be redone. */
+			if (sysv_hash) rebuild_sysv = 1;
+		}
+		free(new_to_old);
+		if (0 != gnu_hash_build(img, gnu_hash, dynsym_shndx, gnu_best.nbuckets, symoffset))
+		{
+			elfimage_warnx(img, "GNU hash table is too small to rebuild");
+			return 6;
+		}
+		struct hash_table_stats after;
+		gnu_hash_stats(img, gnu_hash, nsyms, &after);
+		note_stats(img, "GNU hash table", "now", &after);
+		elfimage_count(img, ELFIMAGE_HASH_TABLES_REBUILT, 1);
+	}
+	if (rebuild_sysv)
+	{
+		if (0 != sysv_hash_build(img, sysv_hash, dynsym_shndx, sysv_best.nbuckets))
+		{
+			elfimage_warnx(img, "SysV hash table is too small to rebuild");
+			return 6;
+		}
+		struct hash_table_stats after;
+		sysv_hash_stats(img, sysv_hash, &after);
+		note_stats(img, "SysV hash table", "now", &after);
+		elfimage_count(img, ELFIMAGE_HASH_TABLES_REBUILT, 1);
+	}
+	elfimage_phase(img, "rebuild", &t);
+	return 0;
+}
@@ -0,0 +1,9 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+int hashopt(char *filename);
+int hashopt_pass(struct elfimage *img);
+#ifdef __cplusplus
+}
+#endif
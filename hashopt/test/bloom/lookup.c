@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+
+/* Look up each name on stdin in a shared object's .gnu.hash, as ld.so
+ * would, and also with dlsym. Print how many names it has (found both
+ * ways), how many it lacks, and how many of those got past the Bloom
+ * filter. Exit 1 if the two ways disagree. */
+
+static uint32_t gnu_hash(const char *name)
+{
+	uint32_t h = 5381;
+	for (const unsigned char *c = (const unsigned char *) name; *c; ++c) h = h * 33 + *c;
+	return h;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) errx(1, "usage: %s <shared object> < names", argv[0]);
+	int fd = open(argv[1], O_RDONLY);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) err(1, "opening %s", argv[1]);
+	char *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (file == MAP_FAILED) err(1, "mapping %s", argv[1]);
+	Elf64_Ehdr *ehdr = (Elf64_Ehdr *) file;
+	Elf64_Shdr *shdrs = (Elf64_Shdr *) (file + ehdr->e_shoff);
+	Elf64_Shdr *hash_shdr = NULL;
+	for (unsigned i = 0; i < ehdr->e_shnum; ++i) if (shdrs[i].sh_type == SHT_GNU_HASH) hash_shdr = &shdrs[i];
+	if (!hash_shdr) errx(1, "%s has no .gnu.hash", argv[1]);
+	Elf64_Shdr *dynsym_shdr = &shdrs[hash_shdr->sh_link];
+	Elf64_Sym *dynsyms = (Elf64_Sym *) (file + dynsym_shdr->sh_offset);
+	const char *dynstr = file + shdrs[dynsym_shdr->sh_link].sh_offset;
+	Elf64_Word *words = (Elf64_Word *) (file + hash_shdr->sh_offset);
+	Elf64_Word nbuckets = words[0], symoffset = words[1], bloom_size = words[2], shift = words[3];
+	Elf64_Xword *bloom = (Elf64_Xword *) &words[4];
+	Elf64_Word *buckets = (Elf64_Word *) &bloom[bloom_size];
+	Elf64_Word *chains = &buckets[nbuckets] - symoffset;
+
+	void *handle = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+	if (!handle) errx(1, "%s", dlerror());
+	unsigned long found = 0, absent = 0, passed = 0;
+	int ret = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	while (-1 != (len = getline(&line, &line_size, stdin)))
+	{
+		if (len && line[len - 1] == '\n') line[--len] = '\0';
+		if (!len) continue;
+		uint32_t h = gnu_hash(line);
+		Elf64_Xword word = bloom[(h / 64) & (bloom_size - 1)];
+		_Bool past_bloom = (word >> (h % 64)) & (word >> ((h >> shift) % 64)) & 1;
+		_Bool in_table = 0;
+		if (past_bloom && buckets[h % nbuckets])
+		{
+			for (Elf64_Word i = buckets[h % nbuckets]; ; ++i)
+			{
+				if ((chains[i] | 1) == (h | 1) && 0 == strcmp(&dynstr[dynsyms[i].st_name], line)
+					&& dynsyms[i].st_shndx != SHN_UNDEF) { in_table = 1; break; }
+				if (chains[i] & 1) break;
+			}
+		}
+		_Bool by_dlsym = (NULL != dlsym(handle, line));
+		if (in_table != by_dlsym)
+		{
+			warnx("`%s' is %sin the table but dlsym %s it", line, in_table ? "" : "not ",
+				by_dlsym ? "finds" : "does not find");
+			ret = 1;
+		}
+		if (in_table) ++found;
+		else { ++absent; passed += past_bloom; }
+	}
+	free(line);
+	printf("%lu %lu %lu\n", found, absent, passed);
+	return ret;
+}
@@ -0,0 +1,106 @@
+#ifndef ELFTIN_BATCH_H_
+#define ELFTIN_BATCH_H_
+
+#include <getopt.h>
+#include "nameset.h"
+
+/* Running one pass over many files, several at a time, as the tools do
+ * given "-j <njobs>" and several files, or "--files-from <listfile>".
+ * Each file is opened, rewritten and committed on its own, so one that
+ * fails does not stop (or spoil) the others.
+ *
+ * A file that is an ar archive stands for its ELF members, which are
+ * rewritten where they lie inside it, several at a time like files. A
+ * pass that changes which symbols a member defines (sym2und, abs2und)
+ * leaves the archive's symbol index stale, so run ranlib afterwards.
+ *
+ * With --check (or --dry-run), nothing is written: each file is mapped
+ * privately, the pass runs, and we say what it would have changed. The
+ * status is then ELFIMAGE_CHANGES_PENDING if anything would change, unless
+ * some file failed, whose status wins.
+ *
+ * With --stamp, each file the pass succeeds on gets a note section,
+ * .note.elftin, recording the pass and its arguments; a file already so
+ * stamped is left alone, without running the pass at all. (List files
+ * are recorded by name, not contents.) The section is added once, with
+ * room for a few dozen stamps.
+ *
+ * By default the passes say nothing about the individual relocs and
+ * symbols they deal with; each -v (--verbose) says more. With --stats=json
+ * (or =text) we print, on stdout, what each file's pass counted (relocs
+ * rewritten and skipped, symbols patched, ...) and how long each phase
+ * took, and the totals.
+ *
+ * A file named "-" is stdin, which must then be the only file, and "-o -"
+ * is stdout. Given stdin and no -o, we write to stdout, so a tool can sit
+ * in a pipeline. Such an image is held in memory (see elfimage_open_stream)
+ * rather than mapped from a file. If the output is stdout, --stats goes to
+ * stderr.
+ *
+ * Zero-initialise one before use. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct elfimage;
+
+struct elftin_batch
+{
+	struct nameset files;  // in order, one per line in list files
+	unsigned njobs;        // files (or members) at once; 0 means one per CPU
+	const char *output;    // -o, which needs a single file
+	_Bool partial;         // open with elfimage_open_partial, not _copy
+	_Bool check;           // --check
+	_Bool stamp;           // --stamp
+	char *pass_desc;       // what to stamp: see elftin_batch_stamp_word
+	unsigned verbosity;    // one per -v
+	enum elftin_stats_format { ELFTIN_STATS_NONE, ELFTIN_STATS_TEXT, ELFTIN_STATS_JSON } stats;
+	int (*pass)(struct elfimage *img, void *arg);
+	void *arg;
+};
+
+/* For the tools' getopt_long tables, with "F:nSv" in the short options.
+ * --stats has no short option, so getopt_long returns this for it. */
+#define ELFTIN_BATCH_STATS_OPTION 0x100
+#define ELFTIN_BATCH_OPTIONS \
+	{ "files-from", required_argument, NULL, 'F' }, \
+	{ "check", no_argument, NULL, 'n' }, \
+	{ "dry-run", no_argument, NULL, 'n' }, \
+	{ "stamp", no_argument, NULL, 'S' }, \
+	{ "verbose", no_argument, NULL, 'v' }, \
+	{ "stats", required_argument, NULL, ELFTIN_BATCH_STATS_OPTION }
+
+#define ELFTIN_STAMP_SECTION ".note.elftin"
+#define ELFTIN_STAMP_SIZE 1024
+#define NT_ELFTIN_PASSES 1
+
+/* Build up the pass's description, for stamps, a word at a time: the
+ * tool's name and then its arguments (but not the files). */
+void elftin_batch_stamp_word(struct elftin_batch *b, const char *word);
+/* Whether the image's stamp records 'pass_desc'; and record it, adding
+ * the stamp section if need be (returns 0, or -1 having warned). */
+_Bool elftin_stamp_has(struct elfimage *img, const char *pass_desc);
+int elftin_stamp_add(struct elfimage *img, const char *pass_desc);
+
+/* Parse the argument of --stats. Returns 0, or -1 having warned. */
+int elftin_batch_set_stats(struct elftin_batch *b, const char *format);
+
+void elftin_batch_add(struct elftin_batch *b, const char *filename);
+/* One filename per line, as for nameset_add_file; "-" means stdin.
+ * Returns 0, or -1 having warned. */
+int elftin_batch_add_list(struct elftin_batch *b, const char *listfile);
+/* Run the pass over every file (and archive member). Returns 0 if all
+ * succeeded, or else the highest status any of them returned. With
+ * more than one, messages from the pass are prefixed with the name of
+ * the file (or "archive(member)") they are about. */
+int elftin_batch_run(struct elftin_batch *b);
+/* Whether 'filename' starts like an ar archive. */
+_Bool elftin_batch_is_archive(const char *filename);
+void elftin_batch_destroy(struct elftin_batch *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
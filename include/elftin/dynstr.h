@@ -0,0 +1,31 @@
+#ifndef ELFTIN_DYNSTR_H_
+#define ELFTIN_DYNSTR_H_
+
+#include <stddef.h>
+
+/* Growing a dynamic string table in place. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct elfimage;
+
+/* Append 'len' bytes of strings (each NUL-terminated) to the string table
+ * in section 'dynstr_shndx', which must be the one named by DT_STRTAB.
+ * If there is free space right after it, in the file and in its segment,
+ * we grow it there. Otherwise we move the whole table to the end of the
+ * file, mapped by a new PT_LOAD. That takes the place of a spare PT_NULL
+ * program header (such as custom-phdrs can reserve) if there is one, or
+ * else we move the program headers, with the new one added, to the start
+ * of the new segment. Either way we update the section header, DT_STRTAB
+ * and DT_STRSZ. The image may be remapped.
+ * Returns the offset within the table of the first appended byte, or -1
+ * having warned. */
+long dynstr_append(struct elfimage *img, unsigned dynstr_shndx, const char *strs, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef ELFTIN_ELFIMAGE_H_
+#define ELFTIN_ELFIMAGE_H_
+
+#include <elf.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A writable mapping of an ELF file, plus the indexes that the
+ * in-place rewriting tools all need. We map and index once, then
+ * any number of passes can work on the same image. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* What a pass has to say: warnings, and notes of what it changed. */
+enum elfimage_report_kind
+{
+	ELFIMAGE_WARNING,
+	ELFIMAGE_NOTE
+};
+
+/* What passes count as they go, for --stats. */
+enum elfimage_counter
+{
+	ELFIMAGE_RELOCS_SCANNED,
+	ELFIMAGE_RELOCS_REWRITTEN,
+	ELFIMAGE_RELOCS_SKIPPED_NO_SYMBOL,     // no zero-offset symbol for the section
+	ELFIMAGE_RELOCS_SKIPPED_SAME_SECTION,  // e.g. taking the address of a label
+	ELFIMAGE_RELOCS_SKIPPED_NO_SECTION_SYMBOL, // from debug info, but nothing to point at
+	ELFIMAGE_SYMBOLS_PATCHED,
+	ELFIMAGE_SYMBOLS_RENAMED,
+	ELFIMAGE_SYMBOLS_DUPLICATE,            // names or addresses that are ambiguous
+	ELFIMAGE_HASH_TABLES_REBUILT,
+	ELFIMAGE_STRTAB_BYTES_SAVED,
+	ELFIMAGE_NCOUNTERS
+};
+/* Their names in the --stats output. */
+extern const char *const elfimage_counter_names[ELFIMAGE_NCOUNTERS];
+#define ELFIMAGE_MAX_PHASES 16
+struct elfimage_stats
+{
+	unsigned long counters[ELFIMAGE_NCOUNTERS];
+	/* Time spent in each named phase, in the order first seen. */
+	struct elfimage_phase { const char *name; double seconds; } phases[ELFIMAGE_MAX_PHASES];
+	unsigned nphases;
+};
+
+struct elfimage
+{
+	const char *filename;
+	int fd;
+	void *mapping;
+	size_t length;       // length of the mapping, i.e. file size rounded up to a page
+	size_t size;         // of the file
+	/* From e_ident: ELFCLASS32 or ELFCLASS64, and whether the file's
+	 * byte order is the other one from ours. The headers below are as
+	 * the file has them, i.e. Elf32_* or Elf64_* in the file's byte
+	 * order, so are for code written against elfn.h. */
+	unsigned char elfclass;
+	_Bool swapped;
+	void *ehdr;
+	void *shdrs;         // null if there is no section header table
+	/* These three allow for extended numbering (see section 0). */
+	unsigned shnum;
+	unsigned shstrndx;
+	void *phdrs;         // null if there is no program header table
+	unsigned phnum;
+	const char *shstrtab;
+	/* The header of the first section of each of these types, or null. */
+	void *symtab_shdr;
+	void *dynsym_shdr;
+	void *dynamic_shdr;
+	/* When writing a copy: the file we map is 'tmpname', and
+	 * elfimage_commit() renames it to 'output'. */
+	const char *output;
+	char *tmpname;
+	/* If 'mapping' is null, the file is mapped piecemeal: just the
+	 * headers, and then whatever parts are asked for. */
+	struct elfimage_window { Elf64_Off offset; size_t length; void *base; } *windows;
+	unsigned nwindows;
+	_Bool in_memory;     // 'mapping' is the caller's buffer, and there is no file
+	_Bool check;         // opened by elfimage_open_check: writes never reach the file
+	/* If set (after opening), passes hand their warnings and notes to
+	 * this, one message at a time, instead of printing them. */
+	void (*report)(void *arg, enum elfimage_report_kind kind, const char *msg);
+	void *report_arg;
+	/* Set after opening, like 'report'. Passes say what they do item by
+	 * item (each reloc or symbol) only at 1 and above. */
+	unsigned verbosity;
+	struct elfimage_stats stats; // zeroed on opening
+};
+#define ELFIMAGE_DATA(img, off, len) ((img)->mapping \
+	? (void*)((uintptr_t) (img)->mapping + (off)) \
+	: elfimage_window((img), (off), (len)))
+/* Call the instance of 'fn' (see elfn.h) for the image's class and byte
+ * order, passing the rest of the arguments. */
+#define ELFIMAGE_DISPATCH(img, fn, ...) ((img)->elfclass == ELFCLASS32 \
+	? ((img)->swapped ? fn##_32_1(__VA_ARGS__) : fn##_32_0(__VA_ARGS__)) \
+	: ((img)->swapped ? fn##_64_1(__VA_ARGS__) : fn##_64_0(__VA_ARGS__)))
+
+/* Returns 0 on success. Otherwise it has already warned, and returns
+ * the exit status the tools have always used: 2 for open, 3 for stat,
+ * 4 for mmap and 5 for a non-ELF file, or one of a class or byte order
+ * that ELF does not define. */
+int elfimage_open(struct elfimage *img, const char *filename);
+/* As elfimage_open, but leave 'filename' alone and work on a copy that
+ * elfimage_commit() will atomically put at 'output'. The copy is a
+ * reflink where the filesystem allows, so only the pages we write get
+ * copied. A null 'output' means work in place, as elfimage_open. */
+int elfimage_open_copy(struct elfimage *img, const char *filename, const char *output);
+/* As elfimage_open_copy, but map only the ELF header, the program and
+ * section header tables and the section header string table up front.
+ * Anything else is mapped in a window of its own on first use, via
+ * ELFIMAGE_DATA or ELFN_SECTION_DATA. This is for passes that touch
+ * only metadata, so that they do I/O in proportion to it and not to the
+ * file (think of a huge .debug_info). Such passes must not use 'mapping',
+ * which is null. */
+int elfimage_open_partial(struct elfimage *img, const char *filename, const char *output);
+/* For --check: open read-only, and map privately, so that a pass can run
+ * as usual but what it writes stays in our own copy of the pages (as does
+ * anything it adds, if it grows the image). elfimage_check_changes then
+ * says what it would have changed. 'partial' is as for _open_partial. */
+int elfimage_open_check(struct elfimage *img, const char *filename, _Bool partial);
+/* The status of a --check that finds changes to make. */
+#define ELFIMAGE_CHANGES_PENDING 8
+/* Compare the image with 'original' (an image of the same size, for a
+ * buffer image) or, if that is null, with the file. If they differ, note
+ * which headers and sections, and return ELFIMAGE_CHANGES_PENDING;
+ * otherwise return 0. */
+int elfimage_check_changes(struct elfimage *img, const void *original);
+/* As elfimage_open_copy (or _partial), but on descriptors that are
+ * already open, e.g. having been passed over a socket. If 'out_fd' is
+ * not 'in_fd', we first copy 'in_fd' into it (it should be empty). We
+ * take over 'out_fd', but 'in_fd' stays the caller's. There is nothing
+ * to commit: the output's name, if any, is the caller's business. */
+int elfimage_open_fd(struct elfimage *img, int in_fd, int out_fd, const char *name,
+	_Bool partial);
+/* For pipelines: read everything from 'in_fd' (say, a pipe on stdin) into
+ * a file of our own, and work on that. The file is in memory (a memfd),
+ * unless there is an 'output', in which case it is a temporary file that
+ * elfimage_commit() puts there. Then elfimage_write_out() can send the
+ * result on down the pipeline. 'check' is as for elfimage_open_check. */
+int elfimage_open_stream(struct elfimage *img, int in_fd, const char *name,
+	const char *output, _Bool partial, _Bool check);
+/* Write the whole image, as it now stands, to 'out_fd'. Returns 0, or 1
+ * having warned. Not for buffer images, nor checked ones. */
+int elfimage_write_out(struct elfimage *img, int out_fd);
+/* Work on an ELF image that the caller already has in memory, e.g. one
+ * it has just read or generated. Nothing is copied, and the buffer is
+ * still the caller's after elfimage_close(). 'name' (which may be null)
+ * is used in messages. The checks and return values are as for
+ * elfimage_open, except that passes which would grow the file fail. */
+int elfimage_open_buffer(struct elfimage *img, void *buf, size_t size, const char *name);
+/* The copying half of elfimage_open_copy, for files that are not ELF
+ * images themselves (e.g. archives): copy 'filename' to a new temporary
+ * file next to 'output', and return it open read-write, and its name.
+ * Returns 0, or 2 or 3 having warned, as elfimage_open. */
+int elfimage_copy_file(const char *filename, const char *output, int *out_fd,
+	char **out_tmpname);
+/* The header of the first section called 'name', or null. */
+void *elfimage_section_by_name(struct elfimage *img, const char *name);
+/* Add a section of 'size' zero bytes at the end of the file, followed by
+ * new copies of the section name table and the section header table (the
+ * old ones are left as dead bytes). Returns its header, or null having
+ * warned. Like elfimage_grow, this invalidates pointers into the image. */
+void *elfimage_add_section(struct elfimage *img, const char *name, Elf64_Word type,
+	Elf64_Xword flags, Elf64_Xword size, Elf64_Xword align);
+/* Map the 'length' bytes at 'offset', if they are not mapped already. */
+void *elfimage_window(struct elfimage *img, Elf64_Off offset, size_t length);
+/* Put the copy in place, if any. Returns 0, or 1 having warned. */
+int elfimage_commit(struct elfimage *img);
+/* Unmap and close. An uncommitted copy is deleted. */
+void elfimage_close(struct elfimage *img);
+/* Extend the file to 'new_size' bytes (zero-filled) and remap it. This
+ * moves the mapping, so any pointers into it must be recomputed; the
+ * fields of 'img' are updated. (A partial image's windows stay put.)
+ * Returns 0, or -1 having warned. */
+int elfimage_grow(struct elfimage *img, size_t new_size);
+
+/* How passes report: through img->report if it is set, otherwise as
+ * warnx() would, or (for notes) as a plain line on stderr. */
+void elfimage_warnx(struct elfimage *img, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void elfimage_note(struct elfimage *img, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* Whether to say what we do at 'level' of detail. Test this before
+ * formatting a message, which can cost more than the work it describes. */
+#define ELFIMAGE_VERBOSE(img, level) ((img)->verbosity >= (level))
+/* Counters may be bumped from several threads at once. */
+static inline void elfimage_count(struct elfimage *img, enum elfimage_counter c,
+	unsigned long n)
+{
+	__atomic_fetch_add(&img->stats.counters[c], n, __ATOMIC_RELAXED);
+}
+/* Seconds on the monotonic clock. */
+double elfimage_clock(void);
+/* Charge the time since '*since' to the phase called 'name' (a string
+ * that outlives the image), and restart '*since' from now. Phases past
+ * ELFIMAGE_MAX_PHASES are not recorded. Not for use from several
+ * threads at once. */
+void elfimage_phase(struct elfimage *img, const char *name, double *since);
+
+/* The SHT_SYMTAB_SHNDX data that goes with a symbol table (given by its
+ * header), or null. Its entries are in the file's byte order. See elfn.h
+ * for reading them, and for the section that a symbol is defined in. */
+Elf64_Word *elfimage_symtab_xindex(struct elfimage *img, const void *symtab_shdr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+/* No include guard around the whole: see below. */
+
+/* Code that reads and writes ELF structures in place, written once and
+ * compiled for each ELF class and byte order, as elftraits.hh does for
+ * the C++ code. We read the image as the file has it, rather than copy
+ * each structure out and back the 'gelf' way: fields are read through
+ * GET() and written through SET(), which for the host's byte order are
+ * plain loads and stores.
+ *
+ * A source file instantiates such code by defining ELFN_BITS (32 or 64)
+ * and ELFN_SWAP (1 if the file's byte order is not the host's, else 0),
+ * then including it; the code includes this first thing. That is done
+ * for each of the four combinations, and ELFIMAGE_DISPATCH (elfimage.h)
+ * calls the one that suits an image. Within the code, ElfN(Sym) is
+ * Elf32_Sym or Elf64_Sym and so on, and ELFN(f) is the name that this
+ * instance's 'f' goes by. */
+
+#ifndef ELFTIN_ELFN_H_
+#define ELFTIN_ELFN_H_
+
+#include <elf.h>
+#include <stdint.h>
+#include "elfimage.h"
+
+#define ELFN_BSWAP(x) ((__typeof__(x)) ( \
+	sizeof (x) == 1 ? (uint8_t) (x) : \
+	sizeof (x) == 2 ? __builtin_bswap16((uint16_t) (x)) : \
+	sizeof (x) == 4 ? __builtin_bswap32((uint32_t) (x)) : \
+	__builtin_bswap64((uint64_t) (x))))
+/* As ELFIMAGE_DATA, for the contents of the section with header 'shdr'. */
+#define ELFN_SECTION_DATA(img, shdr) ELFIMAGE_DATA((img), GET((shdr).sh_offset), GET((shdr).sh_size))
+
+#endif
+
+#if !defined(ELFN_BITS) || !defined(ELFN_SWAP)
+#error "define ELFN_BITS and ELFN_SWAP before including elfn.h"
+#endif
+
+#undef ElfN
+#undef ELFN
+#undef ELFN_CLASS
+#undef ELFN_SWAPPED
+#undef ELFN_R_SYM
+#undef ELFN_R_TYPE
+#undef ELFN_R_INFO
+#undef ELFN_ST_BIND
+#undef ELFN_ST_TYPE
+#undef ELFN_ST_INFO
+#undef ELFN_ST_VISIBILITY
+#undef GET
+#undef SET
+
+#if ELFN_BITS == 64
+#define ElfN(type) Elf64_##type
+#define ELFN_CLASS ELFCLASS64
+#define ELFN_R_SYM(info) ELF64_R_SYM(info)
+#define ELFN_R_TYPE(info) ELF64_R_TYPE(info)
+#define ELFN_R_INFO(sym, type) ELF64_R_INFO((sym), (type))
+#define ELFN_ST_BIND(info) ELF64_ST_BIND(info)
+#define ELFN_ST_TYPE(info) ELF64_ST_TYPE(info)
+#define ELFN_ST_INFO(bind, type) ELF64_ST_INFO((bind), (type))
+#define ELFN_ST_VISIBILITY(other) ELF64_ST_VISIBILITY(other)
+#elif ELFN_BITS == 32
+#define ElfN(type) Elf32_##type
+#define ELFN_CLASS ELFCLASS32
+#define ELFN_R_SYM(info) ELF32_R_SYM(info)
+#define ELFN_R_TYPE(info) ELF32_R_TYPE(info)
+#define ELFN_R_INFO(sym, type) ELF32_R_INFO((sym), (type))
+#define ELFN_ST_BIND(info) ELF32_ST_BIND(info)
+#define ELFN_ST_TYPE(info) ELF32_ST_TYPE(info)
+#define ELFN_ST_INFO(bind, type) ELF32_ST_INFO((bind), (type))
+#define ELFN_ST_VISIBILITY(other) ELF32_ST_VISIBILITY(other)
+#else
+#error "ELFN_BITS must be 32 or 64"
+#endif
+
+/* Swapping is its own inverse, so GET converts both ways. */
+#if ELFN_SWAP
+#define ELFN_SWAPPED 1
+#define GET(x) ELFN_BSWAP(x)
+#else
+#define ELFN_SWAPPED 0
+#define GET(x) (x)
+#endif
+#define SET(lvalue, v) ((lvalue) = GET((__typeof__(lvalue)) (v)))
+
+/* These must match ELFIMAGE_DISPATCH. */
+#if ELFN_BITS == 64 && !ELFN_SWAP
+#define ELFN(name) name##_64_0
+#elif ELFN_BITS == 64
+#define ELFN(name) name##_64_1
+#elif !ELFN_SWAP
+#define ELFN(name) name##_32_0
+#else
+#define ELFN(name) name##_32_1
+#endif
+
+#undef ELFN_BITS
+#undef ELFN_SWAP
+
+/* The section that 'sym' (from 'symtab') is defined in, looking through
+ * SHN_XINDEX to 'xindex' as needed, or 0 if it is undefined or has some
+ * other reserved index (like SHN_ABS). */
+static inline ElfN(Word) ELFN(elfimage_sym_section)(const ElfN(Sym) *symtab, const ElfN(Sym) *sym,
+	const ElfN(Word) *xindex)
+{
+	if (GET(sym->st_shndx) == SHN_XINDEX) return xindex ? GET(xindex[sym - symtab]) : 0;
+	return (GET(sym->st_shndx) < SHN_LORESERVE) ? GET(sym->st_shndx) : 0;
+}
+/* Make 'sym' be defined in section 'shndx'. Returns 0, or -1 if that
+ * needs an xindex entry and there is no 'xindex'. */
+static inline int ELFN(elfimage_set_sym_section)(const ElfN(Sym) *symtab, ElfN(Sym) *sym,
+	ElfN(Word) *xindex, ElfN(Word) shndx)
+{
+	if (shndx < SHN_LORESERVE)
+	{
+		SET(sym->st_shndx, shndx);
+		if (xindex) xindex[sym - symtab] = 0;
+		return 0;
+	}
+	if (!xindex) return -1;
+	SET(sym->st_shndx, SHN_XINDEX);
+	SET(xindex[sym - symtab], shndx);
+	return 0;
+}
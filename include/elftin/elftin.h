@@ -0,0 +1,54 @@
+#ifndef ELFTIN_ELFTIN_H_
+#define ELFTIN_ELFTIN_H_
+
+#include "elfimage.h"
+#include "nameset.h"
+#include "pipeline.h"
+
+/* libelftin: each of the rewriting tools as a pass over an elfimage.
+ *
+ * Open an image once -- from a file, as a copy (elfimage_open_copy) or
+ * from a buffer you already hold (elfimage_open_buffer) -- then run any
+ * sequence of passes over it, with no fork/exec and no remapping. Set
+ * img->report to collect the passes' warnings and notes rather than
+ * have them printed. Passes return 0 on success, or else the exit
+ * status the corresponding tool would give. Those passes that say so
+ * need a full mapping, i.e. not one from elfimage_open_partial.
+ *
+ * Where a pass takes a nameset, a null one means "every symbol". */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Full mapping. 'nthreads' of 0 means one per CPU. */
+int normrelocs_pass(struct elfimage *img, char **maybe_symnames, unsigned nsymnames,
+	unsigned nthreads);
+int sym2und_pass(struct elfimage *img, struct nameset *names);
+int abs2und_pass(struct elfimage *img, struct nameset *maybe_names);
+int abs2sectsym_pass(struct elfimage *img, struct nameset *maybe_names);
+/* Full mapping. New names that don't fit in .dynstr grow the file, so
+ * with a buffer image they fail (returning 7). */
+int sym2dyn_pass(struct elfimage *img);
+int pie2rel_pass(struct elfimage *img);
+int rel2data_pass(struct elfimage *img);
+int undprot_pass(struct elfimage *img);
+int dynappend_pass(struct elfimage *img, const char *tagnum_string, long *maybe_tagval);
+int shift_elf_pass(struct elfimage *img, long offset);
+/* Returns 6 if a hash table is malformed. */
+int hashopt_pass(struct elfimage *img);
+/* Names may be glob patterns if 'names' was made with 'globs' set. */
+int bindlocal_pass(struct elfimage *img, struct nameset *names, _Bool protect);
+/* Full mapping. Without the section header for .relr.dyn with a buffer
+ * image, since that cannot grow. */
+int relrpack_pass(struct elfimage *img);
+/* Relocatable objects only; for others, returns 1. 'exports' is as for
+ * bindlocal_pass, and may come from nameset_add_version_script. */
+int hidesyms_pass(struct elfimage *img, struct nameset *exports);
+int strmerge_pass(struct elfimage *img);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
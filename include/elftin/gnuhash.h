@@ -0,0 +1,144 @@
+#ifndef ELFTIN_GNUHASH_H_
+#define ELFTIN_GNUHASH_H_
+
+#include <elf.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Rebuilding the dynamic symbol hash tables (.gnu.hash and .hash) in place.
+ *
+ * A .gnu.hash section is
+ *
+ *     nbuckets, symoffset, bloom_size, bloom_shift   (32-bit words)
+ *     bloom[bloom_size]                               (address-sized words)
+ *     buckets[nbuckets]
+ *     chains[nsyms - symoffset]
+ *
+ * and requires the dynsyms from symoffset onwards to be grouped by bucket.
+ * So if a rename changes some symbol's hash, the dynsyms may have to move,
+ * and with them anything that refers to a dynsym by index.
+ *
+ * The functions that take an image find the dynsyms, their strings and
+ * the tables by section index, and read and write them in the image's
+ * class and byte order (see elfn.h). */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline uint32_t elf_gnu_hash(const char *name)
+{
+	uint32_t h = 5381;
+	for (const unsigned char *c = (const unsigned char *) name; *c; ++c) h = h * 33 + *c;
+	return h;
+}
+static inline uint32_t elf_sysv_hash(const char *name)
+{
+	uint32_t h = 0, g;
+	for (const unsigned char *c = (const unsigned char *) name; *c; ++c)
+	{
+		h = (h << 4) + *c;
+		if (0 != (g = h & 0xf0000000)) h ^= g >> 24;
+		h &= ~g;
+	}
+	return h;
+}
+
+/* As the file has it, so in the file's byte order. */
+struct gnu_hash_header
+{
+	Elf64_Word nbuckets;
+	Elf64_Word symoffset;
+	Elf64_Word bloom_size;
+	Elf64_Word bloom_shift;
+};
+
+/* Compute the order in which the dynsyms of section 'dynsym_shndx' must
+ * appear for a table with 'nbuckets' buckets: new_to_old[i] is the
+ * current index of the symbol that belongs at index i. Symbols below
+ * 'symoffset' stay put, and within a bucket we keep the current order. */
+struct elfimage;
+void gnu_hash_order(struct elfimage *img, unsigned dynsym_shndx, Elf64_Word symoffset,
+	Elf64_Word nbuckets, Elf64_Word *new_to_old);
+
+/* Move the dynsyms of section 'dynsym_shndx' into the given order, along
+ * with the .gnu.version and SHT_SYMTAB_SHNDX entries that parallel them,
+ * and the symbol indices of every rel/rela section linked to them.
+ * Returns 0, or -1 having warned and touched nothing if some .gnu.version
+ * or SHT_SYMTAB_SHNDX does not match the dynsym (see dynsym_permutable). */
+int dynsym_permute(struct elfimage *img, unsigned dynsym_shndx, const Elf64_Word *new_to_old);
+_Bool dynsym_permutable(struct elfimage *img, unsigned dynsym_shndx);
+
+/* The fraction of lookups of absent names that get past the Bloom filter,
+ * measured by looking up a fixed set of random hashes. This is for ELF64
+ * Bloom words in the host's byte order. */
+double gnu_hash_bloom_false_positive_rate(const Elf64_Xword *bloom, Elf64_Word bloom_size,
+	Elf64_Word bloom_shift);
+
+/* Whether a table with this many buckets fits in 'size' bytes; checking
+ * this first means we need not move any dynsyms for a table we then
+ * could not build. The GNU table's Bloom words are as wide as the image's
+ * addresses. */
+_Bool gnu_hash_fits(const struct elfimage *img, size_t size, Elf64_Word nbuckets, Elf64_Word symoffset,
+	Elf64_Word nsyms);
+_Bool sysv_hash_fits(size_t size, Elf64_Word nbucket, Elf64_Word nsyms);
+
+/* Rewrite .gnu.hash section 'gnu_hash_shndx' for the dynsyms of section
+ * 'dynsym_shndx', which are already in gnu_hash_order(). The bucket count
+ * and symoffset are kept. We use as many Bloom words as fit, with the
+ * shift the linker would use for that many. Returns 0, or -1 if the
+ * section is too small. */
+int gnu_hash_build(struct elfimage *img, unsigned gnu_hash_shndx, unsigned dynsym_shndx,
+	Elf64_Word nbuckets, Elf64_Word symoffset);
+
+/* Rewrite a .hash section, keeping its bucket count. Returns 0, or -1
+ * if the section is too small. */
+int sysv_hash_build(struct elfimage *img, unsigned sysv_hash_shndx, unsigned dynsym_shndx,
+	Elf64_Word nbucket);
+
+/* How well a table serves lookups, taking each name it holds to be as
+ * likely as any other, and the names it lacks to hash uniformly. A
+ * "probe" is one chain entry looked at. */
+struct hash_table_stats
+{
+	Elf64_Word nbuckets;
+	Elf64_Word bloom_size;   // GNU only, as are the next two
+	Elf64_Word bloom_shift;
+	double bloom_false_positive_rate; // 1 for SysV, which has no filter
+	Elf64_Word empty_buckets;
+	Elf64_Word longest_chain;
+	double probes_per_hit;   // to find a name it holds
+	double probes_per_miss;  // to find that it lacks one, given we got past the filter
+};
+/* What we expect a lookup to cost, counting the bucket as a probe too.
+ * ld.so tries each library in turn, so in any one library most lookups
+ * miss; we take it that this fraction do. The tuning minimises this. */
+#ifndef HASH_TABLE_MISS_FRACTION
+#define HASH_TABLE_MISS_FRACTION 0.9
+#endif
+static inline double hash_table_expected_probes(const struct hash_table_stats *s)
+{
+	return HASH_TABLE_MISS_FRACTION * s->bloom_false_positive_rate * (1 + s->probes_per_miss)
+		+ (1 - HASH_TABLE_MISS_FRACTION) * (1 + s->probes_per_hit);
+}
+
+/* Measure an existing table, of a dynsym with 'nsyms' symbols for GNU.
+ * Return 0, or -1 if it is malformed. */
+int gnu_hash_stats(struct elfimage *img, unsigned gnu_hash_shndx, Elf64_Word nsyms,
+	struct hash_table_stats *s);
+int sysv_hash_stats(struct elfimage *img, unsigned sysv_hash_shndx, struct hash_table_stats *s);
+/* Find the bucket count (and, for GNU, Bloom size) that makes for the
+ * fewest expected probes in a table the size of section 'shndx' over the
+ * dynsyms of section 'dynsym_shndx', in any order, and say how that table
+ * would do. Passing its nbuckets to gnu_hash_build (or sysv_hash_build)
+ * builds it. Returns 0, or -1 if no table fits. */
+int gnu_hash_tune(struct elfimage *img, unsigned gnu_hash_shndx, unsigned dynsym_shndx,
+	Elf64_Word symoffset, struct hash_table_stats *best);
+int sysv_hash_tune(struct elfimage *img, unsigned sysv_hash_shndx, unsigned dynsym_shndx,
+	struct hash_table_stats *best);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
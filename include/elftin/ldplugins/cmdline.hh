@@ -8,6 +8,8 @@
 #include <utility>
 #include <functional>
 #include <fcntl.h>
+#include <cassert>
+#include <cstring>
 #include "elfmap.hh"
 #include "base-ldplugin.hh" /* for debug_println */
 
@@ -197,8 +199,47 @@ map< pair<string, off_t> , T> classify_input_objects(vector<string> const& input
 	return out;
 }
 
-set< pair<ElfW(Sym)*, string> > enumerate_symbols_matching(fmap const& f, off_t offset,
-    std::function<bool(ElfW(Sym)*, string const&)> pred);
+/* Walk the symtab of a relocatable ELF file of any class and byte order,
+ * returning the names for which pred(traits, sym, name) holds. The
+ * predicate is called with each instantiation of elf_traits, so is
+ * usually a generic lambda. */
+template <typename Pred>
+set<string> enumerate_symbols_matching(fmap const& f, off_t offset, Pred pred)
+{
+	set<string> matched;
+	if (!(f.mapping_size > 0 && 0 == memcmp(f, "\x7f""ELF", 4))) return matched;
+	debug_println(1, "We have an ELF at %p+0x%x", f.mapping, (unsigned) f.start_offset_from_mapping_offset);
+	// it's already mapped! how do we do the 'upgrade'? need to point to it, unfortunately
+	elfmap e(f);
+	assert(e.mapping == f.mapping);
+	e.with_traits([&e, &pred, &matched](auto t) {
+		if (t.get(e.ehdr(t)->e_type) != ET_REL) return;
+		debug_println(1, "It's an interesting ELF");
+		/* Since we need to peek at the file contents to get
+		 * headers and the like, maybe the get_input_section_count
+		 * and get_input_section_contents calls are a bad idea.
+		 * I notice that only ld.gold implements them; ld.bfd
+		 * does not. */
+		auto *shdrs = e.shdrs(t);
+		auto *found = e.template find<SHT_SYMTAB>(t);
+		if (!found) return;
+		typedef typename decltype(t)::Sym sym_t;
+		sym_t *symtab = e.template ptr<sym_t>(t.get(found->sh_offset));
+		sym_t *symtab_end = symtab + t.get(found->sh_size) / sizeof (sym_t);
+		char *strtab = e.template ptr<char>(t.get(shdrs[t.get(found->sh_link)].sh_offset));
+		/* Walk the symtab */
+		for (sym_t *sym = symtab; sym < symtab_end; ++sym)
+		{
+			const char *name = &strtab[t.get(sym->st_name)];
+			if (pred(t, sym, string(name)))
+			{
+				/* It defines a wrapped symbol */
+				matched.insert(name);
+			}
+		}
+	});
+	return matched;
+}
 
 } /* end namespace elftin */
 #endif
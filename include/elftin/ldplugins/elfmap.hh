@@ -9,6 +9,7 @@
 #include <optional>
 #include <array>
 #include "relf.h"
+#include "elftraits.hh"
 
 /* Some C++ utilities for creating and navigating a memory mapping
  * of an ELF file. */
@@ -90,8 +91,8 @@ struct fmap
 
 struct elfmap : public fmap
 {
-	/* FIXME: what if it's a 32-bit header and we are building on a 64-bit platform?
-	 * We could take the 'gelf' approach and take a copy here. */
+	/* This is only right for native ELF. Code that may see other classes
+	 * or byte orders should go via with_traits() instead. */
 	ElfW(Ehdr) *hdr;
 private:
 	void set_hdr()
@@ -116,19 +117,66 @@ public:
 
 	operator ElfW(Ehdr)*() const { return hdr; }
 
+	/* e_shnum is zero if there are too many sections to fit; then the
+	 * count is in section header 0's sh_size. */
+	size_t shnum() const
+	{
+		if (!hdr->e_shoff) return 0;
+		return hdr->e_shnum ? hdr->e_shnum : ptr<ElfW(Shdr)>(hdr->e_shoff)->sh_size;
+	}
+
 	template <ElfW(Word) sht>
 	ElfW(Shdr)*
 	find(ElfW(Shdr) *start = nullptr) const /* find first section header by SHT */
 	{
 		ElfW(Shdr) *first = ptr<ElfW(Shdr)>(hdr->e_shoff);
 		if (!start) start = first;
-		for (auto i = start + 1; (i-first) < hdr->e_shnum; ++i)
+		size_t n = shnum();
+		for (auto i = start + 1; (size_t)(i-first) < n; ++i)
 		{
 			if (i->sh_type == sht) return i;
 		}
 		return nullptr;
 	}
 
+	/* Call f(traits) with the traits for this file's class and data
+	 * encoding; see elftraits.hh. */
+	template <typename F>
+	auto with_traits(F&& f) const
+	{ return with_elf_traits(ptr<unsigned char>(0), std::forward<F>(f)); }
+
+	/* The same as above, for any class and byte order. */
+	template <typename Traits>
+	typename Traits::Ehdr *ehdr(Traits) const
+	{ return ptr<typename Traits::Ehdr>(0); }
+	template <typename Traits>
+	typename Traits::Shdr *shdrs(Traits t) const
+	{
+		auto off = t.get(ehdr(t)->e_shoff);
+		return off ? ptr<typename Traits::Shdr>(off) : nullptr;
+	}
+	template <typename Traits>
+	size_t shnum(Traits t) const
+	{
+		auto *first = shdrs(t);
+		if (!first) return 0;
+		auto n = t.get(ehdr(t)->e_shnum);
+		return n ? n : t.get(first->sh_size);
+	}
+	template <ElfW(Word) sht, typename Traits>
+	typename Traits::Shdr *
+	find(Traits t, typename Traits::Shdr *start = nullptr) const
+	{
+		typename Traits::Shdr *first = shdrs(t);
+		if (!first) return nullptr;
+		if (!start) start = first;
+		size_t n = shnum(t);
+		for (auto i = start + 1; (size_t)(i-first) < n; ++i)
+		{
+			if (t.get(i->sh_type) == sht) return i;
+		}
+		return nullptr;
+	}
 };
 
 } /* end namespace elftin */
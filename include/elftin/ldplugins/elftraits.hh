@@ -0,0 +1,124 @@
+#ifndef ELFTRAITS_HH_
+#define ELFTRAITS_HH_
+
+#include <elf.h>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+/* Compile-time traits for each ELF class and data encoding. Code written
+ * once against a traits type reads ELF32 or ELF64, in either byte order,
+ * straight out of the mapping: we dispatch once on e_ident (see
+ * with_elf_traits) rather than copying each structure the 'gelf' way.
+ * For native input, get() is the identity, so field accesses compile
+ * to plain loads. */
+
+namespace elftin
+{
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+constexpr unsigned char native_elf_data = ELFDATA2LSB;
+#else
+constexpr unsigned char native_elf_data = ELFDATA2MSB;
+#endif
+
+template <unsigned char Class> struct elf_class_types;
+template <> struct elf_class_types<ELFCLASS32>
+{
+	typedef Elf32_Ehdr Ehdr;
+	typedef Elf32_Phdr Phdr;
+	typedef Elf32_Shdr Shdr;
+	typedef Elf32_Sym Sym;
+	typedef Elf32_Dyn Dyn;
+	typedef Elf32_Rel Rel;
+	typedef Elf32_Rela Rela;
+	typedef Elf32_Addr Addr;
+	typedef Elf32_Off Off;
+	typedef Elf32_Half Half;
+	typedef Elf32_Word Word;
+	static unsigned char st_type(unsigned char info) { return ELF32_ST_TYPE(info); }
+	static unsigned char st_bind(unsigned char info) { return ELF32_ST_BIND(info); }
+	/* These take r_info already in host byte order. */
+	static Word r_sym(Word info) { return ELF32_R_SYM(info); }
+	static Word r_type(Word info) { return ELF32_R_TYPE(info); }
+	static Word r_info(Word sym, Word type) { return ELF32_R_INFO(sym, type); }
+};
+template <> struct elf_class_types<ELFCLASS64>
+{
+	typedef Elf64_Ehdr Ehdr;
+	typedef Elf64_Phdr Phdr;
+	typedef Elf64_Shdr Shdr;
+	typedef Elf64_Sym Sym;
+	typedef Elf64_Dyn Dyn;
+	typedef Elf64_Rel Rel;
+	typedef Elf64_Rela Rela;
+	typedef Elf64_Addr Addr;
+	typedef Elf64_Off Off;
+	typedef Elf64_Half Half;
+	typedef Elf64_Word Word;
+	static unsigned char st_type(unsigned char info) { return ELF64_ST_TYPE(info); }
+	static unsigned char st_bind(unsigned char info) { return ELF64_ST_BIND(info); }
+	static Elf64_Word r_sym(Elf64_Xword info) { return ELF64_R_SYM(info); }
+	static Elf64_Word r_type(Elf64_Xword info) { return ELF64_R_TYPE(info); }
+	static Elf64_Xword r_info(Elf64_Xword sym, Elf64_Xword type) { return ELF64_R_INFO(sym, type); }
+};
+
+template <unsigned char Data>
+struct elf_byte_order
+{
+	static_assert(Data == ELFDATA2LSB || Data == ELFDATA2MSB, "unknown ELF data encoding");
+	static constexpr bool is_native = (Data == native_elf_data);
+	/* Swapping is its own inverse, so this converts both ways. */
+	template <typename T>
+	static T get(T v)
+	{
+		static_assert(std::is_integral<T>::value, "ELF fields are integers");
+		if constexpr (is_native || sizeof (T) == 1) return v;
+		else if constexpr (sizeof (T) == 2) return static_cast<T>(__builtin_bswap16(static_cast<uint16_t>(v)));
+		else if constexpr (sizeof (T) == 4) return static_cast<T>(__builtin_bswap32(static_cast<uint32_t>(v)));
+		else return static_cast<T>(__builtin_bswap64(static_cast<uint64_t>(v)));
+	}
+	template <typename T>
+	static void set(T& field, T v) { field = get(v); }
+};
+
+template <unsigned char Class, unsigned char Data>
+struct elf_traits : elf_class_types<Class>, elf_byte_order<Data>
+{
+	static constexpr unsigned char elf_class = Class;
+	static constexpr unsigned char elf_data = Data;
+};
+
+/* Call f(traits) with a traits object matching the given e_ident, and
+ * return what it returns. Every instantiation of f must return the same
+ * type. If the class or encoding is not one we know, we return a
+ * value-initialised result without calling f. */
+template <typename F>
+auto with_elf_traits(const unsigned char *ident, F&& f)
+	-> decltype(f(elf_traits<ELFCLASS64, ELFDATA2LSB>()))
+{
+	typedef decltype(f(elf_traits<ELFCLASS64, ELFDATA2LSB>())) ret_t;
+	switch (ident[EI_CLASS])
+	{
+		case ELFCLASS32: switch (ident[EI_DATA])
+		{
+			case ELFDATA2LSB: return std::forward<F>(f)(elf_traits<ELFCLASS32, ELFDATA2LSB>());
+			case ELFDATA2MSB: return std::forward<F>(f)(elf_traits<ELFCLASS32, ELFDATA2MSB>());
+			default: break;
+		}
+		break;
+		case ELFCLASS64: switch (ident[EI_DATA])
+		{
+			case ELFDATA2LSB: return std::forward<F>(f)(elf_traits<ELFCLASS64, ELFDATA2LSB>());
+			case ELFDATA2MSB: return std::forward<F>(f)(elf_traits<ELFCLASS64, ELFDATA2MSB>());
+			default: break;
+		}
+		break;
+		default: break;
+	}
+	return ret_t();
+}
+
+} /* end namespace elftin */
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef ELFTIN_NAMESET_H_
+#define ELFTIN_NAMESET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A set of symbol (or section) names, from the command line and/or
+ * from list files, that we can test membership of in O(1). Zero-
+ * initialise it before use. If 'globs' is set before adding, a name
+ * with any of "*?[" in it is a pattern, as for fnmatch(3); patterns
+ * are tried one by one, after the names. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct nameset
+{
+	char **names;        // our own copies
+	unsigned nnames;
+	unsigned names_size;
+	/* Open-addressed, built on the first lookup: 'index' is 1 + the name's
+	 * index in 'names', or 0 if the slot is empty. */
+	struct nameset_entry { uint32_t hash; unsigned index; } *tab;
+	size_t tab_size;     // a power of two, or 0 if not built
+	_Bool globs;
+	char **patterns;
+	unsigned npatterns;
+};
+
+void nameset_add(struct nameset *s, const char *name);
+/* A list file has one name per line. Leading and trailing whitespace,
+ * blank lines and lines starting '#' are ignored. Returns 0, or -1
+ * (having warned) if the file can't be read. */
+int nameset_add_file(struct nameset *s, const char *filename);
+/* Add the names that a linker version script makes global, in any of its
+ * version nodes (or in an anonymous one), as for ld --version-script. Set
+ * 'globs' first if its names include patterns. We don't do extern "C++"
+ * (that needs demangling), so a script using it fails. Returns 0, or -1
+ * (having warned). */
+int nameset_add_version_script(struct nameset *s, const char *filename);
+/* Add names from an argument vector, where "-f <file>" means the names
+ * listed in <file>. Returns 0, or -1 (having warned). */
+int nameset_add_args(struct nameset *s, char **args, unsigned nargs);
+_Bool nameset_contains(struct nameset *s, const char *name);
+/* The index in 'names' of the first name added that equals 'name', or -1.
+ * Patterns aren't tried. */
+long nameset_find(struct nameset *s, const char *name);
+/* Build the table now rather than on the first lookup, after which
+ * lookups (until the next nameset_add) may run in parallel. */
+void nameset_freeze(struct nameset *s);
+void nameset_destroy(struct nameset *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef ELFTIN_PIPELINE_H_
+#define ELFTIN_PIPELINE_H_
+
+#include <stdio.h>
+
+/* A sequence of passes, by name and with their arguments, as taken by
+ * elftin-rewrite and elftin-served. Zero-initialise one before use.
+ * The argument words are not copied, so must outlive the pipeline. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct elfimage;
+
+struct elftin_pass;
+struct elftin_step
+{
+	const struct elftin_pass *pass;
+	char **args;
+	unsigned nargs;
+	const char *where; // for messages: "command line", a script name...
+	unsigned line;
+};
+struct elftin_pipeline
+{
+	struct elftin_step *steps;
+	unsigned nsteps;
+	unsigned steps_size;
+	unsigned nthreads;   // for normrelocs; 0 means one per CPU
+	char *error;         // the last problem adding a step
+};
+
+/* Add one step, e.g. { "sym2und", "-f", "list" }. Returns 0, or -1 having
+ * put a message in p->error. */
+int elftin_pipeline_add(struct elftin_pipeline *p, char **words, unsigned nwords,
+	const char *where, unsigned line);
+/* Add steps separated by "--", counting them as lines 1, 2, ... of 'where'. */
+int elftin_pipeline_add_args(struct elftin_pipeline *p, char **args, unsigned nargs,
+	const char *where);
+/* Whether every step touches only metadata; see elfimage_open_partial. */
+_Bool elftin_pipeline_partial_ok(const struct elftin_pipeline *p);
+/* Run the steps in order, stopping at the first that fails, and return
+ * its status (having reported it via the image) or 0. */
+int elftin_pipeline_run(const struct elftin_pipeline *p, struct elfimage *img);
+/* List the passes and their arguments, one per line. */
+void elftin_pipeline_print_passes(FILE *f);
+void elftin_pipeline_destroy(struct elftin_pipeline *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef ELFTIN_STRTAB_H_
+#define ELFTIN_STRTAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* An index of every tail of every string in an ELF string table, so that
+ * we can find where a given name already occurs (possibly as the end of a
+ * longer string, e.g. "bar" in "foobar") in one hash lookup. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct strtab_index
+{
+	const char *strtab;
+	size_t size;
+	/* Open-addressed; 'offset' is 1 + the tail's offset, or 0 if empty. */
+	struct strtab_index_entry { uint32_t check; uint32_t offset; } *entries;
+	size_t nentries;
+};
+
+void strtab_index_init(struct strtab_index *idx, const char *strtab, size_t size);
+/* Returns the offset of a string equal to 'name', or -1. */
+long strtab_index_find(struct strtab_index *idx, const char *name);
+void strtab_index_destroy(struct strtab_index *idx);
+
+/* Lay out a string table holding the 'n' strings in 'strs' (which may
+ * repeat), in which any string that is a tail of another is not stored
+ * again but points into it, e.g. "bar" into "foobar". The table starts
+ * with the empty string, as ELF's do. Returns it (malloc'd), with its
+ * size in '*size' and each string's offset in 'offsets'. */
+char *strtab_merge_tails(const char *const *strs, size_t n, size_t *offsets, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,370 @@
+/* The reloc rewriting of normrelocs.c, for one ELF class and byte order;
+ * see elfn.h. */
+#include "elfn.h"
+
+/* As relscan(), which reads r_info in place and so suits only ELF64 in a
+ * little-endian host's byte order; otherwise we decode each record. */
+static size_t ELFN(relscan)(const unsigned char *rels, size_t entsize, size_t n,
+	const uint32_t *bitmap, uint32_t nbits, uint32_t *out)
+{
+#if ELFN_CLASS == ELFCLASS64 && !ELFN_SWAPPED && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return relscan(rels, entsize, n, bitmap, nbits, out);
+#else
+	size_t nout = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		ElfN(Rel) r;
+		memcpy(&r, rels + i * entsize, sizeof r);
+		uint32_t sym = ELFN_R_SYM(GET(r.r_info));
+		if (sym < nbits && (bitmap[sym >> 5] >> (sym & 31)) & 1) out[nout++] = i;
+	}
+	return nout;
+#endif
+}
+
+static void ELFN(rewrite_relocs)(struct rewrite_context *ctxt, struct reloc_shard *shard)
+{
+	void *mapping = ctxt->mapping;
+	ElfN(Shdr) *shdrs = ctxt->shdrs;
+	const unsigned shnum = ctxt->shnum;
+	const char *shstrtab = ctxt->shstrtab;
+	struct symtab_index *symtab_indexes = ctxt->symtab_indexes;
+	struct remembered_symbol *zero_offset_list = ctxt->zero_offset_list;
+	ElfN(Shdr) *shdr = shard->shdr;
+	unsigned char *rels = SECTION_DATA(*shdr);
+	// NOTE: this may be Rel or Rela and we cast on use
+	struct symtab_index *idx = &symtab_indexes[GET(shdr->sh_link)];
+	ElfN(Shdr) *symtab_shdr = &shdrs[GET(shdr->sh_link)];
+	ElfN(Sym) *symtab = SECTION_DATA(*symtab_shdr);
+	char *strtab = SECTION_DATA(shdrs[GET(symtab_shdr->sh_link)]);
+	ElfN(Shdr) *relocated_sect_shdr = &shdrs[GET(shdr->sh_info)];
+	_Bool from_debug = IS_A_DEBUGGING_SECTION(relocated_sect_shdr);
+	// does this reloc reference a section symbol,
+	// where that section has a corresponding zero-offset symbol, and
+	// the relocation site matches our criteria, and
+	// the zero-offset symbol matches our criteria?
+	const unsigned sz = ((GET(shdr->sh_type) == SHT_REL) ?
+			sizeof (ElfN(Rel)) : sizeof (ElfN(Rela)));
+	if (shard->end > GET(shdr->sh_size) / sz) shard->end = GET(shdr->sh_size) / sz;
+	/* Only relocs whose symbol is marked in the relevant bitmap can need
+	 * rewriting, so we let relscan() pick those out, a block at a time. */
+	const uint32_t *interest = from_debug ? idx->from_debug_interest : idx->from_nondebug_interest;
+	uint32_t hits[RELSCAN_BLOCK];
+	const _Bool verbose = ELFIMAGE_VERBOSE(ctxt->img, 1);
+	unsigned long nrewritten = 0, nno_symbol = 0, nsame_section = 0, nno_section_symbol = 0;
+	for (unsigned long block = shard->begin; block < shard->end; block += RELSCAN_BLOCK)
+	{
+		size_t nhits = ELFN(relscan)(rels + block * sz, sz,
+			(shard->end - block < RELSCAN_BLOCK) ? shard->end - block : RELSCAN_BLOCK,
+			interest, idx->nsyms, hits);
+		for (size_t i_hit = 0; i_hit < nhits; ++i_hit)
+		{
+			unsigned char *rel = rels + (block + hits[i_hit]) * sz;
+			/* Rel is a prefix of Rela, so just copy out the fields we want. */
+			ElfN(Rel) r;
+			memcpy(&r, rel, sizeof r);
+			Elf64_Xword r_info = GET(r.r_info);
+			ElfN(Sym) *sym = symtab + ELFN_R_SYM(r_info);
+			/* If the reference is coming from a debugging section, 
+			 * we look for zero-offset-symbol relocs and turn them to section relocs.
+			 */
+			Elf64_Word sym_shndx = ELFN(elfimage_sym_section)(symtab, sym, idx->xindex);
+			if (from_debug && IS_ORDINARY_ZERO_OFFSET(sym))
+			{
+				if (verbose) shard_warnx(ctxt, shard, "found a from-debug reloc using ordinary symbol `%s'",
+						&strtab[GET(sym->st_name)]);
+				/* The reloc is using a zero-offset symbol, so let it
+				 * use the section symbol instead. */
+				Elf64_Word section_sym = (sym_shndx < shnum) ?
+					idx->section_sym_by_shndx[sym_shndx] : 0;
+				if (section_sym)
+				{
+					unsigned associated = idx->zero_offset_by_shndx[sym_shndx];
+					if (verbose && associated && !(sym == zero_offset_list[associated - 1].sym))
+					{
+						shard_warnx(ctxt, shard, "reloc uses zero-offset sym that is not the associated one");
+					}
+					// do the rewrite
+					SET(r.r_info, ELFN_R_INFO(section_sym,
+						ELFN_R_TYPE(r_info)));
+					memcpy(rel + offsetof(ElfN(Rel), r_info),
+						&r.r_info,
+						sizeof r.r_info);
+					++nrewritten;
+				}
+				else
+				{
+					if (verbose) shard_warnx(ctxt, shard, "did not rewrite a from-debug reloc using ordinary symbol `%s'",
+						&strtab[GET(sym->st_name)]);
+					++nno_section_symbol;
+				}
+			}
+			else if (!from_debug &&
+				ELFN_ST_TYPE(sym->st_info) == STT_SECTION)
+			{
+				// does this reloc site match our criteria?
+				// FIXME: here is where we catch goto labels etc
+#define INTERNAL_SELF_REFERENCE(_shdr, _offs, _info) (0)
+				if (INTERNAL_SELF_REFERENCE(relocated_sect_shdr, GET(r.r_offset), r_info)) continue;
+				/* We don't do rewrites for intra-section references via section symbols,
+				 * e.g. for addr-taking of goto labels etc. */
+				if (sym_shndx == relocated_sect_shdr - shdrs)
+				{
+					++nsame_section;
+					continue;
+				}
+				// do we know a corresponding zero-offset non-section sym
+				// ...*in the same symtab*?
+				unsigned associated = (sym_shndx < shnum) ?
+					idx->zero_offset_by_shndx[sym_shndx] : 0;
+				if (!associated)
+				{
+					if (verbose) shard_warnx(ctxt, shard, "NOT rewriting a reloc (shdr %u offset %u) to point to zero-offset sym: no sym found",
+					(unsigned)(shdr - shdrs), (unsigned)((rel - rels) / sz));
+					++nno_symbol;
+				}
+				else
+				{
+					// do the rewrite
+					if (verbose) shard_warnx(ctxt, shard, "Rewriting a reloc (shdr %u offset %u) to point to zero-offset sym %s",
+						(unsigned)(shdr - shdrs), (unsigned)((rel - rels) / sz),
+							zero_offset_list[associated - 1].name);
+					SET(r.r_info, ELFN_R_INFO(
+						(ElfN(Sym) *) zero_offset_list[associated - 1].sym - symtab,
+						ELFN_R_TYPE(r_info)));
+					memcpy(rel + offsetof(ElfN(Rel), r_info),
+						&r.r_info,
+						sizeof r.r_info);
+					++nrewritten;
+				}
+			}
+		}
+	}
+	/* Shards run concurrently, so we add to the image's counts once each. */
+	elfimage_count(ctxt->img, ELFIMAGE_RELOCS_SCANNED, shard->end - shard->begin);
+	elfimage_count(ctxt->img, ELFIMAGE_RELOCS_REWRITTEN, nrewritten);
+	elfimage_count(ctxt->img, ELFIMAGE_RELOCS_SKIPPED_NO_SYMBOL, nno_symbol);
+	elfimage_count(ctxt->img, ELFIMAGE_RELOCS_SKIPPED_SAME_SECTION, nsame_section);
+	elfimage_count(ctxt->img, ELFIMAGE_RELOCS_SKIPPED_NO_SECTION_SYMBOL, nno_section_symbol);
+}
+static void *ELFN(rewrite_relocs_thread)(void *arg)
+{
+	struct rewrite_context *ctxt = arg;
+	unsigned i;
+	while ((i = __atomic_fetch_add(&ctxt->next_shard, 1, __ATOMIC_RELAXED)) < ctxt->nshards)
+	{
+		ELFN(rewrite_relocs)(ctxt, &ctxt->shards[i]);
+	}
+	return NULL;
+}
+static int ELFN(normrelocs_pass)(struct elfimage *img, char **maybe_symnames, unsigned nsymnames,
+	unsigned nthreads)
+{
+	void *mapping = img->mapping;
+	int ret;
+	double t = elfimage_clock();
+	/* Put the names we're interested in into a hash set. A name's index
+	 * there is its rank, i.e. its position in the caller's list; if it is
+	 * listed twice, its first rank stands. */
+	struct nameset symnames = { 0 };
+	for (unsigned i = 0; maybe_symnames && i < nsymnames; ++i) nameset_add(&symnames, maybe_symnames[i]);
+#define INITIAL_LIST_SIZE 256
+	unsigned zero_offset_list_size = 0;
+	struct remembered_symbol *zero_offset_list = NULL;
+	unsigned nzero_offset = 0;
+#define REALLOC_IF_FULL(fragment) do { \
+	if (n ## fragment + 1 > fragment ## _list_size) \
+	{ \
+		fragment ## _list_size = (fragment ## _list_size) ? fragment ## _list_size * 2 : \
+		     INITIAL_LIST_SIZE; \
+		fragment ## _list = realloc(fragment ## _list, \
+		     fragment ## _list_size * sizeof (struct remembered_symbol)); \
+		if (! fragment ## _list) err(1, "reallocating remembered list"); \
+	} } while (0)
+	ElfN(Shdr) *shdrs = img->shdrs;
+	const char *shstrtab = img->shstrtab;
+	const unsigned shnum = img->shnum;
+	/* Indexed by the section index of the symtab. Only symtabs get tables. */
+	struct symtab_index *symtab_indexes = calloc(shnum, sizeof (struct symtab_index));
+	if (!symtab_indexes) err(1, "allocating symtab indexes");
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_SYMTAB)
+		{
+			const char *strtab = SECTION_DATA(shdrs[GET(shdr->sh_link)]);
+			ElfN(Sym) *symtab = SECTION_DATA(*shdr);
+			struct symtab_index *idx = &symtab_indexes[shdr - shdrs];
+			idx->section_sym_by_shndx = calloc(shnum, sizeof (Elf64_Word));
+			idx->zero_offset_by_shndx = calloc(shnum, sizeof (unsigned));
+			idx->nsyms = GET(shdr->sh_size) / sizeof (ElfN(Sym));
+			idx->xindex = elfimage_symtab_xindex(img, shdr);
+			idx->from_debug_interest = calloc(RELSCAN_BITMAP_WORDS(idx->nsyms), sizeof (uint32_t));
+			idx->from_nondebug_interest = calloc(RELSCAN_BITMAP_WORDS(idx->nsyms), sizeof (uint32_t));
+			if (!idx->section_sym_by_shndx || !idx->zero_offset_by_shndx
+				|| !idx->from_debug_interest || !idx->from_nondebug_interest)
+			{
+				err(1, "allocating symtab index tables");
+			}
+			// 1. collect section symbols, and mark the interesting ones
+			for (ElfN(Sym) *sym = symtab;
+					sym != (ElfN(Sym) *) ((char*) SECTION_DATA(*shdr) + GET(shdr->sh_size));
+					++sym)
+			{
+				Elf64_Word sym_shndx = ELFN(elfimage_sym_section)(symtab, sym, idx->xindex);
+				if (ELFN_ST_TYPE(sym->st_info) == STT_SECTION &&
+					sym_shndx && sym_shndx < shnum &&
+					!idx->section_sym_by_shndx[sym_shndx])
+				{
+					idx->section_sym_by_shndx[sym_shndx] = sym - symtab;
+				}
+				/* These must match the tests in rewrite_relocs(). */
+				if (ELFN_ST_TYPE(sym->st_info) == STT_SECTION)
+				{
+					BITMAP_SET(idx->from_nondebug_interest, sym - symtab);
+				}
+				else if (IS_ORDINARY_ZERO_OFFSET(sym))
+				{
+					BITMAP_SET(idx->from_debug_interest, sym - symtab);
+				}
+			}
+			// 2. collect zero-offset symbols and associate with section syms
+			for (ElfN(Sym) *sym = symtab;
+					sym != (ElfN(Sym) *) ((char*) SECTION_DATA(*shdr) + GET(shdr->sh_size));
+					++sym)
+			{
+				const char *name = &strtab[GET(sym->st_name)];
+				Elf64_Word sym_shndx = ELFN(elfimage_sym_section)(symtab, sym, idx->xindex);
+				long found_name = -1;
+				if (sym->st_name &&
+					ELFN_ST_TYPE(sym->st_info) != STT_SECTION &&
+					(!maybe_symnames || -1 != (found_name = nameset_find(&symnames, name))) &&
+					sym_shndx != SHN_UNDEF &&
+					sym_shndx < shnum &&
+					sym->st_value == 0)
+				{
+					REALLOC_IF_FULL(zero_offset);
+					unsigned rank = (found_name != -1) ? (unsigned) found_name : 0;
+					zero_offset_list[nzero_offset++] = (struct remembered_symbol) {
+						.name = sym->st_name ? &strtab[GET(sym->st_name)] : NULL,
+						.sym = sym,
+						.shdr = shdr,
+						.rank = rank
+					};
+					// remember the association
+					unsigned *associated = &idx->zero_offset_by_shndx[sym_shndx];
+					if (!*associated || rank < zero_offset_list[*associated - 1].rank)
+					{
+						/* An earlier-named symbol wins. Its own run would have
+						 * claimed all the relocs before this one's run. */
+						*associated = nzero_offset;
+					}
+					else if (rank == zero_offset_list[*associated - 1].rank &&
+						idx->section_sym_by_shndx[sym_shndx])
+					{
+						elfimage_warnx(img, "Fishy: found multiple zero-offset replacements "
+							"for section symbol of section `%s'",
+							&shstrtab[GET(shdrs[sym_shndx].sh_name)]);
+					}
+				}
+			}
+		}
+	}
+	elfimage_phase(img, "index_symbols", &t);
+	/* Now we look for relocs referring to section syms from non-debug sections
+	 * *or* to named ordinary syms from debug sections. Both need to be rewritten.
+	 * Each rel section only rewrites its own r_info words, so we can farm them
+	 * out to threads, splitting big ones (think .rela.debug_info) into shards. */
+	unsigned nshards = 0;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + shnum; ++shdr)
+	{
+		if (IS_RELOC_SECTION_TO_SCAN(shdr))
+		{
+			nshards += SHARDS_FOR(shdr);
+		}
+	}
+	struct reloc_shard *shards = calloc(nshards ? nshards : 1, sizeof (struct reloc_shard));
+	if (!shards) err(1, "allocating reloc shards");
+	unsigned i_shard = 0;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + shnum; ++shdr)
+	{
+		if (IS_RELOC_SECTION_TO_SCAN(shdr))
+		{
+			for (unsigned i = 0; i < SHARDS_FOR(shdr); ++i)
+			{
+				shards[i_shard++] = (struct reloc_shard) {
+					.shdr = shdr,
+					.begin = i * SHARD_NRELS,
+					.end = (i + 1) * SHARD_NRELS
+				};
+			}
+		}
+	}
+	assert(i_shard == nshards);
+	struct rewrite_context ctxt = {
+		.img = img,
+		.mapping = mapping,
+		.shdrs = shdrs,
+		.shnum = shnum,
+		.shstrtab = shstrtab,
+		.symtab_indexes = symtab_indexes,
+		.zero_offset_list = zero_offset_list,
+		.shards = shards,
+		.nshards = nshards,
+		.next_shard = 0
+	};
+	if (nthreads == 0)
+	{
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = (ncpus > 0) ? ncpus : 1;
+	}
+	if (nthreads > nshards) nthreads = nshards;
+	if (nthreads <= 1)
+	{
+		/* Do it all in this thread, warning as we go. */
+		for (unsigned i = 0; i < nshards; ++i) ELFN(rewrite_relocs)(&ctxt, &shards[i]);
+	}
+	else
+	{
+		/* Warnings are buffered per shard, then printed in shard order,
+		 * so the output does not depend on scheduling. */
+		for (unsigned i = 0; i < nshards; ++i)
+		{
+			shards[i].msgs = open_memstream(&shards[i].msgbuf, &shards[i].msgbuf_size);
+			if (!shards[i].msgs) err(1, "opening warnings buffer");
+		}
+		pthread_t threads[nthreads];
+		for (unsigned i = 0; i < nthreads; ++i)
+		{
+			ret = pthread_create(&threads[i], NULL, ELFN(rewrite_relocs_thread), &ctxt);
+			if (ret) errx(1, "creating thread: %s", strerror(ret));
+		}
+		for (unsigned i = 0; i < nthreads; ++i) pthread_join(threads[i], NULL);
+		for (unsigned i = 0; i < nshards; ++i)
+		{
+			fclose(shards[i].msgs);
+			for (char *line = shards[i].msgbuf, *nl;
+					line < shards[i].msgbuf + shards[i].msgbuf_size;
+					line = nl + 1)
+			{
+				nl = strchr(line, '\n');
+				*nl = '\0';
+				elfimage_warnx(img, "%s", line);
+			}
+			free(shards[i].msgbuf);
+		}
+	}
+	free(shards);
+	elfimage_phase(img, "rewrite_relocs", &t);
+
+	for (unsigned i = 0; i < shnum; ++i)
+	{
+		free(symtab_indexes[i].section_sym_by_shndx);
+		free(symtab_indexes[i].zero_offset_by_shndx);
+		free(symtab_indexes[i].from_debug_interest);
+		free(symtab_indexes[i].from_nondebug_interest);
+	}
+	free(symtab_indexes);
+	if (zero_offset_list) free(zero_offset_list);
+	nameset_destroy(&symnames);
+	return 0;
+}
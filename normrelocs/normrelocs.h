@@ -1,7 +1,13 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+struct elfimage;
 int normrelocs(char *filename, char *maybe_symname);
+int normrelocs_multi(char *filename, char **maybe_symnames, unsigned nsymnames,
+	unsigned nthreads);
+/* As normrelocs_multi, but on an image that is already mapped. */
+int normrelocs_pass(struct elfimage *img, char **maybe_symnames, unsigned nsymnames,
+	unsigned nthreads);
 #ifdef __cplusplus
 }
 #endif
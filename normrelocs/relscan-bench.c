@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include <time.h>
+#include <err.h>
+#include <libgen.h>
+#include "relscan.h"
+
+/*
+ Microbenchmark for the relscan kernels, over synthetic relocation arrays.
+ We fill an array of Rel or Rela records with random symbol indices, mark
+ a given fraction of the symbols as interesting, then time each kernel and
+ check that they all find the same records.
+ */
+
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [<nrels> [<nsyms> [<percent-interesting> [rel|rela]]]]\n",
+		basename);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct kernel
+{
+	const char *name;
+	relscan_fn *fn;
+};
+
+int main(int argc, char **argv)
+{
+	if (argc > 5)
+	{
+		usage(basename(argv[0]));
+		return 1;
+	}
+	size_t nrels = (argc > 1) ? strtoul(argv[1], NULL, 0) : 4u<<20;
+	uint32_t nsyms = (argc > 2) ? strtoul(argv[2], NULL, 0) : 100000;
+	double percent = (argc > 3) ? atof(argv[3]) : 1.0;
+	size_t entsize = (argc > 4 && 0 == strcmp(argv[4], "rel")) ?
+		sizeof (Elf64_Rel) : sizeof (Elf64_Rela);
+	if (nsyms == 0) errx(1, "need at least one symbol");
+
+	unsigned char *rels = calloc(nrels, entsize);
+	uint32_t *bitmap = calloc(RELSCAN_BITMAP_WORDS(nsyms), sizeof (uint32_t));
+	if (!rels || !bitmap) err(1, "allocating");
+	srandom(42);
+	for (uint32_t s = 0; s < nsyms; ++s)
+	{
+		if (random() < percent / 100.0 * RAND_MAX) bitmap[s >> 5] |= 1u << (s & 31);
+	}
+	for (size_t i = 0; i < nrels; ++i)
+	{
+		Elf64_Xword r_info = ELF64_R_INFO(random() % nsyms, R_X86_64_64);
+		memcpy(rels + i * entsize + offsetof(Elf64_Rel, r_info), &r_info, sizeof r_info);
+	}
+
+	struct kernel kernels[] = {
+		{ "scalar", relscan_scalar },
+#if defined(__x86_64__)
+		{ "sse2", relscan_sse2 },
+#endif
+#if defined(__x86_64__)
+		{ "avx2", __builtin_cpu_supports("avx2") ? relscan_avx2 : NULL },
+#endif
+		{ "dispatch", relscan }
+	};
+	const unsigned nkernels = sizeof kernels / sizeof kernels[0];
+	uint32_t *reference = malloc(nrels * sizeof (uint32_t));
+	uint32_t *out = malloc(nrels * sizeof (uint32_t));
+	if (!reference || !out) err(1, "allocating");
+	size_t nreference = relscan_scalar(rels, entsize, nrels, bitmap, nsyms, reference);
+	printf("%zu %s records, %u symbols, %zu matches (%.2f%%)\n",
+		nrels, (entsize == sizeof (Elf64_Rel)) ? "Rel" : "Rela", nsyms,
+		nreference, 100.0 * nreference / (nrels ? nrels : 1));
+	printf("%-10s %12s %12s\n", "kernel", "ns/record", "Mrecords/s");
+#define NTRIALS 5
+	for (unsigned k = 0; k < nkernels; ++k)
+	{
+		if (!kernels[k].fn)
+		{
+			printf("%-10s %12s\n", kernels[k].name, "(no cpu support)");
+			continue;
+		}
+		double best = -1;
+		for (unsigned t = 0; t < NTRIALS; ++t)
+		{
+			double start = now();
+			size_t nout = kernels[k].fn(rels, entsize, nrels, bitmap, nsyms, out);
+			double elapsed = now() - start;
+			if (nout != nreference || 0 != memcmp(out, reference, nout * sizeof (uint32_t)))
+			{
+				errx(2, "kernel %s disagrees with scalar", kernels[k].name);
+			}
+			if (best < 0 || elapsed < best) best = elapsed;
+		}
+		printf("%-10s %12.3f %12.1f\n", kernels[k].name,
+			best * 1e9 / (nrels ? nrels : 1), nrels / best / 1e6);
+	}
+	free(out);
+	free(reference);
+	free(bitmap);
+	free(rels);
+	return 0;
+}
@@ -0,0 +1,150 @@
+#include <string.h>
+#include <elf.h>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "relscan.h"
+
+/*
+ Most relocs in a big object are of no interest to normrelocs: their symbol
+ is neither a section symbol nor a zero-offset candidate. Rather than copy
+ out and decode every record, we pull out ELF64_R_SYM from a batch of records
+ at once and test it against a bitmap of interesting symbol indices. Only the
+ matches go on to the full rewrite logic.
+
+ Rel and Rela both keep r_info at offset 8, and on a little-endian machine the
+ symbol index is the upper 32 bits of it, i.e. the 32-bit word at offset 12.
+ So we never need the whole record.
+ */
+
+#define R_SYM_OFFSET (offsetof(Elf64_Rel, r_info) + 4)
+
+static inline uint32_t load_r_sym(const unsigned char *rel)
+{
+	uint32_t sym;
+	memcpy(&sym, rel + R_SYM_OFFSET, sizeof sym);
+	return sym;
+}
+
+size_t relscan_scalar(const unsigned char *rels, size_t entsize, size_t n,
+	const uint32_t *bitmap, uint32_t nbits, uint32_t *out)
+{
+	size_t nout = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		uint32_t sym = load_r_sym(rels + i * entsize);
+		if (sym < nbits && (bitmap[sym >> 5] >> (sym & 31)) & 1) out[nout++] = i;
+	}
+	return nout;
+}
+
+#if defined(__x86_64__)
+/* The vector loops leave fewer than a vector's worth of records at the end. */
+static size_t scan_tail(const unsigned char *rels, size_t entsize, size_t n,
+	const uint32_t *bitmap, uint32_t nbits, uint32_t *out, size_t start)
+{
+	size_t nout = relscan_scalar(rels + start * entsize, entsize, n - start,
+		bitmap, nbits, out);
+	for (size_t j = 0; j < nout; ++j) out[j] += start;
+	return nout;
+}
+#define APPEND_LANES(mask, first) do { \
+	unsigned m_ = (mask); \
+	while (m_) \
+	{ \
+		out[nout++] = (first) + __builtin_ctz(m_); \
+		m_ &= m_ - 1; \
+	} } while (0)
+
+/* SSE2 has neither gathers nor per-lane variable shifts. We fetch the four
+ * symbol indices and their bitmap words with scalar loads, then do the
+ * bit-twiddling four lanes at a time. 1<<bit comes from building the float
+ * 2^bit in the exponent field and converting it back (for bit 31 the
+ * conversion overflows to 0x80000000, which happens to be the right answer). */
+size_t relscan_sse2(const unsigned char *rels, size_t entsize, size_t n,
+	const uint32_t *bitmap, uint32_t nbits, uint32_t *out)
+{
+	size_t nout = 0;
+	size_t i = 0;
+	const __m128i thirtyone = _mm_set1_epi32(31);
+	const __m128i bias = _mm_set1_epi32(127);
+	const __m128i zero = _mm_setzero_si128();
+#define WORD_FOR(s) (((s) < nbits) ? bitmap[(s) >> 5] : 0)
+	for (; i + 4 <= n; i += 4)
+	{
+		const unsigned char *p = rels + i * entsize;
+		uint32_t s0 = load_r_sym(p);
+		uint32_t s1 = load_r_sym(p + entsize);
+		uint32_t s2 = load_r_sym(p + 2 * entsize);
+		uint32_t s3 = load_r_sym(p + 3 * entsize);
+		__m128i syms = _mm_setr_epi32(s0, s1, s2, s3);
+		__m128i words = _mm_setr_epi32(WORD_FOR(s0), WORD_FOR(s1), WORD_FOR(s2), WORD_FOR(s3));
+		__m128i bits = _mm_and_si128(syms, thirtyone);
+		__m128i masks = _mm_cvttps_epi32(_mm_castsi128_ps(
+			_mm_slli_epi32(_mm_add_epi32(bits, bias), 23)));
+		/* all-ones in the lanes whose bit is *clear* */
+		__m128i miss = _mm_cmpeq_epi32(_mm_and_si128(words, masks), zero);
+		APPEND_LANES(~_mm_movemask_ps(_mm_castsi128_ps(miss)) & 0xf, i);
+	}
+#undef WORD_FOR
+	return nout + scan_tail(rels, entsize, n, bitmap, nbits, out + nout, i);
+}
+
+/* With AVX2 we can gather both the symbol indices (at a fixed stride) and
+ * their bitmap words, eight records at a time. Out-of-range indices are
+ * clamped to 'nbits', whose bit is clear by contract. */
+__attribute__((target("avx2")))
+size_t relscan_avx2(const unsigned char *rels, size_t entsize, size_t n,
+	const uint32_t *bitmap, uint32_t nbits, uint32_t *out)
+{
+	size_t nout = 0;
+	size_t i = 0;
+	const __m256i strides = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+		_mm256_set1_epi32((int) entsize));
+	const __m256i limit = _mm256_set1_epi32((int) nbits);
+	const __m256i thirtyone = _mm256_set1_epi32(31);
+	const __m256i one = _mm256_set1_epi32(1);
+	for (; i + 8 <= n; i += 8)
+	{
+		const unsigned char *p = rels + i * entsize + R_SYM_OFFSET;
+		__m256i syms = _mm256_i32gather_epi32((const int *) p, strides, 1);
+		syms = _mm256_min_epu32(syms, limit);
+		__m256i words = _mm256_i32gather_epi32((const int *) bitmap,
+			_mm256_srli_epi32(syms, 5), 4);
+		__m256i bits = _mm256_and_si256(
+			_mm256_srlv_epi32(words, _mm256_and_si256(syms, thirtyone)), one);
+		APPEND_LANES(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(bits, 31))), i);
+	}
+	return nout + scan_tail(rels, entsize, n, bitmap, nbits, out + nout, i);
+}
+#undef APPEND_LANES
+#endif
+
+static relscan_fn *best_relscan(void)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return relscan_avx2;
+	/* Without gathers, relscan_sse2 is no quicker than the scalar loop
+	 * (see relscan-bench), so we don't pick it. */
+	return relscan_scalar;
+#else
+	return relscan_scalar;
+#endif
+}
+
+size_t relscan(const unsigned char *rels, size_t entsize, size_t n,
+	const uint32_t *bitmap, uint32_t nbits, uint32_t *out)
+{
+	static relscan_fn *chosen;
+	relscan_fn *f = __atomic_load_n(&chosen, __ATOMIC_RELAXED);
+	if (!f)
+	{
+		/* Racing threads all pick the same one, so no harm done. */
+		f = best_relscan();
+		__atomic_store_n(&chosen, f, __ATOMIC_RELAXED);
+	}
+	return f(rels, entsize, n, bitmap, nbits, out);
+}
@@ -0,0 +1,30 @@
+#ifndef RELSCAN_H_
+#define RELSCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* Scan 'n' Elf64_Rel or Elf64_Rela records starting at 'rels', 'entsize' bytes
+ * apart, and write to 'out' the index of each record whose ELF64_R_SYM is set
+ * in 'bitmap'. The bitmap covers symbol indices [0, nbits) and must have a
+ * clear bit at index 'nbits' (i.e. at least nbits/32 + 1 words). Indices at or
+ * beyond 'nbits' never match. 'out' needs room for 'n' entries.
+ * Returns the number of matches. */
+typedef size_t relscan_fn(const unsigned char *rels, size_t entsize, size_t n,
+	const uint32_t *bitmap, uint32_t nbits, uint32_t *out);
+relscan_fn relscan_scalar;
+#if defined(__x86_64__)
+relscan_fn relscan_sse2;
+relscan_fn relscan_avx2;
+#endif
+/* Picks the best of the above for this CPU. */
+relscan_fn relscan;
+#define RELSCAN_BITMAP_WORDS(nbits) ((nbits) / 32 + 2)
+#ifdef __cplusplus
+}
+#endif
+
+#endif
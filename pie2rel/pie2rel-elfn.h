@@ -0,0 +1,44 @@
+/* pie2rel_pass for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static int ELFN(pie2rel_pass)(struct elfimage *img)
+{
+	ElfN(Ehdr) *ehdr = img->ehdr;
+	ElfN(Shdr) *shdrs = img->shdrs;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)  // FIXME: respect entsz
+	{
+		if (GET(shdr->sh_type) == SHT_SYMTAB)
+		{
+			/* Let's walk the symbols and make sure any non-UND non-ABSs are
+			 * sectoin-relative. */
+			ElfN(Sym) *syms = ELFN_SECTION_DATA(img, *shdr);
+			ElfN(Word) *xindex = elfimage_symtab_xindex(img, shdr);
+			ElfN(Sym) *syms_end = (ElfN(Sym) *) ((char*) syms + GET(shdr->sh_size));
+			for (ElfN(Sym) *sym = syms; sym != syms_end; ++sym) // FIXME: respect entsz
+			{
+				ElfN(Word) shn = ELFN(elfimage_sym_section)(syms, sym, xindex);
+				if (shn)
+				{
+					assert(shn < img->shnum);
+					ElfN(Shdr) *shdr = &shdrs[shn];
+					SET(sym->st_value, GET(sym->st_value) - GET(shdr->sh_addr));
+				}
+			}
+		}
+	}
+	/* Now drop the section addresses. */
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)  // FIXME: respect entsz
+	{
+		if (GET(shdr->sh_flags) & SHF_ALLOC)
+		{
+			shdr->sh_addr = 0;
+		}
+	}
+	/* Now doctor the ELF header */
+	SET(ehdr->e_type, ET_REL);
+	ehdr->e_phoff = 0;
+	ehdr->e_phentsize = 0;
+	if (GET(ehdr->e_phnum) == PN_XNUM && shdrs) shdrs[0].sh_info = 0;
+	ehdr->e_phnum = 0;
+	return 0;
+}
@@ -0,0 +1,9 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+int pie2rel(char *filename);
+int pie2rel_pass(struct elfimage *img);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,15 @@
+/* rel2data_pass for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static int ELFN(rel2data_pass)(struct elfimage *img)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_REL || GET(shdr->sh_type) == SHT_RELA)
+		{
+			SET(shdr->sh_type, SHT_PROGBITS);
+		}
+	}
+	return 0;
+}
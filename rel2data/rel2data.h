@@ -0,0 +1,9 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+int rel2data(char *filename);
+int rel2data_pass(struct elfimage *img);
+#ifdef __cplusplus
+}
+#endif
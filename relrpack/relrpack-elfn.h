@@ -0,0 +1,321 @@
+/* The body of relrpack.c, for one ELF class and byte order; see elfn.h.
+ * RELR words are ElfN(Addr) wide. */
+#include "elfn.h"
+
+static ElfN(Dyn) *ELFN(find_dyn)(struct elfimage *img, Elf64_Sxword tag)
+{
+	ElfN(Shdr) *shdr = img->dynamic_shdr;
+	if (!shdr) return NULL;
+	for (ElfN(Dyn) *d = SECTION_DATA(*shdr);
+			d < (ElfN(Dyn) *) ((char*) SECTION_DATA(*shdr) + GET(shdr->sh_size))
+				&& d->d_tag != DT_NULL;
+			++d)
+	{
+		if (GET(d->d_tag) == tag) return d;
+	}
+	return NULL;
+}
+
+/* The word at 'addr', if it is in the file part of a segment. */
+static ElfN(Addr) *ELFN(file_word)(struct elfimage *img, Elf64_Addr addr)
+{
+	ElfN(Phdr) *phdrs = img->phdrs;
+	for (ElfN(Phdr) *phdr = phdrs; phdr && phdr < phdrs + img->phnum; ++phdr)
+	{
+		if (GET(phdr->p_type) == PT_LOAD && addr >= GET(phdr->p_vaddr)
+				&& addr + sizeof (ElfN(Addr)) <= (Elf64_Addr) GET(phdr->p_vaddr) + GET(phdr->p_filesz))
+		{
+			return ELFIMAGE_DATA(img, GET(phdr->p_offset) + (addr - GET(phdr->p_vaddr)),
+				sizeof (ElfN(Addr)));
+		}
+	}
+	return NULL;
+}
+
+/* Encode the sorted, distinct, word-aligned 'offsets' as RELR into 'out'
+ * (which has room for one word each), returning how many words. Each
+ * address entry is followed by bitmap entries (low bit set) for the 63
+ * (or in ELF32, 31) words after the last word covered. */
+static size_t ELFN(relr_encode)(const struct packable *p, size_t n, ElfN(Addr) *out)
+{
+	const size_t nbits = 8 * sizeof (ElfN(Addr)) - 1;
+	size_t nout = 0;
+	for (size_t i = 0; i < n; )
+	{
+		SET(out[nout++], p[i].offset);
+		Elf64_Addr base = p[i++].offset + sizeof (ElfN(Addr));
+		for (;;)
+		{
+			ElfN(Addr) bitmap = 0;
+			for (; i < n; ++i)
+			{
+				Elf64_Addr delta = p[i].offset - base;
+				if (delta >= nbits * sizeof (ElfN(Addr))) break;
+				bitmap |= (ElfN(Addr)) 1 << (delta / sizeof (ElfN(Addr)));
+			}
+			if (!bitmap) break;
+			SET(out[nout++], (bitmap << 1) | 1);
+			base += nbits * sizeof (ElfN(Addr));
+		}
+	}
+	return nout;
+}
+
+static int ELFN(relrpack_pass)(struct elfimage *img)
+{
+	double t = elfimage_clock();
+	ElfN(Ehdr) *ehdr = img->ehdr;
+	Elf64_Word relative = 0;
+	for (unsigned i = 0; i < sizeof relative_types / sizeof relative_types[0]; ++i)
+	{
+		if (relative_types[i].elfclass == ELFN_CLASS
+				&& relative_types[i].machine == GET(ehdr->e_machine)) relative = relative_types[i].relative;
+	}
+	ElfN(Shdr) *shdrs = img->shdrs;
+	ElfN(Shdr) *dynamic_shdr = img->dynamic_shdr;
+	if (!dynamic_shdr) return 0; // nothing to do
+	if (!relative)
+	{
+		elfimage_warnx(img, "don't know the dynamic relocs of machine %u (ELF%d)",
+			(unsigned) GET(ehdr->e_machine), ELFN_CLASS == ELFCLASS32 ? 32 : 64);
+		return 1;
+	}
+	if (ELFN(find_dyn)(img, DT_RELR))
+	{
+		if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "already has DT_RELR");
+		return 0;
+	}
+	ElfN(Dyn) *rela = ELFN(find_dyn)(img, DT_RELA);
+	ElfN(Dyn) *relasz = ELFN(find_dyn)(img, DT_RELASZ);
+	ElfN(Dyn) *relacount = ELFN(find_dyn)(img, DT_RELACOUNT);
+	if (!rela || !relasz) return 0;
+	ElfN(Shdr) *rela_shdr = NULL;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_RELA && (GET(shdr->sh_flags) & SHF_ALLOC)
+				&& GET(shdr->sh_addr) == GET(rela->d_un.d_ptr)) { rela_shdr = shdr; break; }
+	}
+	if (!rela_shdr || GET(rela_shdr->sh_size) != GET(relasz->d_un.d_val))
+	{
+		elfimage_warnx(img, "DT_RELA is not exactly one section; leaving its relocs as they are");
+		return 0;
+	}
+	/* Room for three tags and the DT_NULL that ends them? */
+	ElfN(Dyn) *dyns = SECTION_DATA(*dynamic_shdr);
+	ElfN(Dyn) *dyns_end = dyns + GET(dynamic_shdr->sh_size) / sizeof (ElfN(Dyn));
+	ElfN(Dyn) *spare = dyns;
+	while (spare < dyns_end && spare->d_tag != DT_NULL) ++spare;
+	if (dyns_end - spare < 4)
+	{
+		elfimage_warnx(img, "no room in .dynamic for DT_RELR, DT_RELRSZ and DT_RELRENT; "
+			"leaving relocs as they are");
+		return 0;
+	}
+
+	/* Which relocs can we pack? */
+	ElfN(Rela) *relas = SECTION_DATA(*rela_shdr);
+	Elf64_Word nrelas = GET(rela_shdr->sh_size) / sizeof (ElfN(Rela));
+	struct packable *packable = malloc((nrelas ? nrelas : 1) * sizeof (struct packable));
+	_Bool *packed = calloc(nrelas ? nrelas : 1, sizeof (_Bool));
+	if (!packable || !packed) err(1, "allocating relocs");
+	size_t npackable = 0;
+	for (Elf64_Word i = 0; i < nrelas; ++i)
+	{
+		if (ELFN_R_TYPE(GET(relas[i].r_info)) == relative
+				&& GET(relas[i].r_offset) % sizeof (ElfN(Addr)) == 0
+				&& ELFN(file_word)(img, GET(relas[i].r_offset)))
+		{
+			packable[npackable++] = (struct packable) { GET(relas[i].r_offset), i };
+		}
+	}
+	qsort(packable, npackable, sizeof (struct packable), compare_packable);
+	/* Two relocs at the same place (which would be odd) stay as they are. */
+	size_t ndistinct = 0;
+	for (size_t i = 0; i < npackable; ++i)
+	{
+		if ((i > 0 && packable[i].offset == packable[i - 1].offset)
+				|| (i + 1 < npackable && packable[i].offset == packable[i + 1].offset)) continue;
+		packable[ndistinct++] = packable[i];
+	}
+	npackable = ndistinct;
+	ElfN(Addr) *relr = malloc((npackable ? npackable : 1) * sizeof (ElfN(Addr)));
+	if (!relr) err(1, "allocating RELR table");
+	size_t nrelr = ELFN(relr_encode)(packable, npackable, relr);
+	elfimage_phase(img, "encode", &t);
+
+	/* Do we need to add the version need, and where? */
+	ElfN(Shdr) *verneed_shdr = NULL, *verdef_shdr = NULL;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_GNU_verneed && !verneed_shdr) verneed_shdr = shdr;
+		if (GET(shdr->sh_type) == SHT_GNU_verdef && !verdef_shdr) verdef_shdr = shdr;
+	}
+	ElfN(Verneed) *libc_need = NULL;
+	ElfN(Vernaux) *libc_last_aux = NULL;
+	_Bool have_relr_version = 0;
+	Elf64_Half max_version = VER_NDX_GLOBAL;
+	const char *verstr = NULL;
+	if (verneed_shdr)
+	{
+		verstr = SECTION_DATA(shdrs[GET(verneed_shdr->sh_link)]);
+		char *vn_pos = SECTION_DATA(*verneed_shdr);
+		for (Elf64_Word i = 0; i < GET(verneed_shdr->sh_info); ++i)
+		{
+			ElfN(Verneed) *vn = (ElfN(Verneed) *) vn_pos;
+			_Bool is_libc = (0 == strcmp(&verstr[GET(vn->vn_file)], "libc.so.6"));
+			if (is_libc) libc_need = vn;
+			char *aux_pos = vn_pos + GET(vn->vn_aux);
+			for (Elf64_Half j = 0; j < GET(vn->vn_cnt); ++j)
+			{
+				ElfN(Vernaux) *aux = (ElfN(Vernaux) *) aux_pos;
+				if ((GET(aux->vna_other) & 0x7fff) > max_version) max_version = GET(aux->vna_other) & 0x7fff;
+				if (is_libc && 0 == strcmp(&verstr[GET(aux->vna_name)], RELR_VERSION)) have_relr_version = 1;
+				if (is_libc && !aux->vna_next) libc_last_aux = aux;
+				aux_pos += GET(aux->vna_next);
+			}
+			if (!vn->vn_next) break;
+			vn_pos += GET(vn->vn_next);
+		}
+	}
+	if (verdef_shdr)
+	{
+		char *vd_pos = SECTION_DATA(*verdef_shdr);
+		for (Elf64_Word i = 0; i < GET(verdef_shdr->sh_info); ++i)
+		{
+			ElfN(Verdef) *vd = (ElfN(Verdef) *) vd_pos;
+			if ((GET(vd->vd_ndx) & 0x7fff) > max_version) max_version = GET(vd->vd_ndx) & 0x7fff;
+			if (!vd->vd_next) break;
+			vd_pos += GET(vd->vd_next);
+		}
+	}
+	_Bool add_version = libc_need && !have_relr_version;
+	if (!libc_need && ELFIMAGE_VERBOSE(img, 1))
+	{
+		elfimage_note(img, "no version need for libc.so.6, so not adding " RELR_VERSION);
+	}
+	Elf64_Addr last_aux_addr = 0;
+	long version_name = -1;
+	if (add_version)
+	{
+		last_aux_addr = GET(verneed_shdr->sh_addr)
+			+ ((char*) libc_last_aux - (char*) SECTION_DATA(*verneed_shdr));
+		ElfN(Shdr) *verstr_shdr = &shdrs[GET(verneed_shdr->sh_link)];
+		const char *found = memmem(verstr, GET(verstr_shdr->sh_size), RELR_VERSION, sizeof RELR_VERSION);
+		if (found) version_name = found - verstr;
+		/* vna_next is unsigned, so the space must come after the last
+		 * version. */
+		if (!libc_last_aux || last_aux_addr >= GET(rela_shdr->sh_addr))
+		{
+			elfimage_warnx(img, "cannot add version need " RELR_VERSION
+				" after .rela.dyn; leaving relocs as they are");
+			goto out;
+		}
+	}
+
+	/* Lay out the space .rela.dyn had: the new version need (if any), the
+	 * relocs we keep, and the RELR table. */
+	size_t aux_size = add_version ? sizeof (ElfN(Vernaux)) : 0;
+	size_t nkept = nrelas - npackable;
+	size_t relr_at = aux_size + nkept * sizeof (ElfN(Rela));
+	size_t used = relr_at + nrelr * sizeof (ElfN(Addr));
+	if (!npackable || used >= GET(rela_shdr->sh_size))
+	{
+		if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "nothing to gain from RELR");
+		goto out;
+	}
+	if (add_version && version_name == -1)
+	{
+		/* This can remap the image, so we start again afterwards, when
+		 * the name will be there to find. */
+		if (-1 == dynstr_append(img, GET(verneed_shdr->sh_link), RELR_VERSION, sizeof RELR_VERSION))
+		{
+			elfimage_warnx(img, "cannot add " RELR_VERSION " to .dynstr; leaving relocs as they are");
+			goto out;
+		}
+		if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "added " RELR_VERSION " to .dynstr");
+		free(relr);
+		free(packed);
+		free(packable);
+		return ELFN(relrpack_pass)(img);
+	}
+	char *space = calloc(1, GET(rela_shdr->sh_size));
+	if (!space) err(1, "allocating relocs");
+	for (size_t i = 0; i < npackable; ++i) packed[packable[i].index] = 1;
+	ElfN(Rela) *kept = (ElfN(Rela) *) (space + aux_size);
+	Elf64_Word nleading_relative = 0;
+	for (Elf64_Word i = 0, k = 0; i < nrelas; ++i)
+	{
+		if (packed[i])
+		{
+			/* The addend is in the file's byte order already. */
+			*ELFN(file_word)(img, GET(relas[i].r_offset)) = relas[i].r_addend;
+			continue;
+		}
+		if (k == nleading_relative && ELFN_R_TYPE(GET(relas[i].r_info)) == relative) ++nleading_relative;
+		kept[k++] = relas[i];
+	}
+	memcpy(space + relr_at, relr, nrelr * sizeof (ElfN(Addr)));
+	Elf64_Addr base = GET(rela_shdr->sh_addr);
+	if (add_version)
+	{
+		ElfN(Vernaux) *aux = (ElfN(Vernaux) *) space;
+		SET(aux->vna_hash, elf_sysv_hash(RELR_VERSION));
+		SET(aux->vna_flags, 0);
+		SET(aux->vna_other, max_version + 1);
+		SET(aux->vna_name, version_name);
+		SET(aux->vna_next, 0);
+		SET(libc_last_aux->vna_next, base - last_aux_addr);
+		SET(libc_need->vn_cnt, GET(libc_need->vn_cnt) + 1);
+		if (GET(verneed_shdr->sh_offset) + GET(verneed_shdr->sh_size) == GET(rela_shdr->sh_offset))
+		{
+			SET(verneed_shdr->sh_size, GET(verneed_shdr->sh_size) + aux_size);
+		}
+		else if (ELFIMAGE_VERBOSE(img, 1))
+		{
+			elfimage_note(img, "version need " RELR_VERSION " is outside .gnu.version_r");
+		}
+	}
+	memcpy(SECTION_DATA(*rela_shdr), space, GET(rela_shdr->sh_size));
+	free(space);
+
+	Elf64_Xword old_size = GET(rela_shdr->sh_size);
+	Elf64_Off relr_offset = GET(rela_shdr->sh_offset) + relr_at;
+	SET(rela->d_un.d_ptr, GET(rela->d_un.d_ptr) + aux_size);
+	SET(relasz->d_un.d_val, nkept * sizeof (ElfN(Rela)));
+	if (relacount) SET(relacount->d_un.d_val, nleading_relative);
+	SET(spare[0].d_tag, DT_RELR);
+	SET(spare[0].d_un.d_ptr, base + relr_at);
+	SET(spare[1].d_tag, DT_RELRSZ);
+	SET(spare[1].d_un.d_val, nrelr * sizeof (ElfN(Addr)));
+	SET(spare[2].d_tag, DT_RELRENT);
+	SET(spare[2].d_un.d_val, sizeof (ElfN(Addr)));
+	spare[3] = (ElfN(Dyn)) { .d_tag = DT_NULL };
+	SET(rela_shdr->sh_offset, GET(rela_shdr->sh_offset) + aux_size);
+	SET(rela_shdr->sh_addr, GET(rela_shdr->sh_addr) + aux_size);
+	SET(rela_shdr->sh_size, nkept * sizeof (ElfN(Rela)));
+	elfimage_count(img, ELFIMAGE_RELOCS_REWRITTEN, npackable);
+
+	/* Last, since it remaps the image. ld.so needs only the tags, so a
+	 * buffer image (which cannot grow) goes without the section header. */
+	ElfN(Shdr) *relr_shdr = elfimage_add_section(img, ".relr.dyn", SHT_RELR, SHF_ALLOC, 0,
+		sizeof (ElfN(Addr)));
+	if (relr_shdr)
+	{
+		SET(relr_shdr->sh_offset, relr_offset);
+		SET(relr_shdr->sh_addr, base + relr_at);
+		SET(relr_shdr->sh_size, nrelr * sizeof (ElfN(Addr)));
+		SET(relr_shdr->sh_entsize, sizeof (ElfN(Addr)));
+	}
+	elfimage_phase(img, "rewrite", &t);
+	elfimage_note(img, "packed %lu of %lu relocs into %lu RELR words: %lu bytes of "
+		"relocs now %lu, %lu fewer for ld.so to read",
+		(unsigned long) npackable, (unsigned long) nrelas, (unsigned long) nrelr,
+		(unsigned long) old_size, (unsigned long) (nkept * sizeof (ElfN(Rela)) + nrelr * sizeof (ElfN(Addr))),
+		(unsigned long) (old_size - nkept * sizeof (ElfN(Rela)) - nrelr * sizeof (ElfN(Addr))));
+out:
+	elfimage_count(img, ELFIMAGE_RELOCS_SCANNED, nrelas);
+	free(relr);
+	free(packed);
+	free(packable);
+	return 0;
+}
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <libgen.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "elfimage.h"
+#include "batch.h"
+#include "gnuhash.h"
+#include "dynstr.h"
+#include "relrpack.h"
+
+/*
+ Here we pack the RELATIVE relocs of a linked shared object (or PIE) into
+ a RELR table (.relr.dyn), as ld -z pack-relative-relocs does, after the
+ fact. A RELA entry is 24 bytes (12 in ELF32); RELR describes the same
+ relocs as a base address followed by bitmaps of which of the next 63
+ words (31 in ELF32) need the load address adding, which for the usual
+ runs of pointers is a bit or so apiece. The addends move into the words
+ themselves.
+
+ The RELR table, and what is left of .rela.dyn, go where .rela.dyn was,
+ so nothing else moves. That needs three spare slots in .dynamic, as for
+ dynappend, for DT_RELR, DT_RELRSZ and DT_RELRENT; without them we leave
+ the file as it is.
+
+ glibc (from 2.36) will only load an object with DT_RELR if it needs the
+ version GLIBC_ABI_DT_RELR of libc.so.6, which older ones do not define.
+ So if the object has a version need for libc.so.6, we add that version
+ to it, with the new entry at the front of the space we freed. (ld puts
+ .gnu.version_r just before .rela.dyn, so this usually stays within the
+ section.) If .dynstr lacks the version's name, we add it (see dynstr.h),
+ which may move .dynstr to a new segment, and then start again.
+
+ We only move relocs at word-aligned offsets in the file-backed part of a
+ segment, since the addend has to be written there. The file stays the
+ same size, bar a new section header table; what shrinks is what ld.so
+ reads and walks at load time. LD_DEBUG=statistics shows the time it
+ takes relocating, before and after.
+
+ FIXME: do REL too (i386, ARM).
+ */
+
+#ifdef RELRPACK_AS_LIBRARY
+int relrpack(char *filename)
+{
+	struct elfimage img;
+	int ret = elfimage_open_copy(&img, filename, NULL);
+	if (ret) return ret;
+	ret = relrpack_pass(&img);
+	if (!ret) ret = elfimage_commit(&img);
+	elfimage_close(&img);
+	return ret;
+}
+#else
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-o <output>] [-F|--files-from <listfile>] "
+		"<filename>...\n", basename);
+}
+static int run_pass(struct elfimage *img, void *arg)
+{ (void) arg; return relrpack_pass(img); }
+int main(int argc, char **argv)
+{
+	struct elftin_batch batch = { .njobs = 1, .pass = run_pass };
+	elftin_batch_stamp_word(&batch, "relrpack");
+	static const struct option longopts[] = { ELFTIN_BATCH_OPTIONS, { 0 } };
+	_Bool have_list = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+j:o:F:nSv", longopts, NULL)))
+	{
+		switch (opt)
+		{
+			case 'j': batch.njobs = atoi(optarg); break;
+			case 'o': batch.output = optarg; break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_list = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: usage(basename(argv[0])); return 1;
+		}
+	}
+	if (argc - optind < 1 && !have_list)
+	{
+		usage(basename(argv[0]));
+		return 1;
+	}
+
+	for (int i = optind; i < argc; ++i) elftin_batch_add(&batch, argv[i]);
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	return ret;
+}
+#endif
+
+#define SECTION_DATA(shdr) ELFN_SECTION_DATA(img, (shdr))
+
+/* The ELF32 rows are x32 and AArch64 ILP32. */
+static const struct
+{
+	unsigned char elfclass;
+	Elf64_Half machine;
+	Elf64_Word relative;
+} relative_types[] = {
+	{ ELFCLASS64, EM_X86_64,  R_X86_64_RELATIVE },
+	{ ELFCLASS64, EM_AARCH64, R_AARCH64_RELATIVE },
+	{ ELFCLASS32, EM_X86_64,  R_X86_64_RELATIVE },
+	{ ELFCLASS32, EM_AARCH64, R_AARCH64_P32_RELATIVE }
+};
+
+#define RELR_VERSION "GLIBC_ABI_DT_RELR"
+
+struct packable { Elf64_Addr offset; Elf64_Word index; };
+static int compare_packable(const void *a, const void *b)
+{
+	const struct packable *pa = a, *pb = b;
+	if (pa->offset != pb->offset) return (pa->offset < pb->offset) ? -1 : 1;
+	return (pa->index < pb->index) ? -1 : (pa->index > pb->index);
+}
+
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "relrpack-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "relrpack-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "relrpack-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "relrpack-elfn.h"
+
+/* Returns 1 for a machine we don't know the relocs of. Having nothing to
+ * gain, or no room for the tags, is not an error: we leave the file be. */
+int relrpack_pass(struct elfimage *img)
+{
+	return ELFIMAGE_DISPATCH(img, relrpack_pass, img);
+}
@@ -0,0 +1,9 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+int relrpack(char *filename);
+int relrpack_pass(struct elfimage *img);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,18 @@
+#include <stdio.h>
+
+/* Plenty of RELATIVE relocs, and a libc version need (from printf). */
+static int a, b, c;
+int *ptrs[] = {
+	&a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c,
+	&a, &b, &c, &a, &b, &c, &a, &b, &c, &a, &b, &c
+};
+int check(void)
+{
+	int ok = 1;
+	for (unsigned i = 0; i < sizeof ptrs / sizeof ptrs[0]; ++i)
+	{
+		ok &= (ptrs[i] == ((int *[]) { &a, &b, &c })[i % 3]);
+	}
+	printf("%s\n", ok ? "pointers ok" : "pointers wrong");
+	return ok;
+}
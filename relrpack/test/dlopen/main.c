@@ -0,0 +1,10 @@
+#include <dlfcn.h>
+#include <stdio.h>
+
+int main(int argc, char **argv)
+{
+	void *handle = dlopen(argv[1], RTLD_NOW);
+	if (!handle) { fprintf(stderr, "%s\n", dlerror()); return 1; }
+	int (*check)(void) = (int (*)(void)) dlsym(handle, "check");
+	return !(check && check());
+}
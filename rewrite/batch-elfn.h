@@ -0,0 +1,26 @@
+/* The parts of batch.c that read and write the stamp note, for one ELF
+ * class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static char *ELFN(stamp_desc)(struct elfimage *img)
+{
+	ElfN(Shdr) *shdr = elfimage_section_by_name(img, ELFTIN_STAMP_SECTION);
+	if (!shdr || GET(shdr->sh_type) != SHT_NOTE || GET(shdr->sh_size) != sizeof (struct stamp_note)) return NULL;
+	struct stamp_note *n = ELFN_SECTION_DATA(img, *shdr);
+	if (GET(n->nhdr.n_namesz) != sizeof "elftin" || 0 != strcmp(n->name, "elftin")
+		|| GET(n->nhdr.n_descsz) != ELFTIN_STAMP_SIZE || GET(n->nhdr.n_type) != NT_ELFTIN_PASSES) return NULL;
+	return n->desc;
+}
+
+/* Fills in the new, empty stamp note section 'new_shdr'; returns its
+ * descriptor. */
+static char *ELFN(stamp_init)(struct elfimage *img, void *new_shdr)
+{
+	ElfN(Shdr) *shdr = new_shdr;
+	struct stamp_note *n = ELFN_SECTION_DATA(img, *shdr);
+	SET(n->nhdr.n_namesz, sizeof "elftin");
+	SET(n->nhdr.n_descsz, ELFTIN_STAMP_SIZE);
+	SET(n->nhdr.n_type, NT_ELFTIN_PASSES);
+	strcpy(n->name, "elftin");
+	return n->desc;
+}
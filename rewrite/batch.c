@@ -0,0 +1,628 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <ar.h>
+#include <elf.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "elfimage.h"
+#include "batch.h"
+
+/*
+ Running a pass over many files; see batch.h. We first expand archives
+ into their members, so that the work items are files and members
+ alike, then hand the items out to 'njobs' threads in order.
+
+ An archive is mapped (shared) once, and each ELF member is worked on
+ as a buffer image where it lies -- unless it is not 8-byte aligned
+ (ar pads only to 2), in which case on an aligned copy, which we copy
+ back if the pass succeeds. With -o we first copy the whole archive, as
+ elfimage_open_copy would, and put the copy in place only if every
+ member succeeded.
+
+ For --stats, each item keeps a copy of its image's stats, to which we
+ add the time spent opening, checking, stamping and committing; passes
+ time their own phases, within "pass".
+ */
+
+struct archive
+{
+	const char *filename;
+	const char *output;
+	int fd;
+	char *tmpname;
+	char *mapping;
+	size_t length;
+	int status;          // the worst of its members' (see worse_status)
+};
+struct item
+{
+	char *name;          // for messages
+	struct archive *ar;  // or null, if a file
+	size_t offset;       // of the member's data, in 'ar'
+	size_t size;
+	int status;
+	struct elfimage_stats stats;
+};
+struct run
+{
+	struct elftin_batch *b;
+	struct item *items;
+	unsigned nitems;
+	unsigned next_item;
+	_Bool prefix;        // messages name their file
+	FILE *stats_f;       // stdout, unless the output goes there
+};
+
+static void report_with_name(void *arg, enum elfimage_report_kind kind, const char *msg)
+{
+	const char *name = arg;
+	if (kind == ELFIMAGE_WARNING) warnx("%s: %s", name, msg);
+	else fprintf(stderr, "%s: %s\n", name, msg);
+}
+
+static void setup_image(struct run *r, struct item *it, struct elfimage *img, double *t)
+{
+	if (r->prefix)
+	{
+		img->report = report_with_name;
+		img->report_arg = it->name;
+	}
+	img->verbosity = r->b->verbosity;
+	elfimage_phase(img, "open", t);
+}
+
+static int run_member(struct run *r, struct item *it)
+{
+	struct elftin_batch *b = r->b;
+	char *data = it->ar->mapping + it->offset;
+	void *copy = NULL;
+	/* When checking, the archive is mapped read-only, so we always copy. */
+	if ((uintptr_t) data % 8 || b->check)
+	{
+		if (0 != posix_memalign(&copy, 8, it->size)) err(1, "allocating archive member");
+		memcpy(copy, data, it->size);
+	}
+	struct elfimage img;
+	double t = elfimage_clock();
+	int ret = elfimage_open_buffer(&img, copy ? copy : data, it->size, it->name);
+	if (ret) { free(copy); return ret; }
+	setup_image(r, it, &img, &t);
+	/* A member can't grow, so can't be stamped, but may have been
+	 * stamped before it went into the archive. */
+	if (!(b->stamp && elftin_stamp_has(&img, b->pass_desc)))
+	{
+		ret = b->pass(&img, b->arg);
+		elfimage_phase(&img, "pass", &t);
+		if (!ret && b->check)
+		{
+			ret = elfimage_check_changes(&img, data);
+			elfimage_phase(&img, "check", &t);
+		}
+	}
+	it->stats = img.stats;
+	elfimage_close(&img);
+	if (copy && !ret && !b->check) memcpy(data, copy, it->size);
+	free(copy);
+	return ret;
+}
+
+static int run_file(struct run *r, struct item *it)
+{
+	struct elftin_batch *b = r->b;
+	struct elfimage img;
+	double t = elfimage_clock();
+	/* "-" is stdin, or stdout; a stdin with no -o goes to stdout. */
+	const _Bool from_stdin = (0 == strcmp(it->name, "-"));
+	const _Bool to_stdout = b->output ? (0 == strcmp(b->output, "-")) : from_stdin;
+	int ret;
+	if (from_stdin || to_stdout)
+	{
+		int in_fd = from_stdin ? STDIN_FILENO : open(it->name, O_RDONLY);
+		if (in_fd == -1)
+		{
+			warnx("could not open %s", it->name);
+			return 2;
+		}
+		ret = elfimage_open_stream(&img, in_fd, from_stdin ? "(standard input)" : it->name,
+			to_stdout ? NULL : b->output, b->partial, b->check);
+		if (!from_stdin) close(in_fd);
+	}
+	else ret = b->check ? elfimage_open_check(&img, it->name, b->partial)
+		: b->partial ? elfimage_open_partial(&img, it->name, b->output)
+		: elfimage_open_copy(&img, it->name, b->output);
+	if (ret) return ret;
+	setup_image(r, it, &img, &t);
+	/* Already done, we need only commit the copy (if any). */
+	if (!(b->stamp && elftin_stamp_has(&img, b->pass_desc)))
+	{
+		ret = b->pass(&img, b->arg);
+		elfimage_phase(&img, "pass", &t);
+		if (!ret && b->check)
+		{
+			ret = elfimage_check_changes(&img, NULL);
+			elfimage_phase(&img, "check", &t);
+		}
+		else if (!ret && b->stamp)
+		{
+			if (0 != elftin_stamp_add(&img, b->pass_desc)) ret = 1;
+			elfimage_phase(&img, "stamp", &t);
+		}
+	}
+	if (!ret && to_stdout && !b->check) ret = elfimage_write_out(&img, STDOUT_FILENO);
+	if (!ret)
+	{
+		ret = elfimage_commit(&img);
+		elfimage_phase(&img, "commit", &t);
+	}
+	it->stats = img.stats;
+	elfimage_close(&img);
+	return ret;
+}
+
+/* A failure is worse than changes pending, whatever their numbers; of
+ * two failures, we keep the higher. */
+static int worse_status(int a, int b)
+{
+	if (a == ELFIMAGE_CHANGES_PENDING && b) return b;
+	if (b == ELFIMAGE_CHANGES_PENDING && a) return a;
+	return (b > a) ? b : a;
+}
+
+static void *worker(void *arg)
+{
+	struct run *r = arg;
+	unsigned i;
+	while ((i = __atomic_fetch_add(&r->next_item, 1, __ATOMIC_RELAXED)) < r->nitems)
+	{
+		struct item *it = &r->items[i];
+		if (!it->ar) it->status = run_file(r, it);
+		else if (it->size) it->status = run_member(r, it);
+		// else it stands for an archive we could not use, or with no ELF members
+	}
+	return NULL;
+}
+
+static void add_item(struct run *r, unsigned *items_size, struct item it)
+{
+	if (r->nitems == *items_size)
+	{
+		*items_size = *items_size ? 2 * *items_size : 64;
+		r->items = realloc(r->items, *items_size * sizeof (struct item));
+		if (!r->items) err(1, "reallocating batch items");
+	}
+	r->items[r->nitems++] = it;
+}
+
+_Bool elftin_batch_is_archive(const char *filename)
+{
+	/* We can't peek at stdin without consuming it; an archive there is
+	 * rejected as not ELF. */
+	if (0 == strcmp(filename, "-")) return 0;
+	char magic[SARMAG];
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) return 0; // we'll warn when we open it as an ELF file
+	_Bool ret = (SARMAG == read(fd, magic, SARMAG) && 0 == memcmp(magic, ARMAG, SARMAG));
+	close(fd);
+	return ret;
+}
+
+/* The member's name, from its header or from the "//" table. */
+static char *member_name(const struct archive *ar, const struct ar_hdr *h,
+	const char *longnames, size_t longnames_size)
+{
+	const char *name = h->ar_name;
+	size_t len = sizeof h->ar_name;
+	if (name[0] == '/' && name[1] >= '0' && name[1] <= '9' && longnames)
+	{
+		size_t off = strtoul(name + 1, NULL, 10);
+		if (off < longnames_size)
+		{
+			name = longnames + off;
+			len = longnames_size - off;
+		}
+	}
+	size_t n = 0;
+	while (n < len && name[n] != '/' && name[n] != '\n') ++n;
+	/* Short names can also end in spaces, if there's no '/'. */
+	while (n > 0 && name[n - 1] == ' ') --n;
+	char *full;
+	if (-1 == asprintf(&full, "%s(%.*s)", ar->filename, (int) n, name)) err(1, "allocating member name");
+	return full;
+}
+
+/* Map the archive, or a copy of it, and add an item for each ELF member. */
+static int add_archive(struct run *r, unsigned *items_size, const char *filename,
+	const char *output, _Bool check)
+{
+	struct archive *ar = calloc(1, sizeof (struct archive));
+	if (!ar) err(1, "allocating archive");
+	*ar = (struct archive) { .filename = filename, .output = output, .fd = -1 };
+	int ret = 0;
+	if (output) ret = elfimage_copy_file(filename, output, &ar->fd, &ar->tmpname);
+	else
+	{
+		ar->fd = open(filename, check ? O_RDONLY : O_RDWR);
+		if (ar->fd == -1) { warnx("could not open %s", filename); ret = 2; }
+	}
+	struct stat buf;
+	if (!ret && 0 != fstat(ar->fd, &buf)) { warnx("could not stat %s", filename); ret = 3; }
+	if (!ret)
+	{
+		ar->length = buf.st_size;
+		ar->mapping = mmap(NULL, ar->length, check ? PROT_READ : PROT_READ | PROT_WRITE,
+			MAP_SHARED, ar->fd, 0);
+		if (ar->mapping == MAP_FAILED) { ar->mapping = NULL; warnx("could not mmap %s", filename); ret = 4; }
+	}
+	const char *longnames = NULL;
+	size_t longnames_size = 0;
+	unsigned first_item = r->nitems;
+	for (size_t pos = SARMAG; !ret && pos + sizeof (struct ar_hdr) <= ar->length; )
+	{
+		const struct ar_hdr *h = (const struct ar_hdr *) (ar->mapping + pos);
+		char size_str[sizeof h->ar_size + 1];
+		memcpy(size_str, h->ar_size, sizeof h->ar_size);
+		size_str[sizeof h->ar_size] = '\0';
+		char *end;
+		size_t size = strtoul(size_str, &end, 10);
+		size_t data = pos + sizeof (struct ar_hdr);
+		if (0 != memcmp(h->ar_fmag, ARFMAG, sizeof h->ar_fmag) || end == size_str
+			|| size > ar->length - data)
+		{
+			warnx("%s: bad archive member header at offset %zu", filename, pos);
+			ret = 5;
+			break;
+		}
+		if (0 == memcmp(h->ar_name, "// ", 3))
+		{
+			longnames = ar->mapping + data;
+			longnames_size = size;
+		}
+		/* The symbol index ("/", "/SYM64/") and anything not ELF, we leave. */
+		else if (h->ar_name[0] != '/' || (h->ar_name[1] >= '0' && h->ar_name[1] <= '9'))
+		{
+			if (size >= SELFMAG && 0 == memcmp(ar->mapping + data, ELFMAG, SELFMAG))
+			{
+				add_item(r, items_size, (struct item) {
+					.name = member_name(ar, h, longnames, longnames_size),
+					.ar = ar,
+					.offset = data,
+					.size = size
+				});
+			}
+		}
+		pos = data + size + (size & 1);
+	}
+	/* A bad archive gets none of its members rewritten. Either way,
+	 * if no member item carries the archive (and its status), an empty
+	 * item does. */
+	if (ret)
+	{
+		while (r->nitems > first_item) free(r->items[--r->nitems].name);
+	}
+	if (r->nitems == first_item)
+	{
+		add_item(r, items_size, (struct item) { .ar = ar, .status = ret });
+	}
+	return ret;
+}
+
+/* Returns the archive's status, having put any copy in place. */
+static int finish_archive(struct archive *ar)
+{
+	int status = ar->status;
+	if (ar->mapping) munmap(ar->mapping, ar->length);
+	if (ar->fd != -1) close(ar->fd);
+	if (ar->tmpname)
+	{
+		if (!status && 0 != rename(ar->tmpname, ar->output))
+		{
+			warn("could not rename %s to %s", ar->tmpname, ar->output);
+			status = 1;
+		}
+		if (status) unlink(ar->tmpname);
+		free(ar->tmpname);
+	}
+	free(ar);
+	return status;
+}
+
+/* A stamp is one ELF note, named "elftin", whose descriptor is a fixed
+ * amount of space holding the passes applied, one per line, with NULs
+ * after. Being fixed, later stamps fit in place. */
+struct stamp_note
+{
+	Elf64_Nhdr nhdr; /* the same as Elf32_Nhdr */
+	char name[8];
+	char desc[ELFTIN_STAMP_SIZE];
+};
+
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "batch-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "batch-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "batch-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "batch-elfn.h"
+
+static char *stamp_desc(struct elfimage *img)
+{
+	return ELFIMAGE_DISPATCH(img, stamp_desc, img);
+}
+
+_Bool elftin_stamp_has(struct elfimage *img, const char *pass_desc)
+{
+	const char *desc = stamp_desc(img);
+	size_t len = strlen(pass_desc);
+	for (const char *line = desc; line && line < desc + ELFTIN_STAMP_SIZE && *line; )
+	{
+		const char *end = memchr(line, '\n', desc + ELFTIN_STAMP_SIZE - line);
+		if (!end) break;
+		if ((size_t) (end - line) == len && 0 == memcmp(line, pass_desc, len)) return 1;
+		line = end + 1;
+	}
+	return 0;
+}
+
+int elftin_stamp_add(struct elfimage *img, const char *pass_desc)
+{
+	char *desc = stamp_desc(img);
+	if (!desc)
+	{
+		void *shdr = elfimage_add_section(img, ELFTIN_STAMP_SECTION, SHT_NOTE, 0,
+			sizeof (struct stamp_note), 4);
+		if (!shdr) return -1;
+		desc = ELFIMAGE_DISPATCH(img, stamp_init, img, shdr);
+	}
+	size_t used = strnlen(desc, ELFTIN_STAMP_SIZE);
+	size_t len = strlen(pass_desc);
+	if (used + len + 1 > ELFTIN_STAMP_SIZE)
+	{
+		elfimage_warnx(img, "no room left to stamp %s", img->filename);
+		return -1;
+	}
+	memcpy(desc + used, pass_desc, len);
+	desc[used + len] = '\n';
+	return 0;
+}
+
+void elftin_batch_stamp_word(struct elftin_batch *b, const char *word)
+{
+	size_t old_len = b->pass_desc ? strlen(b->pass_desc) : 0;
+	b->pass_desc = realloc(b->pass_desc, old_len + strlen(word) + 2);
+	if (!b->pass_desc) err(1, "reallocating stamp");
+	char *pos = b->pass_desc + old_len;
+	if (old_len) *pos++ = ' ';
+	/* A stamp is one line. */
+	for (const char *c = word; *c; ++c) *pos++ = (*c == '\n') ? ' ' : *c;
+	*pos = '\0';
+}
+
+int elftin_batch_set_stats(struct elftin_batch *b, const char *format)
+{
+	if (0 == strcmp(format, "json")) b->stats = ELFTIN_STATS_JSON;
+	else if (0 == strcmp(format, "text")) b->stats = ELFTIN_STATS_TEXT;
+	else
+	{
+		warnx("unknown stats format `%s' (expected json or text)", format);
+		return -1;
+	}
+	return 0;
+}
+
+static void add_stats(struct elfimage_stats *total, const struct elfimage_stats *s)
+{
+	for (unsigned c = 0; c < ELFIMAGE_NCOUNTERS; ++c) total->counters[c] += s->counters[c];
+	for (unsigned i = 0; i < s->nphases; ++i)
+	{
+		unsigned j = 0;
+		while (j < total->nphases && 0 != strcmp(total->phases[j].name, s->phases[i].name)) ++j;
+		if (j == ELFIMAGE_MAX_PHASES) continue;
+		if (j == total->nphases) total->phases[total->nphases++] = (struct elfimage_phase) { .name = s->phases[i].name };
+		total->phases[j].seconds += s->phases[i].seconds;
+	}
+}
+
+static void print_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; ++s)
+	{
+		if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20) fprintf(f, "\\u%04x", (unsigned char) *s);
+		else fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void print_stats(FILE *f, enum elftin_stats_format format, const struct elfimage_stats *s)
+{
+	if (format == ELFTIN_STATS_JSON)
+	{
+		fputs("\"counters\": {", f);
+		for (unsigned c = 0; c < ELFIMAGE_NCOUNTERS; ++c)
+		{
+			fprintf(f, "%s\"%s\": %lu", c ? ", " : "", elfimage_counter_names[c], s->counters[c]);
+		}
+		fputs("}, \"phases_s\": {", f);
+		for (unsigned i = 0; i < s->nphases; ++i)
+		{
+			fprintf(f, "%s", i ? ", " : "");
+			print_json_string(f, s->phases[i].name);
+			fprintf(f, ": %.6f", s->phases[i].seconds);
+		}
+		fputc('}', f);
+		return;
+	}
+	/* Text: only what is non-zero, as name=value pairs. */
+	for (unsigned c = 0; c < ELFIMAGE_NCOUNTERS; ++c)
+	{
+		if (s->counters[c]) fprintf(f, " %s=%lu", elfimage_counter_names[c], s->counters[c]);
+	}
+	for (unsigned i = 0; i < s->nphases; ++i)
+	{
+		fprintf(f, " %s=%.6fs", s->phases[i].name, s->phases[i].seconds);
+	}
+}
+
+/* One line, or one JSON object, for the whole run. */
+static void report_stats(struct run *r)
+{
+	struct elftin_batch *b = r->b;
+	FILE *f = r->stats_f;
+	struct elfimage_stats total = { 0 };
+	const _Bool json = (b->stats == ELFTIN_STATS_JSON);
+	if (json)
+	{
+		fputs("{\"pass\": ", f);
+		print_json_string(f, b->pass_desc ? b->pass_desc : "");
+		fputs(", \"files\": [", f);
+	}
+	unsigned nfiles = 0, nfailed = 0, npending = 0;
+	for (unsigned i = 0; i < r->nitems; ++i)
+	{
+		struct item *it = &r->items[i];
+		if (it->status == ELFIMAGE_CHANGES_PENDING) ++npending;
+		else if (it->status) ++nfailed;
+		if (!it->name) continue; // an archive with no members we could use
+		add_stats(&total, &it->stats);
+		if (json)
+		{
+			fputs(nfiles ? ", {\"name\": " : "{\"name\": ", f);
+			print_json_string(f, it->name);
+			fprintf(f, ", \"status\": %d, ", it->status);
+			print_stats(f, b->stats, &it->stats);
+			fputc('}', f);
+		}
+		else if (r->nitems > 1)
+		{
+			fprintf(f, "%s: status=%d", it->name, it->status);
+			print_stats(f, b->stats, &it->stats);
+			fputc('\n', f);
+		}
+		++nfiles;
+	}
+	if (json)
+	{
+		fprintf(f, "], \"total\": {\"files\": %u, \"failed\": %u, \"would_change\": %u, ",
+			nfiles, nfailed, npending);
+		print_stats(f, b->stats, &total);
+		fputs("}}\n", f);
+	}
+	else
+	{
+		fprintf(f, "total: files=%u failed=%u would_change=%u", nfiles, nfailed, npending);
+		print_stats(f, b->stats, &total);
+		fputc('\n', f);
+	}
+	fflush(f);
+}
+
+void elftin_batch_add(struct elftin_batch *b, const char *filename)
+{ nameset_add(&b->files, filename); }
+
+int elftin_batch_add_list(struct elftin_batch *b, const char *listfile)
+{
+	return nameset_add_file(&b->files, (0 == strcmp(listfile, "-")) ? "/dev/stdin" : listfile);
+}
+
+int elftin_batch_run(struct elftin_batch *b)
+{
+	if (b->output && b->files.nnames != 1)
+	{
+		warnx("-o needs exactly one input file");
+		return 1;
+	}
+	for (unsigned i = 0; i < b->files.nnames; ++i)
+	{
+		if (b->files.nnames != 1 && 0 == strcmp(b->files.names[i], "-"))
+		{
+			warnx("standard input (-) must be the only input file");
+			return 1;
+		}
+	}
+	struct run r = { .b = b };
+	unsigned items_size = 0;
+	/* Checking writes nothing, not even a copy. */
+	if (b->check) b->output = NULL;
+	for (unsigned i = 0; i < b->files.nnames; ++i)
+	{
+		char *filename = b->files.names[i];
+		if (elftin_batch_is_archive(filename))
+		{
+			if (b->output && 0 == strcmp(b->output, "-"))
+			{
+				warnx("%s: cannot write an archive to standard output", filename);
+				return 1;
+			}
+			if (b->stamp && !b->check) warnx("%s: members of archives cannot be stamped", filename);
+			add_archive(&r, &items_size, filename, b->output, b->check);
+		}
+		else add_item(&r, &items_size, (struct item) { .name = filename });
+	}
+	r.prefix = (r.nitems > 1);
+	_Bool writes_stdout = !b->check && (b->output ? 0 == strcmp(b->output, "-")
+		: (b->files.nnames == 1 && 0 == strcmp(b->files.names[0], "-")));
+	r.stats_f = writes_stdout ? stderr : stdout;
+
+	unsigned njobs = b->njobs;
+	if (!njobs)
+	{
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		njobs = (ncpus > 0) ? ncpus : 1;
+	}
+	if (njobs > r.nitems) njobs = r.nitems;
+	if (njobs <= 1) worker(&r);
+	else
+	{
+		pthread_t threads[njobs];
+		for (unsigned i = 0; i < njobs; ++i)
+		{
+			int ret = pthread_create(&threads[i], NULL, worker, &r);
+			if (ret) errx(1, "creating thread: %s", strerror(ret));
+		}
+		for (unsigned i = 0; i < njobs; ++i) pthread_join(threads[i], NULL);
+	}
+
+	if (b->stats) report_stats(&r);
+	/* Each archive is done once its last item is. */
+	int status = 0;
+	unsigned nfailed = 0, npending = 0;
+	for (unsigned i = 0; i < r.nitems; ++i)
+	{
+		struct item *it = &r.items[i];
+		if (it->status == ELFIMAGE_CHANGES_PENDING) ++npending;
+		else if (it->status) ++nfailed;
+		status = worse_status(status, it->status);
+		if (!it->ar) continue;
+		it->ar->status = worse_status(it->ar->status, it->status);
+		free(it->name);
+		if (i + 1 == r.nitems || r.items[i + 1].ar != it->ar)
+		{
+			int ar_status = finish_archive(it->ar);
+			status = worse_status(status, ar_status);
+		}
+	}
+	if (npending && r.nitems > 1) warnx("%u of %u files would change", npending, r.nitems);
+	if (nfailed && r.nitems > 1) warnx("%u of %u files failed", nfailed, r.nitems);
+	free(r.items);
+	return status;
+}
+
+void elftin_batch_destroy(struct elftin_batch *b)
+{
+	nameset_destroy(&b->files);
+	free(b->pass_desc);
+	*b = (struct elftin_batch) { 0 };
+}
@@ -0,0 +1,159 @@
+/* The body of dynstr.c, for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static ElfN(Dyn) *ELFN(find_dyn)(struct elfimage *img, Elf64_Sxword tag)
+{
+	ElfN(Shdr) *shdr = img->dynamic_shdr;
+	if (!shdr) return NULL;
+	for (ElfN(Dyn) *d = ELFN_SECTION_DATA(img, *shdr);
+			d < (ElfN(Dyn) *) ((char*) ELFN_SECTION_DATA(img, *shdr) + GET(shdr->sh_size))
+				&& d->d_tag != DT_NULL;
+			++d)
+	{
+		if (GET(d->d_tag) == tag) return d;
+	}
+	return NULL;
+}
+
+/* Can section 'shndx' grow by 'len' bytes where it is? */
+static _Bool ELFN(can_grow_in_place)(struct elfimage *img, unsigned shndx, size_t len)
+{
+	ElfN(Ehdr) *ehdr = img->ehdr;
+	ElfN(Shdr) *shdrs = img->shdrs;
+	ElfN(Shdr) *target = &shdrs[shndx];
+	Elf64_Off off = GET(target->sh_offset) + GET(target->sh_size);
+	Elf64_Addr addr = GET(target->sh_addr) + GET(target->sh_size);
+	/* It must stay within the file part of the segment that maps it. */
+	ElfN(Phdr) *phdrs = img->phdrs;
+	_Bool covered = 0;
+	for (ElfN(Phdr) *phdr = phdrs; phdr < phdrs + img->phnum; ++phdr)
+	{
+		if (GET(phdr->p_type) == PT_LOAD &&
+			GET(phdr->p_offset) <= GET(target->sh_offset) &&
+			off + len <= (Elf64_Off) GET(phdr->p_offset) + GET(phdr->p_filesz))
+		{
+			covered = 1;
+			break;
+		}
+	}
+	if (!covered) return 0;
+	/* ... and not run into anything else. */
+	if (OVERLAPS(off, len, 0, sizeof (ElfN(Ehdr)))) return 0;
+	if (OVERLAPS(off, len, GET(ehdr->e_phoff), (Elf64_Off) img->phnum * GET(ehdr->e_phentsize))) return 0;
+	if (OVERLAPS(off, len, GET(ehdr->e_shoff), (Elf64_Off) img->shnum * GET(ehdr->e_shentsize))) return 0;
+	for (unsigned i = 0; i < img->shnum; ++i)
+	{
+		ElfN(Shdr) *shdr = &shdrs[i];
+		if (i == shndx || shdr->sh_size == 0) continue;
+		if (GET(shdr->sh_type) != SHT_NOBITS && OVERLAPS(off, len, GET(shdr->sh_offset), GET(shdr->sh_size))) return 0;
+		if ((GET(shdr->sh_flags) & SHF_ALLOC) && OVERLAPS(addr, len, GET(shdr->sh_addr), GET(shdr->sh_size))) return 0;
+	}
+	return 1;
+}
+
+static long ELFN(dynstr_append)(struct elfimage *img, unsigned dynstr_shndx, const char *strs, size_t len)
+{
+	ElfN(Shdr) *shdr = &((ElfN(Shdr) *) img->shdrs)[dynstr_shndx];
+	ElfN(Dyn) *strtab_dyn = ELFN(find_dyn)(img, DT_STRTAB);
+	ElfN(Dyn) *strsz_dyn = ELFN(find_dyn)(img, DT_STRSZ);
+	if (!strtab_dyn || !strsz_dyn || GET(strtab_dyn->d_un.d_ptr) != GET(shdr->sh_addr))
+	{
+		elfimage_warnx(img, "string table is not the dynamic one, so not growing it");
+		return -1;
+	}
+	Elf64_Xword old_size = GET(shdr->sh_size);
+	if (ELFN(can_grow_in_place)(img, dynstr_shndx, len))
+	{
+		memcpy((char*) ELFN_SECTION_DATA(img, *shdr) + old_size, strs, len);
+		SET(shdr->sh_size, old_size + len);
+		SET(strsz_dyn->d_un.d_val, old_size + len);
+		return old_size;
+	}
+
+	/* Move it to the end of the file, in a new segment. That needs a new
+	 * phdr, and the PT_LOADs must stay in ascending vaddr order. If there
+	 * is no spare PT_NULL to use, we move the phdrs too, one longer, to the
+	 * start of the new segment. ld.so and the kernel find them by e_phoff
+	 * (and PT_PHDR, which we update), so they need not be at the front. */
+	ElfN(Phdr) *phdrs = img->phdrs;
+	unsigned phnum = img->phnum;
+	int spare = -1, last_load = -1;
+	Elf64_Addr vaddr_end = 0;
+	for (unsigned i = 0; i < phnum; ++i)
+	{
+		if (GET(phdrs[i].p_type) == PT_NULL && spare == -1) spare = i;
+		if (GET(phdrs[i].p_type) == PT_LOAD)
+		{
+			last_load = i;
+			Elf64_Addr end = (Elf64_Addr) GET(phdrs[i].p_vaddr) + GET(phdrs[i].p_memsz);
+			if (end > vaddr_end) vaddr_end = end;
+		}
+	}
+	_Bool move_phdrs = (spare == -1);
+	if (last_load == -1 || (move_phdrs && phnum + 1 >= PN_XNUM))
+	{
+		elfimage_warnx(img, "no room to grow the dynamic string table in place, and no way "
+			"to map a new copy");
+		return -1;
+	}
+	long page_size = sysconf(_SC_PAGESIZE);
+	Elf64_Off new_off = ROUND_UP(img->size, page_size);
+	Elf64_Addr new_addr = ROUND_UP(vaddr_end, page_size);
+	Elf64_Xword phdrs_size = move_phdrs ? (phnum + 1) * sizeof (ElfN(Phdr)) : 0;
+	Elf64_Xword new_size = old_size + len;
+	Elf64_Off old_off = GET(shdr->sh_offset);
+	if (0 != elfimage_grow(img, new_off + phdrs_size + new_size)) return -1;
+	/* The mapping has moved. */
+	shdr = &((ElfN(Shdr) *) img->shdrs)[dynstr_shndx];
+	phdrs = img->phdrs;
+	strtab_dyn = ELFN(find_dyn)(img, DT_STRTAB);
+	strsz_dyn = ELFN(find_dyn)(img, DT_STRSZ);
+	memcpy((char*) img->mapping + new_off + phdrs_size, (char*) img->mapping + old_off, old_size);
+	memcpy((char*) img->mapping + new_off + phdrs_size + old_size, strs, len);
+	ElfN(Phdr) new_phdr = { 0 };
+	SET(new_phdr.p_type, PT_LOAD);
+	SET(new_phdr.p_flags, PF_R);
+	SET(new_phdr.p_offset, new_off);
+	SET(new_phdr.p_vaddr, new_addr);
+	SET(new_phdr.p_paddr, new_addr);
+	SET(new_phdr.p_filesz, phdrs_size + new_size);
+	SET(new_phdr.p_memsz, phdrs_size + new_size);
+	SET(new_phdr.p_align, page_size);
+	if (move_phdrs)
+	{
+		ElfN(Ehdr) *ehdr = img->ehdr;
+		ElfN(Phdr) *new_phdrs = (ElfN(Phdr) *) ((char*) img->mapping + new_off);
+		memcpy(new_phdrs, phdrs, (last_load + 1) * sizeof (ElfN(Phdr)));
+		new_phdrs[last_load + 1] = new_phdr;
+		memcpy(&new_phdrs[last_load + 2], &phdrs[last_load + 1], (phnum - last_load - 1) * sizeof (ElfN(Phdr)));
+		for (ElfN(Phdr) *phdr = new_phdrs; phdr < new_phdrs + phnum + 1; ++phdr)
+		{
+			if (GET(phdr->p_type) != PT_PHDR) continue;
+			SET(phdr->p_offset, new_off);
+			SET(phdr->p_vaddr, new_addr);
+			SET(phdr->p_paddr, new_addr);
+			SET(phdr->p_filesz, phdrs_size);
+			SET(phdr->p_memsz, phdrs_size);
+		}
+		SET(ehdr->e_phoff, new_off);
+		SET(ehdr->e_phnum, phnum + 1);
+		img->phdrs = new_phdrs;
+		img->phnum = phnum + 1;
+	}
+	else if (spare > last_load)
+	{
+		memmove(&phdrs[last_load + 2], &phdrs[last_load + 1], (spare - last_load - 1) * sizeof (ElfN(Phdr)));
+		phdrs[last_load + 1] = new_phdr;
+	}
+	else
+	{
+		memmove(&phdrs[spare], &phdrs[spare + 1], (last_load - spare) * sizeof (ElfN(Phdr)));
+		phdrs[last_load] = new_phdr;
+	}
+	SET(shdr->sh_offset, new_off + phdrs_size);
+	SET(shdr->sh_addr, new_addr + phdrs_size);
+	SET(shdr->sh_size, new_size);
+	SET(strtab_dyn->d_un.d_ptr, new_addr + phdrs_size);
+	SET(strsz_dyn->d_un.d_val, new_size);
+	return old_size;
+}
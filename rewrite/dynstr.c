@@ -0,0 +1,31 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <elf.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include "elfimage.h"
+#include "dynstr.h"
+
+/* See dynstr.h. */
+
+#define ROUND_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+#define OVERLAPS(b1, n1, b2, n2) ((b1) < (b2) + (n2) && (b2) < (b1) + (n1))
+
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "dynstr-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "dynstr-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "dynstr-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "dynstr-elfn.h"
+
+long dynstr_append(struct elfimage *img, unsigned dynstr_shndx, const char *strs, size_t len)
+{
+	return ELFIMAGE_DISPATCH(img, dynstr_append, img, dynstr_shndx, strs, len);
+}
@@ -0,0 +1,137 @@
+/* The parts of elfimage.c that read the headers, for one ELF class and
+ * byte order; see elfn.h. */
+#include "elfn.h"
+
+static void ELFN(find_sections)(struct elfimage *img)
+{
+	ElfN(Ehdr) *ehdr = ELFIMAGE_DATA(img, 0, sizeof (ElfN(Ehdr)));
+	img->ehdr = ehdr;
+	/* If there are too many sections or phdrs for the ELF header's fields,
+	 * the real counts (and shstrndx) live in section header 0. */
+	ElfN(Shdr) *shdr0 = GET(ehdr->e_shoff) ? ELFIMAGE_DATA(img, GET(ehdr->e_shoff), sizeof (ElfN(Shdr))) : NULL;
+	img->shnum = !shdr0 ? 0 : GET(ehdr->e_shnum) ? GET(ehdr->e_shnum) : GET(shdr0->sh_size);
+	img->shstrndx = (GET(ehdr->e_shstrndx) == SHN_XINDEX && shdr0) ? GET(shdr0->sh_link) : GET(ehdr->e_shstrndx);
+	img->phnum = (GET(ehdr->e_phnum) == PN_XNUM && shdr0) ? GET(shdr0->sh_info) : GET(ehdr->e_phnum);
+	ElfN(Shdr) *shdrs = shdr0 ? ELFIMAGE_DATA(img, GET(ehdr->e_shoff),
+		(size_t) img->shnum * sizeof (ElfN(Shdr))) : NULL;
+	img->shdrs = shdrs;
+	img->phdrs = GET(ehdr->e_phoff) ? ELFIMAGE_DATA(img, GET(ehdr->e_phoff),
+		(size_t) img->phnum * sizeof (ElfN(Phdr))) : NULL;
+	if (!img->phdrs) img->phnum = 0;
+	img->shstrtab = (shdrs && img->shstrndx < img->shnum) ?
+		ELFN_SECTION_DATA(img, shdrs[img->shstrndx]) : NULL;
+	img->symtab_shdr = img->dynsym_shdr = img->dynamic_shdr = NULL;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		switch (GET(shdr->sh_type))
+		{
+			case SHT_SYMTAB:  if (!img->symtab_shdr) img->symtab_shdr = shdr; break;
+			case SHT_DYNSYM:  if (!img->dynsym_shdr) img->dynsym_shdr = shdr; break;
+			case SHT_DYNAMIC: if (!img->dynamic_shdr) img->dynamic_shdr = shdr; break;
+			default: break;
+		}
+	}
+}
+
+/* See mark_changed. */
+static void ELFN(mark_changed)(struct elfimage *img, unsigned char *changed, Elf64_Off begin,
+	Elf64_Off end)
+{
+#define OVERLAPS(off, len) ((off) < end && begin < (off) + (len))
+	ElfN(Ehdr) *ehdr = img->ehdr;
+	ElfN(Shdr) *shdrs = img->shdrs;
+	_Bool any = 0;
+	if (OVERLAPS(0, sizeof (ElfN(Ehdr)))) changed[0] = any = 1;
+	if (img->phdrs && OVERLAPS(GET(ehdr->e_phoff), img->phnum * sizeof (ElfN(Phdr)))) changed[1] = any = 1;
+	if (shdrs && OVERLAPS(GET(ehdr->e_shoff), img->shnum * sizeof (ElfN(Shdr)))) changed[2] = any = 1;
+	for (unsigned i = 1; i < img->shnum; ++i)
+	{
+		ElfN(Shdr) *shdr = &shdrs[i];
+		if (GET(shdr->sh_type) != SHT_NOBITS && OVERLAPS(GET(shdr->sh_offset), GET(shdr->sh_size))) changed[3 + i] = any = 1;
+	}
+	if (!any) changed[3 + img->shnum] = 1;
+#undef OVERLAPS
+}
+
+static const char *ELFN(section_name)(struct elfimage *img, unsigned shndx)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	return (img->shstrtab && GET(shdrs[shndx].sh_name)) ? img->shstrtab + GET(shdrs[shndx].sh_name) : NULL;
+}
+
+static Elf64_Word *ELFN(symtab_xindex)(struct elfimage *img, const ElfN(Shdr) *symtab_shdr)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	ElfN(Word) symtab_shndx = symtab_shdr - shdrs;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_SYMTAB_SHNDX && GET(shdr->sh_link) == symtab_shndx)
+		{
+			return ELFN_SECTION_DATA(img, *shdr);
+		}
+	}
+	return NULL;
+}
+
+static void *ELFN(section_by_name)(struct elfimage *img, const char *name)
+{
+	if (!img->shstrtab) return NULL;
+	ElfN(Shdr) *shdrs = img->shdrs;
+	ElfN(Xword) strsz = GET(shdrs[img->shstrndx].sh_size);
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_name) < strsz && 0 == strcmp(img->shstrtab + GET(shdr->sh_name), name)) return shdr;
+	}
+	return NULL;
+}
+
+static void *ELFN(add_section)(struct elfimage *img, const char *name, Elf64_Word type,
+	Elf64_Xword flags, Elf64_Xword size, Elf64_Xword align)
+{
+	/* Copy what we move, since growing may remap it. */
+	unsigned shnum = img->shnum;
+	ElfN(Xword) strsz = GET(((ElfN(Shdr) *) img->shdrs)[img->shstrndx].sh_size);
+	size_t namelen = strlen(name) + 1;
+	ElfN(Shdr) *shdrs = malloc((shnum + 1) * sizeof (ElfN(Shdr)));
+	char *strs = malloc(strsz + namelen);
+	if (!shdrs || !strs) err(1, "allocating section headers");
+	memcpy(shdrs, img->shdrs, shnum * sizeof (ElfN(Shdr)));
+	memcpy(strs, img->shstrtab, strsz);
+	memcpy(strs + strsz, name, namelen);
+	if (!align) align = 1;
+	ElfN(Off) str_off = ALIGN_UP(img->size, 8);
+	ElfN(Off) data_off = ALIGN_UP(str_off + strsz + namelen, align);
+	ElfN(Off) shdrs_off = ALIGN_UP(data_off + size, 8);
+	size_t new_size = shdrs_off + (shnum + 1) * sizeof (ElfN(Shdr));
+	if (0 != elfimage_grow(img, new_size))
+	{
+		free(shdrs);
+		free(strs);
+		return NULL;
+	}
+	ElfN(Ehdr) *ehdr = img->ehdr;
+	SET(shdrs[img->shstrndx].sh_offset, str_off);
+	SET(shdrs[img->shstrndx].sh_size, strsz + namelen);
+	shdrs[shnum] = (ElfN(Shdr)) { 0 };
+	SET(shdrs[shnum].sh_name, strsz);
+	SET(shdrs[shnum].sh_type, type);
+	SET(shdrs[shnum].sh_flags, flags);
+	SET(shdrs[shnum].sh_offset, data_off);
+	SET(shdrs[shnum].sh_size, size);
+	SET(shdrs[shnum].sh_addralign, align);
+	if (shnum + 1 >= SHN_LORESERVE || !GET(ehdr->e_shnum))
+	{
+		SET(ehdr->e_shnum, 0);
+		SET(shdrs[0].sh_size, shnum + 1);
+	}
+	else SET(ehdr->e_shnum, shnum + 1);
+	memcpy(ELFIMAGE_DATA(img, str_off, strsz + namelen), strs, strsz + namelen);
+	if (size) memset(ELFIMAGE_DATA(img, data_off, size), 0, size);
+	memcpy(ELFIMAGE_DATA(img, shdrs_off, (shnum + 1) * sizeof (ElfN(Shdr))), shdrs,
+		(shnum + 1) * sizeof (ElfN(Shdr)));
+	SET(ehdr->e_shoff, shdrs_off);
+	free(shdrs);
+	free(strs);
+	ELFN(find_sections)(img);
+	return &((ElfN(Shdr) *) img->shdrs)[shnum];
+}
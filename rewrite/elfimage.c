@@ -0,0 +1,679 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <elf.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h> /* for FICLONE */
+#include "elfimage.h"
+
+/*
+ The open/stat/mmap dance that every in-place tool used to do for itself,
+ plus a few indexes that several of them need. See elfimage.h.
+ */
+
+#define ALIGN_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "elfimage-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "elfimage-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "elfimage-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "elfimage-elfn.h"
+
+static void find_sections(struct elfimage *img)
+{
+	ELFIMAGE_DISPATCH(img, find_sections, img);
+}
+
+static void drop_windows(struct elfimage *img)
+{
+	for (unsigned i = 0; i < img->nwindows; ++i)
+	{
+		munmap(img->windows[i].base, img->windows[i].length);
+	}
+	free(img->windows);
+	img->windows = NULL;
+	img->nwindows = 0;
+}
+
+void *elfimage_window(struct elfimage *img, Elf64_Off offset, size_t length)
+{
+	for (unsigned i = 0; i < img->nwindows; ++i)
+	{
+		struct elfimage_window *w = &img->windows[i];
+		if (w->offset <= offset && offset + length <= w->offset + w->length)
+		{
+			return (char*) w->base + (offset - w->offset);
+		}
+	}
+	long page_size = sysconf(_SC_PAGESIZE);
+	Elf64_Off start = offset / page_size * page_size;
+	size_t window_length = (offset + length) - start;
+	if (window_length == 0) window_length = 1;
+	void *base;
+	struct stat buf;
+	if (img->check && 0 == fstat(img->fd, &buf) && start + window_length > (size_t) buf.st_size)
+	{
+		/* The image has grown, but the file hasn't, so what lies beyond
+		 * its end is ours alone. */
+		base = mmap(NULL, window_length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (base != MAP_FAILED && start < (size_t) buf.st_size && MAP_FAILED == mmap(base,
+				buf.st_size - start, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, img->fd, start))
+		{
+			munmap(base, window_length);
+			base = MAP_FAILED;
+		}
+	}
+	else base = mmap(NULL, window_length, PROT_READ|PROT_WRITE,
+		img->check ? MAP_PRIVATE : MAP_SHARED, img->fd, start);
+	if (base == MAP_FAILED) err(1, "could not mmap part of %s", img->filename);
+	img->windows = realloc(img->windows, (img->nwindows + 1) * sizeof (struct elfimage_window));
+	if (!img->windows) err(1, "reallocating windows");
+	img->windows[img->nwindows++] = (struct elfimage_window) {
+		.offset = start,
+		.length = window_length,
+		.base = base
+	};
+	return (char*) base + (offset - start);
+}
+
+/* Returns 0, or 5 having warned. */
+static int check_header(struct elfimage *img, const char *filename)
+{
+	unsigned char *ident;
+	if (img->size < EI_NIDENT
+		|| 0 != memcmp((ident = ELFIMAGE_DATA(img, 0, EI_NIDENT)), ELFMAG, SELFMAG))
+	{
+		warnx("not an ELF file: %s", filename);
+		return 5;
+	}
+	/* Either class in either byte order will do, since the code that
+	 * reads the headers is built for each (see elfn.h). */
+	if ((ident[EI_CLASS] != ELFCLASS32 && ident[EI_CLASS] != ELFCLASS64)
+		|| (ident[EI_DATA] != ELFDATA2LSB && ident[EI_DATA] != ELFDATA2MSB))
+	{
+		warnx("%s: unknown ELF class or byte order", filename);
+		return 5;
+	}
+	if (img->size < (ident[EI_CLASS] == ELFCLASS32 ? sizeof (Elf32_Ehdr) : sizeof (Elf64_Ehdr)))
+	{
+		warnx("not an ELF file: %s", filename);
+		return 5;
+	}
+	img->elfclass = ident[EI_CLASS];
+	img->swapped = ident[EI_DATA] != (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? ELFDATA2LSB : ELFDATA2MSB);
+	return 0;
+}
+
+static int map_fd(struct elfimage *img, int fd, const char *filename, _Bool partial)
+{
+	struct stat buf;
+	int ret = fstat(fd, &buf);
+
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if (ret)
+	{
+		warnx("could not stat %s", filename);
+		close(fd);
+		return 3;
+	}
+
+	size_t length = (buf.st_size % page_size == 0) ? buf.st_size
+				: page_size * (buf.st_size / page_size + 1);
+
+	img->fd = fd;
+	img->length = length;
+	img->size = buf.st_size;
+	if (!partial)
+	{
+		void *mapping = mmap(NULL, length, PROT_READ|PROT_WRITE,
+			img->check ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+		if (mapping == MAP_FAILED)
+		{
+			warnx("could not mmap %s", filename);
+			ret = 4;
+			goto fail;
+		}
+		img->mapping = mapping;
+	}
+
+	ret = check_header(img, filename);
+	if (ret) goto fail;
+	find_sections(img);
+	return 0;
+fail:
+	if (img->mapping) munmap(img->mapping, img->length);
+	img->mapping = NULL;
+	drop_windows(img);
+	close(fd);
+	img->fd = -1;
+	return ret;
+}
+
+/* Make 'out_fd' a copy of the first 'size' bytes of 'in_fd'. Best is a
+ * reflink, which shares every extent until it is written. Next best is
+ * copy_file_range, which stays in the kernel and may share extents too.
+ * Failing both, we copy by hand, skipping holes. */
+static int clone_fd(int in_fd, int out_fd, off_t size)
+{
+#ifdef FICLONE
+	if (0 == ioctl(out_fd, FICLONE, in_fd)) return 0;
+#endif
+	off_t done = 0;
+	while (done < size)
+	{
+		ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, size - done, 0);
+		if (n <= 0) break;
+		done += n;
+	}
+	if (done == size) return 0;
+	if (0 != ftruncate(out_fd, size)) return -1;
+	char buf[65536];
+	while (done < size)
+	{
+		off_t data = lseek(in_fd, done, SEEK_DATA);
+		if (data == (off_t) -1 && errno == ENXIO) break; // only a hole remains
+		off_t hole = (data == (off_t) -1) ? size : lseek(in_fd, data, SEEK_HOLE);
+		if (data == (off_t) -1) data = done; // no SEEK_DATA, so copy the rest
+		if (hole == (off_t) -1 || hole > size) hole = size;
+		for (done = data; done < hole; )
+		{
+			size_t want = (hole - done < (off_t) sizeof buf) ? (size_t) (hole - done) : sizeof buf;
+			ssize_t n = pread(in_fd, buf, want, done);
+			if (n <= 0 || n != pwrite(out_fd, buf, n, done)) return -1;
+			done += n;
+		}
+	}
+	return 0;
+}
+
+int elfimage_copy_file(const char *filename, const char *output, int *out_fd,
+	char **out_tmpname)
+{
+	int in_fd = open(filename, O_RDONLY);
+	if (in_fd == -1)
+	{
+		warnx("could not open %s", filename);
+		return 2;
+	}
+	struct stat buf;
+	if (0 != fstat(in_fd, &buf))
+	{
+		warnx("could not stat %s", filename);
+		close(in_fd);
+		return 3;
+	}
+	/* The copy goes next to the output, so that we can rename it there. */
+	char *tmpname;
+	if (-1 == asprintf(&tmpname, "%s.XXXXXX", output)) err(1, "allocating temporary name");
+	int fd = mkstemp(tmpname);
+	if (fd == -1 || 0 != fchmod(fd, buf.st_mode & 07777)
+		|| 0 != clone_fd(in_fd, fd, buf.st_size))
+	{
+		warn("could not copy %s to %s", filename, output);
+		if (fd != -1) { close(fd); unlink(tmpname); }
+		free(tmpname);
+		close(in_fd);
+		return 2;
+	}
+	close(in_fd);
+	*out_fd = fd;
+	*out_tmpname = tmpname;
+	return 0;
+}
+
+static int open_image(struct elfimage *img, const char *filename, const char *output,
+	_Bool partial)
+{
+	*img = (struct elfimage) { .filename = filename, .fd = -1 };
+	if (!output)
+	{
+		int fd = open(filename, O_RDWR);
+		if (fd == -1)
+		{
+			warnx("could not open %s", filename);
+			return 2;
+		}
+		return map_fd(img, fd, filename, partial);
+	}
+	int fd;
+	int ret = elfimage_copy_file(filename, output, &fd, &img->tmpname);
+	if (ret) return ret;
+	img->output = output;
+	ret = map_fd(img, fd, filename, partial);
+	if (ret)
+	{
+		unlink(img->tmpname);
+		free(img->tmpname);
+		img->tmpname = NULL;
+	}
+	return ret;
+}
+
+int elfimage_open(struct elfimage *img, const char *filename)
+{ return open_image(img, filename, NULL, 0); }
+int elfimage_open_copy(struct elfimage *img, const char *filename, const char *output)
+{ return open_image(img, filename, output, 0); }
+int elfimage_open_partial(struct elfimage *img, const char *filename, const char *output)
+{ return open_image(img, filename, output, 1); }
+
+int elfimage_open_check(struct elfimage *img, const char *filename, _Bool partial)
+{
+	*img = (struct elfimage) { .filename = filename, .fd = -1, .check = 1 };
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+	{
+		warnx("could not open %s", filename);
+		return 2;
+	}
+	return map_fd(img, fd, filename, partial);
+}
+
+int elfimage_open_fd(struct elfimage *img, int in_fd, int out_fd, const char *name,
+	_Bool partial)
+{
+	*img = (struct elfimage) { .filename = name, .fd = -1 };
+	if (out_fd != in_fd)
+	{
+		struct stat buf;
+		if (0 != fstat(in_fd, &buf))
+		{
+			warnx("could not stat %s", name);
+			close(out_fd);
+			return 3;
+		}
+		if (0 != clone_fd(in_fd, out_fd, buf.st_size))
+		{
+			warn("could not copy %s", name);
+			close(out_fd);
+			return 2;
+		}
+	}
+	return map_fd(img, out_fd, name, partial);
+}
+
+/* Copy all that can be read from 'in_fd' to 'out_fd'. From a pipe we
+ * splice, so the data never comes up to user space. */
+static int drain_fd(int in_fd, int out_fd)
+{
+	ssize_t n;
+	while (0 < (n = splice(in_fd, NULL, out_fd, NULL, 1ul << 20, SPLICE_F_MOVE)));
+	if (n == 0) return 0;
+	if (errno != EINVAL) return -1;
+	/* Not a pipe (a socket, say), so copy by hand. */
+	char buf[65536];
+	while (0 < (n = read(in_fd, buf, sizeof buf)))
+	{
+		for (ssize_t done = 0, w; done < n; done += w)
+		{
+			w = write(out_fd, buf + done, n - done);
+			if (w <= 0) return -1;
+		}
+	}
+	return (n == 0) ? 0 : -1;
+}
+
+int elfimage_open_stream(struct elfimage *img, int in_fd, const char *name,
+	const char *output, _Bool partial, _Bool check)
+{
+	*img = (struct elfimage) { .filename = name, .fd = -1, .check = check };
+	int fd;
+	if (output)
+	{
+		if (-1 == asprintf(&img->tmpname, "%s.XXXXXX", output)) err(1, "allocating temporary name");
+		fd = mkstemp(img->tmpname);
+		/* As if created by open(), since there is no input file to copy. */
+		mode_t mask = umask(0);
+		umask(mask);
+		if (fd != -1) fchmod(fd, 0666 & ~mask);
+		img->output = output;
+	}
+	else fd = memfd_create(name, MFD_CLOEXEC);
+	struct stat buf;
+	int ret = 0;
+	if (fd == -1) { warn("could not create a file to hold %s", name); ret = 2; }
+	else if (0 != fstat(in_fd, &buf)) { warnx("could not stat %s", name); ret = 3; }
+	else if (S_ISREG(buf.st_mode) ? 0 != clone_fd(in_fd, fd, buf.st_size) : 0 != drain_fd(in_fd, fd))
+	{
+		warn("could not read %s", name);
+		ret = 2;
+	}
+	if (!ret) ret = map_fd(img, fd, name, partial);
+	else if (fd != -1) close(fd);
+	if (ret && img->tmpname)
+	{
+		unlink(img->tmpname);
+		free(img->tmpname);
+		img->tmpname = NULL;
+	}
+	return ret;
+}
+
+int elfimage_write_out(struct elfimage *img, int out_fd)
+{
+	off_t off = 0;
+	ssize_t n = 0;
+	while ((size_t) off < img->size
+		&& 0 < (n = sendfile(out_fd, img->fd, &off, img->size - off)));
+	if ((size_t) off < img->size && (n == 0 || errno == EINVAL || errno == ENOSYS))
+	{
+		char buf[65536];
+		while ((size_t) off < img->size
+			&& 0 < (n = pread(img->fd, buf, (img->size - off < sizeof buf) ? img->size - off : sizeof buf, off)))
+		{
+			for (ssize_t done = 0, w; done < n; done += w)
+			{
+				w = write(out_fd, buf + done, n - done);
+				if (w <= 0) { n = -1; break; }
+			}
+			if (n == -1) break;
+			off += n;
+		}
+	}
+	if ((size_t) off < img->size)
+	{
+		warn("could not write out %s", img->filename);
+		return 1;
+	}
+	return 0;
+}
+
+int elfimage_open_buffer(struct elfimage *img, void *buf, size_t size, const char *name)
+{
+	*img = (struct elfimage) {
+		.filename = name ? name : "(in-memory image)",
+		.fd = -1,
+		.mapping = buf,
+		.length = size,
+		.size = size,
+		.in_memory = 1
+	};
+	int ret = check_header(img, img->filename);
+	if (ret)
+	{
+		*img = (struct elfimage) { .fd = -1 };
+		return ret;
+	}
+	find_sections(img);
+	return 0;
+}
+
+int elfimage_commit(struct elfimage *img)
+{
+	if (!img->tmpname) return 0;
+	if (0 != rename(img->tmpname, img->output))
+	{
+		warn("could not rename %s to %s", img->tmpname, img->output);
+		return 1;
+	}
+	free(img->tmpname);
+	img->tmpname = NULL;
+	return 0;
+}
+
+void elfimage_close(struct elfimage *img)
+{
+	if (img->mapping && !img->in_memory) munmap(img->mapping, img->length);
+	drop_windows(img);
+	if (img->fd != -1) close(img->fd);
+	/* A copy that was never committed is thrown away. */
+	if (img->tmpname)
+	{
+		unlink(img->tmpname);
+		free(img->tmpname);
+	}
+	*img = (struct elfimage) { .fd = -1 };
+}
+
+int elfimage_grow(struct elfimage *img, size_t new_size)
+{
+	if (new_size <= img->size) return 0;
+	if (img->in_memory)
+	{
+		elfimage_warnx(img, "cannot grow %s, which is not a file", img->filename);
+		return -1;
+	}
+	if (!img->check && 0 != ftruncate(img->fd, new_size))
+	{
+		warn("could not extend %s", img->filename);
+		return -1;
+	}
+	if (!img->mapping)
+	{
+		img->size = new_size;
+		return 0;
+	}
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t length = (new_size % page_size == 0) ? new_size
+				: page_size * (new_size / page_size + 1);
+	void *mapping;
+	if (img->check)
+	{
+		/* Keep the pages we have written (they are only in our copy),
+		 * and put anonymous memory where the file would have grown. */
+		mapping = mremap(img->mapping, img->length, length, MREMAP_MAYMOVE);
+		if (mapping == MAP_FAILED)
+		{
+			warnx("could not grow the image of %s", img->filename);
+			return -1;
+		}
+		img->mapping = mapping;
+		if (length > img->length && MAP_FAILED == mmap((char *) mapping + img->length, length - img->length,
+				PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0))
+		{
+			warnx("could not grow the image of %s", img->filename);
+			return -1;
+		}
+	}
+	else
+	{
+		mapping = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, img->fd, 0);
+		if (mapping == MAP_FAILED)
+		{
+			warnx("could not mmap %s", img->filename);
+			return -1;
+		}
+	}
+	if (!img->check) munmap(img->mapping, img->length);
+	img->mapping = mapping;
+	img->length = length;
+	img->size = new_size;
+	find_sections(img);
+	return 0;
+}
+
+static void report(struct elfimage *img, enum elfimage_report_kind kind,
+	const char *fmt, va_list ap)
+{
+	if (!img->report)
+	{
+		if (kind == ELFIMAGE_WARNING) vwarnx(fmt, ap);
+		else { vfprintf(stderr, fmt, ap); fputc('\n', stderr); }
+		return;
+	}
+	char *msg;
+	if (-1 == vasprintf(&msg, fmt, ap)) err(1, "formatting a message");
+	img->report(img->report_arg, kind, msg);
+	free(msg);
+}
+void elfimage_warnx(struct elfimage *img, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	report(img, ELFIMAGE_WARNING, fmt, ap);
+	va_end(ap);
+}
+void elfimage_note(struct elfimage *img, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	report(img, ELFIMAGE_NOTE, fmt, ap);
+	va_end(ap);
+}
+
+const char *const elfimage_counter_names[ELFIMAGE_NCOUNTERS] = {
+	[ELFIMAGE_RELOCS_SCANNED] = "relocs_scanned",
+	[ELFIMAGE_RELOCS_REWRITTEN] = "relocs_rewritten",
+	[ELFIMAGE_RELOCS_SKIPPED_NO_SYMBOL] = "relocs_skipped_no_symbol",
+	[ELFIMAGE_RELOCS_SKIPPED_SAME_SECTION] = "relocs_skipped_same_section",
+	[ELFIMAGE_RELOCS_SKIPPED_NO_SECTION_SYMBOL] = "relocs_skipped_no_section_symbol",
+	[ELFIMAGE_SYMBOLS_PATCHED] = "symbols_patched",
+	[ELFIMAGE_SYMBOLS_RENAMED] = "symbols_renamed",
+	[ELFIMAGE_SYMBOLS_DUPLICATE] = "symbols_duplicate",
+	[ELFIMAGE_HASH_TABLES_REBUILT] = "hash_tables_rebuilt",
+	[ELFIMAGE_STRTAB_BYTES_SAVED] = "strtab_bytes_saved"
+};
+
+double elfimage_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+void elfimage_phase(struct elfimage *img, const char *name, double *since)
+{
+	double now = elfimage_clock();
+	struct elfimage_stats *s = &img->stats;
+	unsigned i = 0;
+	while (i < s->nphases && 0 != strcmp(s->phases[i].name, name)) ++i;
+	if (i == s->nphases && i < ELFIMAGE_MAX_PHASES)
+	{
+		s->phases[s->nphases++] = (struct elfimage_phase) { .name = name };
+	}
+	if (i < s->nphases) s->phases[i].seconds += now - *since;
+	if (ELFIMAGE_VERBOSE(img, 2)) elfimage_note(img, "%s took %.6fs", name, now - *since);
+	*since = now;
+}
+
+Elf64_Word *elfimage_symtab_xindex(struct elfimage *img, const void *symtab_shdr)
+{
+	return ELFIMAGE_DISPATCH(img, symtab_xindex, img, symtab_shdr);
+}
+
+void *elfimage_section_by_name(struct elfimage *img, const char *name)
+{
+	return ELFIMAGE_DISPATCH(img, section_by_name, img, name);
+}
+
+void *elfimage_add_section(struct elfimage *img, const char *name, Elf64_Word type,
+	Elf64_Xword flags, Elf64_Xword size, Elf64_Xword align)
+{
+	if (!img->shstrtab)
+	{
+		elfimage_warnx(img, "cannot add section %s to %s, which has no section names",
+			name, img->filename);
+		return NULL;
+	}
+	return ELFIMAGE_DISPATCH(img, add_section, img, name, type, flags, size, align);
+}
+
+/* Mark which parts of the file [begin, end) overlaps: 0 for the ELF
+ * header, 1 the program headers, 2 the section headers, 3 + i for
+ * section i and 3 + shnum for anything else. */
+static void mark_changed(struct elfimage *img, unsigned char *changed, Elf64_Off begin,
+	Elf64_Off end)
+{
+	ELFIMAGE_DISPATCH(img, mark_changed, img, changed, begin, end);
+}
+
+/* Compare 'len' bytes of the image at 'cur' (file offset 'off') with the
+ * original, marking the runs that differ. */
+static _Bool diff_range(struct elfimage *img, const char *cur, Elf64_Off off, size_t len,
+	const char *original, size_t orig_size, unsigned char *changed)
+{
+	_Bool any = 0;
+	char buf[65536];
+	for (size_t done = 0; done < len; )
+	{
+		size_t n = (len - done < sizeof buf) ? len - done : sizeof buf;
+		const char *orig;
+		size_t have = (off + done < orig_size) ? orig_size - (off + done) : 0;
+		if (have > n) have = n;
+		if (original) orig = original + off + done;
+		else
+		{
+			if (have && (ssize_t) have != pread(img->fd, buf, have, off + done)) have = 0;
+			orig = buf;
+		}
+		/* Past the original's end, everything is new. */
+		if (have < n)
+		{
+			mark_changed(img, changed, off + done + have, off + done + n);
+			any = 1;
+		}
+		if (0 != memcmp(cur + done, orig, have))
+		{
+			for (size_t i = 0; i < have; )
+			{
+				if (cur[done + i] == orig[i]) { ++i; continue; }
+				size_t j = i;
+				while (j < have && cur[done + j] != orig[j]) ++j;
+				mark_changed(img, changed, off + done + i, off + done + j);
+				i = j;
+			}
+			any = 1;
+		}
+		done += n;
+	}
+	return any;
+}
+
+int elfimage_check_changes(struct elfimage *img, const void *original)
+{
+	size_t orig_size = img->size;
+	struct stat buf;
+	if (!original && 0 == fstat(img->fd, &buf)) orig_size = buf.st_size;
+	unsigned char *changed = calloc(img->shnum + 4, 1);
+	if (!changed) err(1, "allocating change map");
+	_Bool any = 0;
+	if (img->mapping) any = diff_range(img, img->mapping, 0, img->size, original, orig_size, changed);
+	else for (unsigned i = 0; i < img->nwindows; ++i)
+	{
+		struct elfimage_window *w = &img->windows[i];
+		size_t len = (w->offset + w->length > img->size) ? img->size - w->offset : w->length;
+		if (w->offset < img->size) any |= diff_range(img, w->base, w->offset, len,
+			original, orig_size, changed);
+	}
+	if (any)
+	{
+		char *list = NULL;
+		size_t list_size = 0;
+		FILE *f = open_memstream(&list, &list_size);
+		if (!f) err(1, "allocating change list");
+		const char *fixed[] = { "ELF header", "program headers", "section headers" };
+		for (unsigned i = 0; i < img->shnum + 4; ++i)
+		{
+			if (!changed[i]) continue;
+			const char *name = (i < 3 || i == 3 + img->shnum) ? NULL
+				: ELFIMAGE_DISPATCH(img, section_name, img, i - 3);
+			const char *what = (i < 3) ? fixed[i]
+				: (i == 3 + img->shnum) ? "bytes outside any section"
+				: name ? name
+				: "an unnamed section";
+			fprintf(f, "%s%s", ftell(f) ? ", " : "", what);
+		}
+		fclose(f);
+		elfimage_note(img, "would change %s", list);
+		free(list);
+	}
+	free(changed);
+	return any ? ELFIMAGE_CHANGES_PENDING : 0;
+}
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <libgen.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "elfimage.h"
+#include "nameset.h"
+#include "pipeline.h"
+#include "batch.h"
+
+/*
+ Here we map an ELF file once and run a pipeline of the in-place
+ rewriting tools over it, as library passes. This saves each tool
+ re-opening, re-mapping and re-indexing the file for itself.
+
+ The pipeline comes from a script file (-f), one pass per line with
+ '#' comments, and/or from the command line, with passes separated
+ by '--'. Script passes run first. For example
+
+   elftin-rewrite foo.o normrelocs f g -- sym2und __real_f -- undprot
+
+ We check the whole pipeline before touching the file. If a pass fails
+ we stop there, but what has already been done stays done -- unless we
+ are writing a copy (-o), in which case no output appears.
+
+ Given --files-from (-F) instead of a filename, or an archive, we run
+ the pipeline over each file or member, -j of them at once; see batch.h.
+ */
+
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-j <nthreads>] [-v] [--check] [--stamp] [--stats=json|text] [-o <output>] [-f <script>] <filename> "
+		"[<pass> [<arg>...] [-- <pass> [<arg>...]]...]\n"
+		"       %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-f <script>] -F|--files-from <filelist> "
+		"[<pass> [<arg>...] [-- <pass> [<arg>...]]...]\n"
+		"Passes:\n", basename, basename);
+}
+
+static struct elftin_pipeline pipeline = { .nthreads = 1 };
+
+static void read_script(const char *scriptname)
+{
+	FILE *f = fopen(scriptname, "r");
+	if (!f) err(1, "could not open %s", scriptname);
+	char *linebuf = NULL;
+	size_t linebuf_size = 0;
+	unsigned line = 0;
+	while (-1 != getline(&linebuf, &linebuf_size, f))
+	{
+		++line;
+		char *hash = strchr(linebuf, '#');
+		if (hash) *hash = '\0';
+		/* The words live as long as the pipeline does, so we
+		 * keep a copy of each line. */
+		char *copy = strdup(linebuf);
+		if (!copy) err(1, "copying script line");
+		char **words = NULL;
+		unsigned nwords = 0;
+		for (char *p = copy, *w; NULL != (w = strsep(&p, " \t\r\n")); )
+		{
+			if (!*w) continue;
+			words = realloc(words, (nwords + 1) * sizeof (char*));
+			if (!words) err(1, "reallocating script words");
+			words[nwords++] = w;
+		}
+		if (!nwords) { free(copy); continue; }
+		if (0 != elftin_pipeline_add(&pipeline, words, nwords, scriptname, line))
+		{
+			errx(1, "%s", pipeline.error);
+		}
+	}
+	free(linebuf);
+	fclose(f);
+}
+
+static int run_pipeline(struct elfimage *img, void *arg)
+{ (void) arg; return elftin_pipeline_run(&pipeline, img); }
+
+int main(int argc, char **argv)
+{
+	struct elftin_batch batch = { .njobs = 1, .pass = run_pipeline };
+	elftin_batch_stamp_word(&batch, "elftin-rewrite");
+	static const struct option longopts[] = { ELFTIN_BATCH_OPTIONS, { 0 } };
+	_Bool have_files = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+j:o:f:F:nSv", longopts, NULL)))
+	{
+		switch (opt)
+		{
+			case 'j': pipeline.nthreads = atoi(optarg); break;
+			case 'o': batch.output = optarg; break;
+			case 'f':
+				read_script(optarg);
+				elftin_batch_stamp_word(&batch, "-f");
+				elftin_batch_stamp_word(&batch, optarg);
+				break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_files = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: goto bad_usage;
+		}
+	}
+	if (!have_files)
+	{
+		if (argc - optind < 1) goto bad_usage;
+		elftin_batch_add(&batch, argv[optind++]);
+	}
+	if (0 != elftin_pipeline_add_args(&pipeline, &argv[optind], argc - optind,
+			"command line"))
+	{
+		errx(1, "%s", pipeline.error);
+	}
+	if (!pipeline.nsteps) goto bad_usage;
+	for (int i = optind; i < argc; ++i) elftin_batch_stamp_word(&batch, argv[i]);
+
+	/* If every pass sticks to the metadata, so can our mapping. */
+	batch.partial = elftin_pipeline_partial_ok(&pipeline);
+	/* With many files (or archive members), -j is how many to do at
+	 * once, each on one thread; otherwise, how many threads for one. */
+	if (have_files || elftin_batch_is_archive(batch.files.names[0]))
+	{
+		batch.njobs = pipeline.nthreads;
+		pipeline.nthreads = 1;
+	}
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	return ret;
+
+bad_usage:
+	usage(basename(argv[0]));
+	elftin_pipeline_print_passes(stderr);
+	return 1;
+}
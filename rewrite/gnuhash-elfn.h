@@ -0,0 +1,369 @@
+/* The parts of gnuhash.c that read and write the dynsyms and tables, for
+ * one ELF class and byte order; see elfn.h. The Bloom words are ElfN(Addr)
+ * wide, and we work on them in the host's byte order, converting as we
+ * read or write the table. */
+#include "elfn.h"
+
+#define BLOOM_BITS (8 * sizeof (ElfN(Addr)))
+
+static _Bool ELFN(bloom_passes)(const ElfN(Addr) *bloom, Elf64_Word bloom_size, Elf64_Word shift, uint32_t h)
+{
+	/* As ld.so does it. */
+	ElfN(Addr) word = bloom[(h / BLOOM_BITS) & (bloom_size - 1)];
+	return ((word >> (h % BLOOM_BITS)) & (word >> ((h >> shift) % BLOOM_BITS)) & 1);
+}
+
+static double ELFN(bloom_false_positive_rate)(const ElfN(Addr) *bloom, Elf64_Word bloom_size,
+	Elf64_Word bloom_shift)
+{
+	if (!bloom_size || (bloom_size & (bloom_size - 1))) return 1.0;
+	/* The two bits a hash needs are not independent (for big shifts, the
+	 * second comes from so few bits of the hash that it is nearly always
+	 * set), so rather than estimate we look up BLOOM_PROBES uniformly
+	 * random hashes. Any that happen to be in the table we count too,
+	 * but there are too few of those to matter. */
+	uint32_t h = BLOOM_PROBE_SEED;
+	unsigned long passed = 0;
+	for (unsigned i = 0; i < BLOOM_PROBES; ++i)
+	{
+		/* xorshift32 */
+		h ^= h << 13; h ^= h >> 17; h ^= h << 5;
+		passed += ELFN(bloom_passes)(bloom, bloom_size, bloom_shift % 32, h);
+	}
+	return (double) passed / BLOOM_PROBES;
+}
+
+static void ELFN(fill_bloom)(ElfN(Addr) *bloom, Elf64_Word bloom_size, Elf64_Word shift,
+	const uint32_t *hashes, Elf64_Word nhashes)
+{
+	memset(bloom, 0, bloom_size * sizeof (ElfN(Addr)));
+	for (Elf64_Word i = 0; i < nhashes; ++i)
+	{
+		uint32_t h = hashes[i];
+		ElfN(Addr) *word = &bloom[(h / BLOOM_BITS) & (bloom_size - 1)];
+		*word |= (ElfN(Addr)) 1 << (h % BLOOM_BITS);
+		*word |= (ElfN(Addr)) 1 << ((h >> shift) % BLOOM_BITS);
+	}
+}
+
+#undef BLOOM_BITS
+
+/* The dynsyms of section 'dynsym_shndx', their count and their strings. */
+static ElfN(Sym) *ELFN(dynsyms)(struct elfimage *img, unsigned dynsym_shndx, Elf64_Word *nsyms,
+	const char **dynstr)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	ElfN(Shdr) *dynsym_shdr = &shdrs[dynsym_shndx];
+	*nsyms = GET(dynsym_shdr->sh_size) / sizeof (ElfN(Sym));
+	*dynstr = ELFN_SECTION_DATA(img, shdrs[GET(dynsym_shdr->sh_link)]);
+	return ELFN_SECTION_DATA(img, *dynsym_shdr);
+}
+
+static void ELFN(gnu_hash_order)(struct elfimage *img, unsigned dynsym_shndx,
+	Elf64_Word symoffset, Elf64_Word nbuckets, Elf64_Word *new_to_old)
+{
+	Elf64_Word nsyms;
+	const char *dynstr;
+	const ElfN(Sym) *dynsyms = ELFN(dynsyms)(img, dynsym_shndx, &nsyms, &dynstr);
+	for (Elf64_Word i = 0; i < symoffset && i < nsyms; ++i) new_to_old[i] = i;
+	if (symoffset >= nsyms) return;
+	/* A counting sort by bucket, which is stable. */
+	Elf64_Word *bucket_of = malloc((nsyms - symoffset) * sizeof (Elf64_Word));
+	Elf64_Word *next_slot = calloc(nbuckets + 1, sizeof (Elf64_Word));
+	if (!bucket_of || !next_slot) err(1, "allocating hash ordering");
+	for (Elf64_Word i = symoffset; i < nsyms; ++i)
+	{
+		bucket_of[i - symoffset] = elf_gnu_hash(&dynstr[GET(dynsyms[i].st_name)]) % nbuckets;
+		++next_slot[bucket_of[i - symoffset] + 1];
+	}
+	next_slot[0] = symoffset;
+	for (Elf64_Word b = 1; b <= nbuckets; ++b) next_slot[b] += next_slot[b - 1];
+	for (Elf64_Word i = symoffset; i < nsyms; ++i)
+	{
+		new_to_old[next_slot[bucket_of[i - symoffset]]++] = i;
+	}
+	free(next_slot);
+	free(bucket_of);
+}
+
+static _Bool ELFN(dynsym_permutable)(struct elfimage *img, unsigned dynsym_shndx)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	Elf64_Word nsyms = GET(shdrs[dynsym_shndx].sh_size) / sizeof (ElfN(Sym));
+	for (const ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_link) != dynsym_shndx) continue;
+		if (GET(shdr->sh_type) == SHT_GNU_versym && GET(shdr->sh_size) / sizeof (ElfN(Half)) != nsyms) return 0;
+		if (GET(shdr->sh_type) == SHT_SYMTAB_SHNDX && GET(shdr->sh_size) / sizeof (ElfN(Word)) != nsyms) return 0;
+	}
+	return 1;
+}
+
+static void ELFN(dynsym_permute)(struct elfimage *img, unsigned dynsym_shndx, const Elf64_Word *new_to_old)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	unsigned shnum = img->shnum;
+	Elf64_Word nsyms = GET(shdrs[dynsym_shndx].sh_size) / sizeof (ElfN(Sym));
+	Elf64_Word *old_to_new = malloc(nsyms * sizeof (Elf64_Word));
+	if (!old_to_new) err(1, "allocating for permutation");
+	for (Elf64_Word i = 0; i < nsyms; ++i) old_to_new[new_to_old[i]] = i;
+	PERMUTE(ElfN(Sym), (ElfN(Sym) *) ELFN_SECTION_DATA(img, shdrs[dynsym_shndx]), nsyms, new_to_old);
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + shnum; ++shdr)
+	{
+		if (GET(shdr->sh_link) != dynsym_shndx) continue;
+		switch (GET(shdr->sh_type))
+		{
+			case SHT_GNU_versym:
+				PERMUTE(ElfN(Half), (ElfN(Half) *) ELFN_SECTION_DATA(img, *shdr), nsyms, new_to_old);
+				break;
+			case SHT_SYMTAB_SHNDX:
+				PERMUTE(ElfN(Word), (ElfN(Word) *) ELFN_SECTION_DATA(img, *shdr), nsyms, new_to_old);
+				break;
+			case SHT_REL:
+			case SHT_RELA:
+			{
+				/* Rel is a prefix of Rela, so just rewrite r_info in place. */
+				size_t sz = (GET(shdr->sh_type) == SHT_REL) ? sizeof (ElfN(Rel)) : sizeof (ElfN(Rela));
+				unsigned char *rels = ELFN_SECTION_DATA(img, *shdr);
+				for (unsigned char *rel = rels; rel + sz <= rels + GET(shdr->sh_size); rel += sz)
+				{
+					ElfN(Rel) r;
+					memcpy(&r, rel, sizeof r);
+					if (ELFN_R_SYM(GET(r.r_info)) >= nsyms) continue;
+					SET(r.r_info, ELFN_R_INFO(old_to_new[ELFN_R_SYM(GET(r.r_info))], ELFN_R_TYPE(GET(r.r_info))));
+					memcpy(rel, &r, sizeof r);
+				}
+				break;
+			}
+			default: break;
+		}
+	}
+	free(old_to_new);
+}
+
+static _Bool ELFN(gnu_hash_fits)(size_t size, Elf64_Word nbuckets, Elf64_Word symoffset, Elf64_Word nsyms)
+{
+	Elf64_Word nhashed = (nsyms > symoffset) ? nsyms - symoffset : 0;
+	/* At least one Bloom word. */
+	return nbuckets != 0 && size >= sizeof (struct gnu_hash_header) + sizeof (ElfN(Addr))
+		+ (nbuckets + (size_t) nhashed) * sizeof (Elf64_Word);
+}
+
+static int ELFN(gnu_hash_build)(struct elfimage *img, unsigned gnu_hash_shndx, unsigned dynsym_shndx,
+	Elf64_Word nbuckets, Elf64_Word symoffset)
+{
+	Elf64_Word nsyms;
+	const char *dynstr;
+	const ElfN(Sym) *dynsyms = ELFN(dynsyms)(img, dynsym_shndx, &nsyms, &dynstr);
+	ElfN(Shdr) *gnu_hash_shdr = &((ElfN(Shdr) *) img->shdrs)[gnu_hash_shndx];
+	size_t size = GET(gnu_hash_shdr->sh_size);
+	void *data = ELFN_SECTION_DATA(img, *gnu_hash_shdr);
+	if (!ELFN(gnu_hash_fits)(size, nbuckets, symoffset, nsyms)) return -1;
+	Elf64_Word nhashed = (nsyms > symoffset) ? nsyms - symoffset : 0;
+	size_t fixed = sizeof (struct gnu_hash_header) + (nbuckets + (size_t) nhashed) * sizeof (Elf64_Word);
+	/* The Bloom filter must be a power of two words. */
+	Elf64_Word bloom_size = 1;
+	while (fixed + 2 * bloom_size * sizeof (ElfN(Addr)) <= size) bloom_size *= 2;
+
+	uint32_t *hashes = calloc(nhashed ? nhashed : 1, sizeof (uint32_t));
+	ElfN(Addr) *bloom = malloc(bloom_size * sizeof (ElfN(Addr)));
+	if (!hashes || !bloom) err(1, "allocating for GNU hash table");
+	for (Elf64_Word i = 0; i < nhashed; ++i) hashes[i] = elf_gnu_hash(&dynstr[GET(dynsyms[symoffset + i].st_name)]);
+	Elf64_Word shift = bloom_shift_for(bloom_size);
+	ELFN(fill_bloom)(bloom, bloom_size, shift, hashes, nhashed);
+
+	memset(data, 0, size);
+	struct gnu_hash_header *hdr = data;
+	SET(hdr->nbuckets, nbuckets);
+	SET(hdr->symoffset, symoffset);
+	SET(hdr->bloom_size, bloom_size);
+	SET(hdr->bloom_shift, shift);
+	ElfN(Addr) *file_bloom = (ElfN(Addr) *) (hdr + 1);
+	for (Elf64_Word i = 0; i < bloom_size; ++i) SET(file_bloom[i], bloom[i]);
+	Elf64_Word *buckets = (Elf64_Word *) (file_bloom + bloom_size);
+	Elf64_Word *chains = buckets + nbuckets;
+	for (Elf64_Word i = 0; i < nhashed; ++i)
+	{
+		Elf64_Word b = hashes[i] % nbuckets;
+		if (!buckets[b]) SET(buckets[b], symoffset + i);
+		/* The low bit marks the end of a bucket's run. */
+		_Bool last = (i + 1 == nhashed) || (hashes[i + 1] % nbuckets != b);
+		SET(chains[i], (hashes[i] & ~1u) | last);
+	}
+	free(bloom);
+	free(hashes);
+	return 0;
+}
+
+static int ELFN(sysv_hash_build)(struct elfimage *img, unsigned sysv_hash_shndx, unsigned dynsym_shndx,
+	Elf64_Word nbucket)
+{
+	Elf64_Word nsyms;
+	const char *dynstr;
+	const ElfN(Sym) *dynsyms = ELFN(dynsyms)(img, dynsym_shndx, &nsyms, &dynstr);
+	ElfN(Shdr) *sysv_hash_shdr = &((ElfN(Shdr) *) img->shdrs)[sysv_hash_shndx];
+	size_t size = GET(sysv_hash_shdr->sh_size);
+	if (!sysv_hash_fits(size, nbucket, nsyms)) return -1;
+	Elf64_Word *words = ELFN_SECTION_DATA(img, *sysv_hash_shdr);
+	memset(words, 0, size);
+	SET(words[0], nbucket);
+	SET(words[1], nsyms);
+	Elf64_Word *buckets = &words[2];
+	Elf64_Word *chains = &words[2 + nbucket];
+	/* Prepend as we go, so go backwards to keep each chain in index order. */
+	for (Elf64_Word i = nsyms; i-- > 1; )
+	{
+		Elf64_Word b = elf_sysv_hash(&dynstr[GET(dynsyms[i].st_name)]) % nbucket;
+		chains[i] = buckets[b];
+		SET(buckets[b], i);
+	}
+	return 0;
+}
+
+static int ELFN(gnu_hash_stats)(struct elfimage *img, unsigned gnu_hash_shndx, Elf64_Word nsyms,
+	struct hash_table_stats *s)
+{
+	ElfN(Shdr) *gnu_hash_shdr = &((ElfN(Shdr) *) img->shdrs)[gnu_hash_shndx];
+	size_t size = GET(gnu_hash_shdr->sh_size);
+	const struct gnu_hash_header *hdr = ELFN_SECTION_DATA(img, *gnu_hash_shdr);
+	if (size < sizeof *hdr) return -1;
+	Elf64_Word nbuckets = GET(hdr->nbuckets), symoffset = GET(hdr->symoffset);
+	Elf64_Word bloom_size = GET(hdr->bloom_size), bloom_shift = GET(hdr->bloom_shift);
+	size_t fixed = sizeof *hdr + (size_t) bloom_size * sizeof (ElfN(Addr))
+		+ (size_t) nbuckets * sizeof (Elf64_Word);
+	if (nbuckets == 0 || bloom_size == 0 || fixed > size || symoffset > nsyms) return -1;
+	const ElfN(Addr) *file_bloom = (const ElfN(Addr) *) (hdr + 1);
+	const Elf64_Word *buckets = (const Elf64_Word *) (file_bloom + bloom_size);
+	const Elf64_Word *chains = buckets + nbuckets;
+	Elf64_Word nchains = (size - fixed) / sizeof (Elf64_Word);
+	Elf64_Word *lengths = calloc(nbuckets, sizeof (Elf64_Word));
+	if (!lengths) err(1, "allocating for hash statistics");
+	int ret = 0;
+	for (Elf64_Word b = 0; b < nbuckets && !ret; ++b)
+	{
+		if (!buckets[b]) continue;
+		for (Elf64_Word i = GET(buckets[b]); ; ++i)
+		{
+			if (i < symoffset || i - symoffset >= nchains || i >= nsyms) { ret = -1; break; }
+			++lengths[b];
+			if (GET(chains[i - symoffset]) & 1) break;
+		}
+	}
+	if (!ret)
+	{
+		ElfN(Addr) *bloom = malloc(bloom_size * sizeof (ElfN(Addr)));
+		if (!bloom) err(1, "allocating for hash statistics");
+		for (Elf64_Word i = 0; i < bloom_size; ++i) bloom[i] = GET(file_bloom[i]);
+		chain_stats(lengths, nbuckets, s);
+		s->bloom_size = bloom_size;
+		s->bloom_shift = bloom_shift;
+		s->bloom_false_positive_rate = ELFN(bloom_false_positive_rate)(bloom, bloom_size, bloom_shift);
+		free(bloom);
+	}
+	free(lengths);
+	return ret;
+}
+
+static int ELFN(sysv_hash_stats)(struct elfimage *img, unsigned sysv_hash_shndx, struct hash_table_stats *s)
+{
+	ElfN(Shdr) *sysv_hash_shdr = &((ElfN(Shdr) *) img->shdrs)[sysv_hash_shndx];
+	size_t size = GET(sysv_hash_shdr->sh_size);
+	const Elf64_Word *words = ELFN_SECTION_DATA(img, *sysv_hash_shdr);
+	if (size < 2 * sizeof (Elf64_Word)) return -1;
+	Elf64_Word nbucket = GET(words[0]), nchain = GET(words[1]);
+	if (nbucket == 0 || (2 + (size_t) nbucket + nchain) * sizeof (Elf64_Word) > size) return -1;
+	const Elf64_Word *buckets = &words[2];
+	const Elf64_Word *chains = &words[2 + nbucket];
+	Elf64_Word *lengths = calloc(nbucket, sizeof (Elf64_Word));
+	if (!lengths) err(1, "allocating for hash statistics");
+	int ret = 0;
+	for (Elf64_Word b = 0; b < nbucket && !ret; ++b)
+	{
+		for (Elf64_Word i = GET(buckets[b]); i != STN_UNDEF; i = GET(chains[i]))
+		{
+			/* A chain longer than the table must have a cycle. */
+			if (i >= nchain || ++lengths[b] > nchain) { ret = -1; break; }
+		}
+	}
+	if (!ret)
+	{
+		chain_stats(lengths, nbucket, s);
+		s->bloom_size = s->bloom_shift = 0;
+		s->bloom_false_positive_rate = 1.0;
+	}
+	free(lengths);
+	return ret;
+}
+
+static int ELFN(gnu_hash_tune)(struct elfimage *img, unsigned gnu_hash_shndx, unsigned dynsym_shndx,
+	Elf64_Word symoffset, struct hash_table_stats *best)
+{
+	Elf64_Word nsyms;
+	const char *dynstr;
+	const ElfN(Sym) *dynsyms = ELFN(dynsyms)(img, dynsym_shndx, &nsyms, &dynstr);
+	size_t size = GET(((ElfN(Shdr) *) img->shdrs)[gnu_hash_shndx].sh_size);
+	Elf64_Word nhashed = (nsyms > symoffset) ? nsyms - symoffset : 0;
+	size_t chains_size = sizeof (struct gnu_hash_header) + (size_t) nhashed * sizeof (Elf64_Word);
+	if (size < chains_size + sizeof (ElfN(Addr)) + sizeof (Elf64_Word)) return -1;
+	/* Every byte goes to either Bloom words or buckets. More of the
+	 * former means fewer false positives, and of the latter shorter
+	 * chains; we try each power-of-two Bloom size, with the rest of the
+	 * space as buckets. */
+	Elf64_Word max_buckets = (size - chains_size - sizeof (ElfN(Addr))) / sizeof (Elf64_Word);
+	uint32_t *hashes = calloc(nhashed ? nhashed : 1, sizeof (uint32_t));
+	Elf64_Word *lengths = malloc(max_buckets * sizeof (Elf64_Word));
+	ElfN(Addr) *bloom = malloc((size - chains_size) / sizeof (ElfN(Addr)) * sizeof (ElfN(Addr)));
+	if (!hashes || !lengths || !bloom) err(1, "allocating for GNU hash tuning");
+	for (Elf64_Word i = 0; i < nhashed; ++i) hashes[i] = elf_gnu_hash(&dynstr[GET(dynsyms[symoffset + i].st_name)]);
+	double best_cost = -1;
+	for (Elf64_Word bloom_size = 1;
+		chains_size + bloom_size * sizeof (ElfN(Addr)) + sizeof (Elf64_Word) <= size;
+		bloom_size *= 2)
+	{
+		struct hash_table_stats s;
+		Elf64_Word nbuckets = (size - chains_size - bloom_size * sizeof (ElfN(Addr)))
+			/ sizeof (Elf64_Word);
+		try_buckets(hashes, nhashed, nbuckets, lengths, &s);
+		s.bloom_size = bloom_size;
+		s.bloom_shift = bloom_shift_for(bloom_size);
+		ELFN(fill_bloom)(bloom, bloom_size, s.bloom_shift, hashes, nhashed);
+		s.bloom_false_positive_rate = ELFN(bloom_false_positive_rate)(bloom, bloom_size, s.bloom_shift);
+		double cost = hash_table_expected_probes(&s);
+		if (best_cost < 0 || cost < best_cost) { best_cost = cost; *best = s; }
+	}
+	free(bloom);
+	free(lengths);
+	free(hashes);
+	return 0;
+}
+
+static int ELFN(sysv_hash_tune)(struct elfimage *img, unsigned sysv_hash_shndx, unsigned dynsym_shndx,
+	struct hash_table_stats *best)
+{
+	Elf64_Word nsyms;
+	const char *dynstr;
+	const ElfN(Sym) *dynsyms = ELFN(dynsyms)(img, dynsym_shndx, &nsyms, &dynstr);
+	size_t size = GET(((ElfN(Shdr) *) img->shdrs)[sysv_hash_shndx].sh_size);
+	if (size < (2 + 1 + (size_t) nsyms) * sizeof (Elf64_Word)) return -1;
+	Elf64_Word max_buckets = size / sizeof (Elf64_Word) - 2 - nsyms;
+	/* Symbol 0 is never in a chain. */
+	Elf64_Word nhashes = nsyms ? nsyms - 1 : 0;
+	uint32_t *hashes = malloc((nhashes ? nhashes : 1) * sizeof (uint32_t));
+	Elf64_Word *lengths = malloc(max_buckets * sizeof (Elf64_Word));
+	if (!hashes || !lengths) err(1, "allocating for SysV hash tuning");
+	for (Elf64_Word i = 0; i < nhashes; ++i) hashes[i] = elf_sysv_hash(&dynstr[GET(dynsyms[i + 1].st_name)]);
+	/* More buckets is nearly always better, but the SysV hash is weak
+	 * enough that some counts spread it better than their neighbours;
+	 * so we try the few largest that fit. */
+	double best_cost = -1;
+	for (Elf64_Word nbuckets = max_buckets; nbuckets > 0 && nbuckets + 64 > max_buckets; --nbuckets)
+	{
+		struct hash_table_stats s = { .bloom_false_positive_rate = 1.0 };
+		try_buckets(hashes, nhashes, nbuckets, lengths, &s);
+		double cost = hash_table_expected_probes(&s);
+		if (best_cost < 0 || cost < best_cost) { best_cost = cost; *best = s; }
+	}
+	free(lengths);
+	free(hashes);
+	return 0;
+}
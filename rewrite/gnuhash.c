@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <elf.h>
+#include <stdlib.h>
+#include <err.h>
+#include "gnuhash.h"
+#include "elfimage.h"
+
+/* See gnuhash.h. */
+
+#define PERMUTE(type, base, n, new_to_old) do { \
+	type *tmp_ = malloc((n) * sizeof (type)); \
+	if (!tmp_) err(1, "allocating for permutation"); \
+	memcpy(tmp_, (base), (n) * sizeof (type)); \
+	for (Elf64_Word i_ = 0; i_ < (n); ++i_) (base)[i_] = tmp_[(new_to_old)[i_]]; \
+	free(tmp_); \
+} while (0)
+
+/* The number of absent names we look up to measure a filter, and the
+ * first of their hashes. The same ones every time, so that measurements
+ * can be compared. */
+#define BLOOM_PROBES 65536
+#define BLOOM_PROBE_SEED 0x9e3779b9u
+
+/* The shift the linker uses: the second bit then comes from the hash bits
+ * just above those that pick the first bit (the low 6) and the word (the
+ * next log2(bloom_size)), so is independent of both. Bigger shifts leave
+ * fewer bits to choose the second bit from, and the high bits of short
+ * names' hashes vary little, so they only make the filter worse. */
+static Elf64_Word bloom_shift_for(Elf64_Word bloom_size)
+{
+	Elf64_Word shift = 6 + __builtin_ctz(bloom_size);
+	return (shift > 26) ? 26 : shift;
+}
+
+_Bool sysv_hash_fits(size_t size, Elf64_Word nbucket, Elf64_Word nsyms)
+{
+	return nbucket != 0 && size >= (2 + (size_t) nbucket + nsyms) * sizeof (Elf64_Word);
+}
+
+/* Fill in the chain statistics from the length of each bucket's chain. */
+static void chain_stats(const Elf64_Word *lengths, Elf64_Word nbuckets, struct hash_table_stats *s)
+{
+	double total = 0, hit_probes = 0;
+	s->nbuckets = nbuckets;
+	s->empty_buckets = 0;
+	s->longest_chain = 0;
+	for (Elf64_Word b = 0; b < nbuckets; ++b)
+	{
+		Elf64_Word l = lengths[b];
+		if (!l) ++s->empty_buckets;
+		if (l > s->longest_chain) s->longest_chain = l;
+		total += l;
+		/* Finding each of the l names takes 1, 2, ..., l probes. */
+		hit_probes += (double) l * (l + 1) / 2;
+	}
+	s->probes_per_hit = total ? hit_probes / total : 0;
+	s->probes_per_miss = nbuckets ? total / nbuckets : 0;
+}
+
+/* How a table with 'nbuckets' would do over these hashes. */
+static void try_buckets(const uint32_t *hashes, Elf64_Word nhashes, Elf64_Word nbuckets,
+	Elf64_Word *lengths, struct hash_table_stats *s)
+{
+	memset(lengths, 0, nbuckets * sizeof (Elf64_Word));
+	for (Elf64_Word i = 0; i < nhashes; ++i) ++lengths[hashes[i] % nbuckets];
+	chain_stats(lengths, nbuckets, s);
+}
+
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "gnuhash-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "gnuhash-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "gnuhash-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "gnuhash-elfn.h"
+
+void gnu_hash_order(struct elfimage *img, unsigned dynsym_shndx, Elf64_Word symoffset,
+	Elf64_Word nbuckets, Elf64_Word *new_to_old)
+{
+	ELFIMAGE_DISPATCH(img, gnu_hash_order, img, dynsym_shndx, symoffset, nbuckets, new_to_old);
+}
+
+_Bool dynsym_permutable(struct elfimage *img, unsigned dynsym_shndx)
+{
+	return ELFIMAGE_DISPATCH(img, dynsym_permutable, img, dynsym_shndx);
+}
+
+int dynsym_permute(struct elfimage *img, unsigned dynsym_shndx, const Elf64_Word *new_to_old)
+{
+	/* Moving the dynsyms but not their versions would give them the
+	 * wrong versions, so we check everything before moving anything. */
+	if (!dynsym_permutable(img, dynsym_shndx))
+	{
+		elfimage_warnx(img, "symbol version or extended section index section does not match the dynsym");
+		return -1;
+	}
+	ELFIMAGE_DISPATCH(img, dynsym_permute, img, dynsym_shndx, new_to_old);
+	return 0;
+}
+
+double gnu_hash_bloom_false_positive_rate(const Elf64_Xword *bloom, Elf64_Word bloom_size,
+	Elf64_Word bloom_shift)
+{
+	return bloom_false_positive_rate_64_0(bloom, bloom_size, bloom_shift);
+}
+
+_Bool gnu_hash_fits(const struct elfimage *img, size_t size, Elf64_Word nbuckets, Elf64_Word symoffset,
+	Elf64_Word nsyms)
+{
+	/* Only the Bloom word size matters, so the byte order does not. */
+	return (img->elfclass == ELFCLASS32 ? gnu_hash_fits_32_0 : gnu_hash_fits_64_0)(size, nbuckets,
+		symoffset, nsyms);
+}
+
+int gnu_hash_build(struct elfimage *img, unsigned gnu_hash_shndx, unsigned dynsym_shndx,
+	Elf64_Word nbuckets, Elf64_Word symoffset)
+{
+	return ELFIMAGE_DISPATCH(img, gnu_hash_build, img, gnu_hash_shndx, dynsym_shndx, nbuckets, symoffset);
+}
+
+int sysv_hash_build(struct elfimage *img, unsigned sysv_hash_shndx, unsigned dynsym_shndx,
+	Elf64_Word nbucket)
+{
+	return ELFIMAGE_DISPATCH(img, sysv_hash_build, img, sysv_hash_shndx, dynsym_shndx, nbucket);
+}
+
+int gnu_hash_stats(struct elfimage *img, unsigned gnu_hash_shndx, Elf64_Word nsyms,
+	struct hash_table_stats *s)
+{
+	return ELFIMAGE_DISPATCH(img, gnu_hash_stats, img, gnu_hash_shndx, nsyms, s);
+}
+
+int sysv_hash_stats(struct elfimage *img, unsigned sysv_hash_shndx, struct hash_table_stats *s)
+{
+	return ELFIMAGE_DISPATCH(img, sysv_hash_stats, img, sysv_hash_shndx, s);
+}
+
+int gnu_hash_tune(struct elfimage *img, unsigned gnu_hash_shndx, unsigned dynsym_shndx,
+	Elf64_Word symoffset, struct hash_table_stats *best)
+{
+	return ELFIMAGE_DISPATCH(img, gnu_hash_tune, img, gnu_hash_shndx, dynsym_shndx, symoffset, best);
+}
+
+int sysv_hash_tune(struct elfimage *img, unsigned sysv_hash_shndx, unsigned dynsym_shndx,
+	struct hash_table_stats *best)
+{
+	return ELFIMAGE_DISPATCH(img, sysv_hash_tune, img, sysv_hash_shndx, dynsym_shndx, best);
+}
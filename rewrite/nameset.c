@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <err.h>
+#include <fnmatch.h>
+#include "nameset.h"
+#include "gnuhash.h"
+
+static void drop_tab(struct nameset *s)
+{
+	free(s->tab);
+	s->tab = NULL;
+	s->tab_size = 0;
+}
+
+void nameset_add(struct nameset *s, const char *name)
+{
+	if (s->globs && strpbrk(name, "*?["))
+	{
+		s->patterns = realloc(s->patterns, (s->npatterns + 1) * sizeof (char*));
+		if (!s->patterns) err(1, "reallocating name patterns");
+		s->patterns[s->npatterns] = strdup(name);
+		if (!s->patterns[s->npatterns]) err(1, "copying name pattern");
+		++s->npatterns;
+		return;
+	}
+	if (s->nnames == s->names_size)
+	{
+		s->names_size = s->names_size ? 2 * s->names_size : 64;
+		s->names = realloc(s->names, s->names_size * sizeof (char*));
+		if (!s->names) err(1, "reallocating name set");
+	}
+	s->names[s->nnames] = strdup(name);
+	if (!s->names[s->nnames]) err(1, "copying name");
+	++s->nnames;
+	drop_tab(s);
+}
+
+int nameset_add_file(struct nameset *s, const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
+	{
+		warnx("could not open %s", filename);
+		return -1;
+	}
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	while (-1 != (len = getline(&line, &line_size, f)))
+	{
+		char *begin = line;
+		while (isspace((unsigned char) *begin)) ++begin;
+		char *end = line + len;
+		while (end > begin && isspace((unsigned char) end[-1])) --end;
+		*end = '\0';
+		if (*begin && *begin != '#') nameset_add(s, begin);
+	}
+	free(line);
+	fclose(f);
+	return 0;
+}
+
+/* The next token of a version script, and its length: a name (maybe
+ * quoted), or one of "{};:", or null at the end. Comments are as in C,
+ * or '#' to the end of the line. */
+static const char *next_token(const char **pos, size_t *len)
+{
+	const char *p = *pos;
+	for (;;)
+	{
+		while (isspace((unsigned char) *p)) ++p;
+		if (*p == '#') { p += strcspn(p, "\n"); continue; }
+		if (p[0] == '/' && p[1] == '*')
+		{
+			const char *end = strstr(p + 2, "*/");
+			p = end ? end + 2 : p + strlen(p);
+			continue;
+		}
+		break;
+	}
+	if (!*p) { *pos = p; return NULL; }
+	const char *tok = p;
+	if (strchr("{};:", *p)) *len = 1;
+	else if (*p == '"')
+	{
+		*len = strcspn(++tok, "\"");
+		*pos = tok + *len + (tok[*len] == '"');
+		return tok;
+	}
+	else *len = strcspn(p, " \t\r\n{};:#\"");
+	*pos = tok + *len;
+	return tok;
+}
+#define TOKEN_IS(tok, len, s) ((len) == sizeof (s) - 1 && 0 == strncmp((tok), (s), (len)))
+
+int nameset_add_version_script(struct nameset *s, const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
+	{
+		warnx("could not open %s", filename);
+		return -1;
+	}
+	char *buf = NULL;
+	size_t buf_size = 0;
+	ssize_t nread = getdelim(&buf, &buf_size, '\0', f);
+	fclose(f);
+	if (nread == -1) { free(buf); return 0; } // empty
+	unsigned depth = 0;
+	_Bool global = 1;
+	int ret = 0;
+	const char *pos = buf, *tok;
+	size_t len;
+	/* Names are at depth 1, each ended by a ';'. Version names (and the
+	 * versions they inherit from) are at depth 0. */
+	while (NULL != (tok = next_token(&pos, &len)))
+	{
+		if (TOKEN_IS(tok, len, "{")) { if (++depth == 1) global = 1; continue; }
+		if (TOKEN_IS(tok, len, "}")) { if (depth) --depth; continue; }
+		if (depth != 1 || strchr("{};:", *tok)) continue;
+		const char *after = pos;
+		size_t after_len;
+		const char *next = next_token(&after, &after_len);
+		if (next && TOKEN_IS(next, after_len, ":"))
+		{
+			if (TOKEN_IS(tok, len, "global")) global = 1;
+			else if (TOKEN_IS(tok, len, "local")) global = 0;
+			pos = after;
+			continue;
+		}
+		if (TOKEN_IS(tok, len, "extern"))
+		{
+			warnx("%s: extern blocks (e.g. extern \"C++\") are not supported; "
+				"list the mangled names instead", filename);
+			ret = -1;
+			break;
+		}
+		if (global)
+		{
+			char *name = strndup(tok, len);
+			if (!name) err(1, "copying name");
+			nameset_add(s, name);
+			free(name);
+		}
+	}
+	free(buf);
+	return ret;
+}
+
+int nameset_add_args(struct nameset *s, char **args, unsigned nargs)
+{
+	for (unsigned i = 0; i < nargs; ++i)
+	{
+		if (0 == strcmp(args[i], "-f"))
+		{
+			if (i + 1 == nargs)
+			{
+				warnx("-f needs a list file");
+				return -1;
+			}
+			if (0 != nameset_add_file(s, args[++i])) return -1;
+		}
+		else nameset_add(s, args[i]);
+	}
+	return 0;
+}
+
+/* We hash names as DT_GNU_HASH does, which spreads similar names (say,
+ * f1 to f99999) well, then scramble the hash, whose low bits are poor,
+ * before taking a slot. */
+#define SLOT_FOR(h, size) ((size_t)(((uint64_t)(h) * 0x9e3779b97f4a7c15ull) >> 32) & ((size) - 1))
+static struct nameset_entry *slot_for(struct nameset *s, const char *name, uint32_t hash)
+{
+	for (size_t i = SLOT_FOR(hash, s->tab_size); ; i = (i + 1) & (s->tab_size - 1))
+	{
+		struct nameset_entry *e = &s->tab[i];
+		if (!e->index || (e->hash == hash && 0 == strcmp(s->names[e->index - 1], name))) return e;
+	}
+}
+
+void nameset_freeze(struct nameset *s)
+{
+	if (s->tab_size || !s->nnames) return;
+	s->tab_size = 16;
+	while (s->tab_size < 2 * (size_t) s->nnames) s->tab_size *= 2;
+	s->tab = calloc(s->tab_size, sizeof (struct nameset_entry));
+	if (!s->tab) err(1, "allocating name set hash table");
+	for (unsigned i = 0; i < s->nnames; ++i)
+	{
+		uint32_t hash = elf_gnu_hash(s->names[i]);
+		struct nameset_entry *e = slot_for(s, s->names[i], hash);
+		if (!e->index) *e = (struct nameset_entry) { .hash = hash, .index = i + 1 };
+	}
+}
+
+long nameset_find(struct nameset *s, const char *name)
+{
+	if (!s->nnames) return -1;
+	nameset_freeze(s);
+	struct nameset_entry *e = slot_for(s, name, elf_gnu_hash(name));
+	return e->index ? (long) e->index - 1 : -1;
+}
+
+_Bool nameset_contains(struct nameset *s, const char *name)
+{
+	if (nameset_find(s, name) != -1) return 1;
+	for (unsigned i = 0; i < s->npatterns; ++i)
+	{
+		if (0 == fnmatch(s->patterns[i], name, 0)) return 1;
+	}
+	return 0;
+}
+
+void nameset_destroy(struct nameset *s)
+{
+	drop_tab(s);
+	for (unsigned i = 0; i < s->nnames; ++i) free(s->names[i]);
+	free(s->names);
+	for (unsigned i = 0; i < s->npatterns; ++i) free(s->patterns[i]);
+	free(s->patterns);
+	*s = (struct nameset) { 0 };
+}
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "elfimage.h"
+#include "nameset.h"
+#include "pipeline.h"
+#include "normrelocs.h"
+#include "sym2und.h"
+#include "abs2und.h"
+#include "abs2sectsym.h"
+#include "undprot.h"
+#include "rel2data.h"
+#include "dynappend.h"
+#include "sym2dyn.h"
+#include "pie2rel.h"
+#include "shift-elf.h"
+#include "hashopt.h"
+#include "bindlocal.h"
+#include "relrpack.h"
+#include "hidesyms.h"
+#include "strmerge.h"
+
+/*
+ The table of passes that a pipeline can name, and the code to check a
+ pipeline and run it. See pipeline.h.
+ */
+
+static int run_normrelocs(const struct elftin_pipeline *p, struct elfimage *img,
+	char **args, unsigned nargs)
+{ return normrelocs_pass(img, nargs ? args : NULL, nargs, p->nthreads); }
+/* These take names, or "-f <listfile>", as arguments. */
+static int run_with_names(struct elfimage *img, char **args, unsigned nargs,
+	_Bool none_means_all, int (*pass)(struct elfimage *, struct nameset *))
+{
+	struct nameset names = { 0 };
+	if (0 != nameset_add_args(&names, args, nargs)) return 1;
+	int ret = pass(img, (nargs || !none_means_all) ? &names : NULL);
+	nameset_destroy(&names);
+	return ret;
+}
+static int run_sym2und(const struct elftin_pipeline *p, struct elfimage *img,
+	char **args, unsigned nargs)
+{ (void) p; return run_with_names(img, args, nargs, 0, sym2und_pass); }
+static int run_abs2und(const struct elftin_pipeline *p, struct elfimage *img,
+	char **args, unsigned nargs)
+{ (void) p; return run_with_names(img, args, nargs, 1, abs2und_pass); }
+static int run_abs2sectsym(const struct elftin_pipeline *p, struct elfimage *img,
+	char **args, unsigned nargs)
+{ (void) p; return run_with_names(img, args, nargs, 1, abs2sectsym_pass); }
+static int run_dynappend(const struct elftin_pipeline *p, struct elfimage *img,
+	char **args, unsigned nargs)
+{
+	(void) p;
+	long tagval;
+	return dynappend_pass(img, args[0],
+		(nargs > 1 && sscanf(args[1], "%ld", &tagval) > 0) ? &tagval : NULL);
+}
+static int run_shift_elf(const struct elftin_pipeline *p, struct elfimage *img,
+	char **args, unsigned nargs)
+{ (void) p; (void) nargs; return shift_elf_pass(img, atol(args[0])); }
+static int run_bindlocal(const struct elftin_pipeline *p, struct elfimage *img,
+	char **args, unsigned nargs)
+{
+	(void) p;
+	_Bool protect = (nargs && 0 == strcmp(args[0], "-p"));
+	if (protect) { ++args; --nargs; }
+	struct nameset names = { .globs = 1 };
+	if (0 != nameset_add_args(&names, args, nargs)) return 1;
+	int ret = bindlocal_pass(img, &names, protect);
+	nameset_destroy(&names);
+	return ret;
+}
+static int run_hidesyms(const struct elftin_pipeline *p, struct elfimage *img,
+	char **args, unsigned nargs)
+{
+	(void) p;
+	struct nameset exports = { .globs = 1 };
+	int ret = 0;
+	for (unsigned i = 0; i < nargs && !ret; ++i)
+	{
+		if (0 == strcmp(args[i], "-V") && i + 1 < nargs)
+		{
+			if (0 != nameset_add_version_script(&exports, args[++i])) ret = 1;
+		}
+		else if (0 == strcmp(args[i], "-f") && i + 1 < nargs)
+		{
+			if (0 != nameset_add_file(&exports, args[++i])) ret = 1;
+		}
+		else nameset_add(&exports, args[i]);
+	}
+	if (!ret) ret = hidesyms_pass(img, &exports);
+	nameset_destroy(&exports);
+	return ret;
+}
+
+struct elftin_pass
+{
+	const char *name;
+	const char *args; // for the usage message
+	unsigned min_args;
+	unsigned max_args;
+	_Bool takes_names; // i.e. "-f <listfile>" is allowed among the args
+	_Bool partial_ok;  // touches only headers and small sections; see elfimage_open_partial
+	int (*run)(const struct elftin_pipeline *p, struct elfimage *img, char **args, unsigned nargs);
+	int (*run_plain)(struct elfimage *img); // instead, for a pass that takes no arguments
+};
+static const struct elftin_pass passes[] = {
+	{ "normrelocs",  "[<sym>...]",                    0, (unsigned) -1, 0, 0, run_normrelocs, NULL },
+	{ "sym2und",     "[-f <listfile>]... [<sym>...]", 1, (unsigned) -1, 1, 1, run_sym2und, NULL },
+	{ "abs2und",     "[-f <listfile>]... [<sym>...]", 0, (unsigned) -1, 1, 1, run_abs2und, NULL },
+	{ "abs2sectsym", "[-f <listfile>]... [<sym>...]", 0, (unsigned) -1, 1, 1, run_abs2sectsym, NULL },
+	{ "undprot",     "",                              0, 0,            0, 1, NULL, undprot_pass },
+	{ "rel2data",    "",                              0, 0,            0, 1, NULL, rel2data_pass },
+	{ "dynappend",   "<tagnum> [<tagval>]",           1, 2,            0, 1, run_dynappend, NULL },
+	{ "sym2dyn",     "",                              0, 0,            0, 0, NULL, sym2dyn_pass },
+	{ "pie2rel",     "",                              0, 0,            0, 1, NULL, pie2rel_pass },
+	{ "shift-elf",   "<offset>",                      1, 1,            0, 1, run_shift_elf, NULL },
+	{ "hashopt",     "",                              0, 0,            0, 1, NULL, hashopt_pass },
+	{ "bindlocal",   "[-p] [-f <listfile>]... [<sym>|<pattern>...]", 1, (unsigned) -1, 1, 1, run_bindlocal, NULL },
+	{ "relrpack",    "",                              0, 0,            0, 0, NULL, relrpack_pass },
+	{ "hidesyms",    "[-V <script>]... [-f <exportlist>]... [<sym>|<pattern>...]", 1, (unsigned) -1, 1, 1, run_hidesyms, NULL },
+	{ "strmerge",    "",                              0, 0,            0, 1, NULL, strmerge_pass }
+};
+#define NPASSES (sizeof passes / sizeof passes[0])
+
+static int fail(struct elftin_pipeline *p, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	free(p->error);
+	if (-1 == vasprintf(&p->error, fmt, ap)) err(1, "formatting pipeline error");
+	va_end(ap);
+	return -1;
+}
+
+int elftin_pipeline_add(struct elftin_pipeline *p, char **words, unsigned nwords,
+	const char *where, unsigned line)
+{
+	const struct elftin_pass *pass = NULL;
+	for (unsigned i = 0; i < NPASSES; ++i)
+	{
+		if (0 == strcmp(words[0], passes[i].name)) { pass = &passes[i]; break; }
+	}
+	if (!pass) return fail(p, "%s:%u: unknown pass `%s'", where, line, words[0]);
+	unsigned nargs = nwords - 1;
+	if (nargs < pass->min_args || nargs > pass->max_args)
+	{
+		return fail(p, "%s:%u: usage: %s %s", where, line, pass->name, pass->args);
+	}
+	/* List files are only read when the pass runs, so check them now. */
+	for (unsigned i = 1; pass->takes_names && i < nwords; ++i)
+	{
+		if (0 == strcmp(words[i], "-f") && (i + 1 == nwords || 0 != access(words[++i], R_OK)))
+		{
+			return fail(p, "%s:%u: %s: missing or unreadable list file", where, line, pass->name);
+		}
+	}
+	if (p->nsteps == p->steps_size)
+	{
+		p->steps_size = p->steps_size ? 2 * p->steps_size : 16;
+		p->steps = realloc(p->steps, p->steps_size * sizeof (struct elftin_step));
+		if (!p->steps) err(1, "reallocating pipeline");
+	}
+	p->steps[p->nsteps++] = (struct elftin_step) {
+		.pass = pass,
+		.args = words + 1,
+		.nargs = nargs,
+		.where = where,
+		.line = line
+	};
+	return 0;
+}
+
+int elftin_pipeline_add_args(struct elftin_pipeline *p, char **args, unsigned nargs,
+	const char *where)
+{
+	unsigned line = 0;
+	for (unsigned i = 0; i < nargs; )
+	{
+		unsigned j = i;
+		while (j < nargs && 0 != strcmp(args[j], "--")) ++j;
+		if (j == i) return fail(p, "%s: empty pass", where);
+		if (0 != elftin_pipeline_add(p, &args[i], j - i, where, ++line)) return -1;
+		i = j + 1;
+	}
+	return 0;
+}
+
+_Bool elftin_pipeline_partial_ok(const struct elftin_pipeline *p)
+{
+	_Bool partial = 1;
+	for (unsigned i = 0; i < p->nsteps; ++i) partial &= p->steps[i].pass->partial_ok;
+	return partial;
+}
+
+int elftin_pipeline_run(const struct elftin_pipeline *p, struct elfimage *img)
+{
+	for (unsigned i = 0; i < p->nsteps; ++i)
+	{
+		const struct elftin_step *s = &p->steps[i];
+		int ret = s->pass->run_plain ? s->pass->run_plain(img)
+			: s->pass->run(p, img, s->args, s->nargs);
+		if (ret)
+		{
+			elfimage_warnx(img, "%s:%u: pass %s failed (status %d)", s->where,
+				s->line, s->pass->name, ret);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+void elftin_pipeline_print_passes(FILE *f)
+{
+	for (unsigned i = 0; i < NPASSES; ++i)
+	{
+		fprintf(f, "\t%s %s\n", passes[i].name, passes[i].args);
+	}
+}
+
+void elftin_pipeline_destroy(struct elftin_pipeline *p)
+{
+	free(p->steps);
+	free(p->error);
+	*p = (struct elftin_pipeline) { 0 };
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <err.h>
+#include "strtab.h"
+
+/* We hash a tail s[i..] as the polynomial s[i] + B s[i+1] + B^2 s[i+2] ...,
+ * which for all the tails of one string we can get in a single backwards
+ * walk, since H(i) = s[i] + B H(i+1). So building costs one step per byte
+ * of the table, rather than one per byte of every tail. */
+#define TAIL_HASH_BASE 0x100000001b3ull
+static inline uint64_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	return h;
+}
+static uint64_t name_tail_hash(const char *name)
+{
+	uint64_t h = 0, power = 1;
+	for (const unsigned char *c = (const unsigned char *) name; *c; ++c)
+	{
+		h += *c * power;
+		power *= TAIL_HASH_BASE;
+	}
+	return h;
+}
+
+static struct strtab_index_entry *slot_for(struct strtab_index *idx, uint64_t h,
+	const char *name)
+{
+	uint64_t m = mix(h);
+	uint32_t check = (uint32_t) m;
+	for (size_t i = (m >> 32) & (idx->nentries - 1); ; i = (i + 1) & (idx->nentries - 1))
+	{
+		struct strtab_index_entry *e = &idx->entries[i];
+		if (!e->offset) return e;
+		if (e->check == check && 0 == strcmp(&idx->strtab[e->offset - 1], name)) return e;
+	}
+}
+
+void strtab_index_init(struct strtab_index *idx, const char *strtab, size_t size)
+{
+	idx->strtab = strtab;
+	idx->size = size;
+	idx->nentries = 16;
+	while (idx->nentries < 2 * size) idx->nentries *= 2;
+	idx->entries = calloc(idx->nentries, sizeof *idx->entries);
+	if (!idx->entries) err(1, "allocating string table index");
+	/* Walk each string backwards, entering each of its non-empty tails. */
+	for (size_t begin = 0; begin < size; )
+	{
+		size_t len = strnlen(&strtab[begin], size - begin);
+		if (begin + len == size) break; // unterminated; ignore it
+		uint64_t h = 0;
+		for (size_t i = begin + len; i-- > begin; )
+		{
+			h = (unsigned char) strtab[i] + TAIL_HASH_BASE * h;
+			struct strtab_index_entry *e = slot_for(idx, h, &strtab[i]);
+			if (!e->offset)
+			{
+				*e = (struct strtab_index_entry) { .check = (uint32_t) mix(h), .offset = i + 1 };
+			}
+		}
+		begin += len + 1;
+	}
+}
+
+long strtab_index_find(struct strtab_index *idx, const char *name)
+{
+	if (!*name) return (idx->size && !idx->strtab[idx->size - 1]) ? (long) idx->size - 1 : -1;
+	struct strtab_index_entry *e = slot_for(idx, name_tail_hash(name), name);
+	return e->offset ? (long) e->offset - 1 : -1;
+}
+
+void strtab_index_destroy(struct strtab_index *idx)
+{
+	free(idx->entries);
+	*idx = (struct strtab_index) { 0 };
+}
+
+/* Comparing strings from the end, a string sorts just before those that
+ * it is a tail of; and any of those that there are follow it at once. */
+struct merge_item { const char *str; size_t len; size_t index; };
+static int compare_reversed(const void *a, const void *b)
+{
+	const struct merge_item *x = a, *y = b;
+	size_t i = x->len, j = y->len;
+	while (i && j)
+	{
+		unsigned char cx = x->str[--i], cy = y->str[--j];
+		if (cx != cy) return (cx < cy) ? -1 : 1;
+	}
+	return (i > 0) - (j > 0);
+}
+
+char *strtab_merge_tails(const char *const *strs, size_t n, size_t *offsets, size_t *size)
+{
+	struct merge_item *items = malloc((n ? n : 1) * sizeof (struct merge_item));
+	if (!items) err(1, "allocating strings");
+	size_t total = 1;
+	for (size_t i = 0; i < n; ++i)
+	{
+		items[i] = (struct merge_item) { strs[i], strlen(strs[i]), i };
+		total += items[i].len + 1;
+	}
+	qsort(items, n, sizeof (struct merge_item), compare_reversed);
+	char *tab = malloc(total);
+	if (!tab) err(1, "allocating string table");
+	tab[0] = '\0';
+	size_t used = 1;
+	/* Going backwards, each string is either a tail of the last one we
+	 * stored, or is stored itself. */
+	const struct merge_item *stored = NULL;
+	size_t stored_at = 0;
+	for (size_t k = n; k-- > 0; )
+	{
+		const struct merge_item *it = &items[k];
+		if (!it->len) offsets[it->index] = 0;
+		else if (stored && it->len <= stored->len
+				&& 0 == memcmp(stored->str + stored->len - it->len, it->str, it->len))
+		{
+			offsets[it->index] = stored_at + stored->len - it->len;
+		}
+		else
+		{
+			memcpy(tab + used, it->str, it->len + 1);
+			stored = it;
+			stored_at = used;
+			offsets[it->index] = used;
+			used += it->len + 1;
+		}
+	}
+	free(items);
+	*size = used;
+	return tab;
+}
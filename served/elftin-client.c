@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "elfimage.h"
+#include "pipeline.h"
+#include "served.h"
+
+/*
+ The client end of elftin-served. Run as 'elftin-client <tool> ...', it
+ takes the arguments of that tool's single-file form, and sends the job
+ to the server if one is listening. If not, it does the job itself,
+ exactly as the tool would. The tools' batch options (-F, --check,
+ --stamp, --stats, -v, several files) are not for us: a batch wants the
+ tool itself, so we are not installed under the tools' names.
+
+ The server sees our files only through the descriptors we send, so it
+ needs no access to our directories, and -o works as for the tools: the
+ output appears, by rename, only if the job succeeds.
+ */
+
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s <tool> [-j <nthreads>] [-o <output>] [-f <listfile>]... "
+		"<filename> [<arg>...]\n"
+		"Tools:\n", basename);
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	for (size_t done = 0; done < len; )
+	{
+		ssize_t n = write(fd, (const char *) buf + done, len - done);
+		if (n <= 0) return -1;
+		done += n;
+	}
+	return 0;
+}
+static int read_full(int fd, void *buf, size_t len)
+{
+	for (size_t done = 0; done < len; )
+	{
+		ssize_t n = read(fd, (char *) buf + done, len - done);
+		if (n <= 0) return -1;
+		done += n;
+	}
+	return 0;
+}
+
+/* Returns the job's status, or -1 if we could not talk to the server
+ * (in which case it has done nothing we need to undo). */
+static int run_remote(int sock, int *fds, unsigned nfds, unsigned nthreads,
+	const char *filename, char **words, unsigned nwords)
+{
+	size_t len = strlen(filename) + 1;
+	for (unsigned i = 0; i < nwords; ++i) len += strlen(words[i]) + 1;
+	if (len > ELFTIN_SERVED_MAX_REQUEST) return -1;
+	char *payload = malloc(len);
+	if (!payload) err(1, "allocating request");
+	char *pos = stpcpy(payload, filename) + 1;
+	for (unsigned i = 0; i < nwords; ++i) pos = stpcpy(pos, words[i]) + 1;
+
+	struct elftin_served_request req = {
+		.magic = ELFTIN_SERVED_MAGIC,
+		.nfds = nfds,
+		.nthreads = nthreads,
+		.len = len
+	};
+	char cbuf[CMSG_SPACE(2 * sizeof (int))] = { 0 };
+	struct iovec iov = { .iov_base = &req, .iov_len = sizeof req };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = CMSG_SPACE(nfds * sizeof (int))
+	};
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(nfds * sizeof (int));
+	memcpy(CMSG_DATA(c), fds, nfds * sizeof (int));
+	ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	if (n <= 0 || ((size_t) n < sizeof req && 0 != write_full(sock, (char *) &req + n, sizeof req - n))
+		|| 0 != write_full(sock, payload, len))
+	{
+		free(payload);
+		return -1;
+	}
+	free(payload);
+
+	/* From here on the server may have started, so we cannot fall back.
+	 * If it goes away before it's done, we say so. */
+	for (;;)
+	{
+		struct elftin_served_record r;
+		if (0 != read_full(sock, &r, sizeof r)) break;
+		if (r.kind == ELFTIN_SERVED_DONE)
+		{
+			int32_t status;
+			if (r.len != sizeof status || 0 != read_full(sock, &status, sizeof status)) break;
+			return status;
+		}
+		if (r.len > ELFTIN_SERVED_MAX_REQUEST) break;
+		char *text = malloc(r.len + 1);
+		if (!text) err(1, "allocating message");
+		if (0 != read_full(sock, text, r.len)) { free(text); break; }
+		text[r.len] = '\0';
+		if (r.kind == ELFIMAGE_WARNING) warnx("%s", text);
+		else fprintf(stderr, "%s\n", text);
+		free(text);
+	}
+	warnx("lost connection to elftin-served while rewriting %s", filename);
+	return 1;
+}
+
+static int run_local(const struct elftin_pipeline *p, const char *filename, const char *output)
+{
+	struct elfimage img;
+	int ret = elftin_pipeline_partial_ok(p) ? elfimage_open_partial(&img, filename, output)
+		: elfimage_open_copy(&img, filename, output);
+	if (ret) return ret;
+	ret = elftin_pipeline_run(p, &img);
+	if (!ret) ret = elfimage_commit(&img);
+	elfimage_close(&img);
+	return ret;
+}
+
+static int connect_server(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	elftin_served_socket_path(addr.sun_path, sizeof addr.sun_path);
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock == -1) return -1;
+	if (0 != connect(sock, (struct sockaddr *) &addr, sizeof addr))
+	{
+		close(sock);
+		return -1;
+	}
+	/* Only a server of our own gets our files; otherwise we do the job. */
+	if (!elftin_served_peer_is_us(sock))
+	{
+		warnx("ignoring %s, which another user is listening on", addr.sun_path);
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) goto bad_usage;
+	char *tool = argv[1];
+	++argv; --argc;
+	/* Our warnings should look like the tool's. */
+	program_invocation_short_name = tool;
+	struct elftin_pipeline p = { .nthreads = 1 };
+	const char *output = NULL;
+	/* The words of the pass: the tool, any list files (by absolute path,
+	 * since the server has its own working directory) and the arguments. */
+	char **words = malloc((2 * argc + 1) * sizeof (char *));
+	if (!words) err(1, "allocating words");
+	unsigned nwords = 0;
+	words[nwords++] = tool;
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "+j:o:f:")))
+	{
+		switch (opt)
+		{
+			case 'j':
+				if (0 == (p.nthreads = elftin_served_parse_count(optarg, ELFTIN_SERVED_MAX_THREADS)))
+				{
+					goto bad_usage;
+				}
+				break;
+			case 'o': output = optarg; break;
+			case 'f':
+				words[nwords++] = "-f";
+				words[nwords] = realpath(optarg, NULL);
+				if (!words[nwords]) err(1, "could not open %s", optarg);
+				++nwords;
+				break;
+			default: goto bad_usage;
+		}
+	}
+	if (argc - optind < 1) goto bad_usage;
+	char *filename = argv[optind];
+	for (int i = optind + 1; i < argc; ++i) words[nwords++] = argv[i];
+	if (0 != elftin_pipeline_add(&p, words, nwords, tool, 1))
+	{
+		/* Say it as the tool would: its usage, not a pipeline line. */
+		fprintf(stderr, "%s\n", strchr(p.error, ' ') + 1);
+		return 1;
+	}
+
+	int sock = connect_server();
+	if (sock == -1) return run_local(&p, filename, output);
+
+	int ret;
+	if (!output)
+	{
+		int fd = open(filename, O_RDWR | O_CLOEXEC);
+		if (fd == -1)
+		{
+			warnx("could not open %s", filename);
+			return 2;
+		}
+		ret = run_remote(sock, &fd, 1, p.nthreads, filename, words, nwords);
+		close(fd);
+		if (ret == -1) ret = run_local(&p, filename, output);
+	}
+	else
+	{
+		int fds[2];
+		fds[0] = open(filename, O_RDONLY | O_CLOEXEC);
+		if (fds[0] == -1)
+		{
+			warnx("could not open %s", filename);
+			return 2;
+		}
+		struct stat buf;
+		if (0 != fstat(fds[0], &buf))
+		{
+			warnx("could not stat %s", filename);
+			return 3;
+		}
+		char *tmpname;
+		if (-1 == asprintf(&tmpname, "%s.XXXXXX", output)) err(1, "allocating temporary name");
+		fds[1] = mkostemp(tmpname, O_CLOEXEC);
+		if (fds[1] == -1 || 0 != fchmod(fds[1], buf.st_mode & 07777))
+		{
+			warn("could not copy %s to %s", filename, output);
+			if (fds[1] != -1) unlink(tmpname);
+			return 2;
+		}
+		ret = run_remote(sock, fds, 2, p.nthreads, filename, words, nwords);
+		close(fds[0]);
+		close(fds[1]);
+		if (ret == 0 && 0 != rename(tmpname, output))
+		{
+			warn("could not rename %s to %s", tmpname, output);
+			ret = 1;
+		}
+		if (ret != 0) unlink(tmpname);
+		if (ret == -1) ret = run_local(&p, filename, output);
+		free(tmpname);
+	}
+	close(sock);
+	return ret;
+
+bad_usage:
+	usage("elftin-client");
+	elftin_pipeline_print_passes(stderr);
+	return 1;
+}
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <err.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "elfimage.h"
+#include "pipeline.h"
+#include "served.h"
+
+/*
+ A resident server that runs rewrite jobs sent over a Unix socket, so
+ that a build doing many small rewrites pays for process startup once.
+ See served.h for the protocol, and elftin-client for the other end.
+
+ Each of a pool of worker threads accepts and runs one job at a time,
+ for clients running as our own user only.
+ After a job we keep the file's image in a small cache, keyed by device,
+ inode, size, mtime and ctime: its descriptor, its mapping (or, for a
+ partial image, the windows mapped so far) and the headers and section
+ lookups done on opening. A later job on the same file, unchanged since,
+ reuses it, saving the open, the mmap and those lookups; but no more
+ than that, since the passes build their symbol indexes afresh each time.
+ That covers in-place jobs, and jobs on the output of an earlier -o job,
+ since the client renames the output without changing its inode. (If
+ something else writes the file within the timestamps' granularity, we
+ could miss it; the mapping itself is shared, so only what we read from
+ the headers on opening could be stale.)
+ */
+
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-j <nworkers>] [-c <cached-files>] [-s <socket>]\n", basename);
+}
+
+struct cache_entry
+{
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct timespec ctime;
+	_Bool partial;
+	struct elfimage img;
+	unsigned long last_used; // 0 means the slot is empty
+};
+static struct cache_entry *cache;
+static unsigned cache_size = 64;
+static unsigned long cache_clock;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Bool same_key(const struct cache_entry *e, const struct stat *s)
+{
+	return e->dev == s->st_dev && e->ino == s->st_ino && e->size == s->st_size
+		&& e->mtime.tv_sec == s->st_mtim.tv_sec && e->mtime.tv_nsec == s->st_mtim.tv_nsec
+		&& e->ctime.tv_sec == s->st_ctim.tv_sec && e->ctime.tv_nsec == s->st_ctim.tv_nsec;
+}
+
+/* If we have an image of fd's file, as it is now, take it out of the cache
+ * (so no other job uses it meanwhile) and close 'fd'. A partial image
+ * will not do for a job that wants a full one; a full one does for any. */
+static _Bool cache_take(int fd, _Bool partial, struct elfimage *img)
+{
+	struct stat s;
+	if (0 != fstat(fd, &s)) return 0;
+	_Bool found = 0;
+	struct elfimage stale = { .fd = -1 };
+	pthread_mutex_lock(&cache_mutex);
+	for (unsigned i = 0; i < cache_size; ++i)
+	{
+		struct cache_entry *e = &cache[i];
+		if (!e->last_used || e->dev != s.st_dev || e->ino != s.st_ino) continue;
+		if (same_key(e, &s) && (partial || !e->partial))
+		{
+			*img = e->img;
+			found = 1;
+		}
+		else stale = e->img;
+		e->last_used = 0;
+		break;
+	}
+	pthread_mutex_unlock(&cache_mutex);
+	if (stale.ehdr) elfimage_close(&stale);
+	if (found) close(fd);
+	return found;
+}
+
+static void cache_put(struct elfimage *img)
+{
+	struct stat s;
+	if (0 != fstat(img->fd, &s))
+	{
+		elfimage_close(img);
+		return;
+	}
+	img->report = NULL;
+	img->report_arg = NULL;
+	img->filename = "(cached image)";
+	struct elfimage evicted = { .fd = -1 };
+	pthread_mutex_lock(&cache_mutex);
+	/* Use the slot for the same file, or an empty one, or the LRU one. */
+	struct cache_entry *slot = NULL;
+	for (unsigned i = 0; i < cache_size; ++i)
+	{
+		struct cache_entry *e = &cache[i];
+		if (e->last_used && e->dev == s.st_dev && e->ino == s.st_ino) { slot = e; break; }
+		if (!slot || (slot->last_used && (!e->last_used || e->last_used < slot->last_used))) slot = e;
+	}
+	if (slot->last_used) evicted = slot->img;
+	*slot = (struct cache_entry) {
+		.dev = s.st_dev,
+		.ino = s.st_ino,
+		.size = s.st_size,
+		.mtime = s.st_mtim,
+		.ctime = s.st_ctim,
+		.partial = !img->mapping,
+		.img = *img,
+		.last_used = ++cache_clock
+	};
+	pthread_mutex_unlock(&cache_mutex);
+	if (evicted.ehdr) elfimage_close(&evicted);
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	for (size_t done = 0; done < len; )
+	{
+		ssize_t n = send(fd, (const char *) buf + done, len - done, MSG_NOSIGNAL);
+		if (n <= 0) return -1;
+		done += n;
+	}
+	return 0;
+}
+static int read_full(int fd, void *buf, size_t len)
+{
+	for (size_t done = 0; done < len; )
+	{
+		ssize_t n = read(fd, (char *) buf + done, len - done);
+		if (n <= 0) return -1;
+		done += n;
+	}
+	return 0;
+}
+static void send_record(int conn, uint32_t kind, const void *payload, uint32_t len)
+{
+	struct elftin_served_record r = { .kind = kind, .len = len };
+	/* If the client has gone, there is nobody to tell. */
+	if (0 == write_full(conn, &r, sizeof r)) write_full(conn, payload, len);
+}
+static void report_to_client(void *arg, enum elfimage_report_kind kind, const char *msg)
+{
+	send_record(*(int *) arg, kind, msg, strlen(msg));
+}
+static int fail_job(int conn, int status, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	char *msg;
+	if (-1 == vasprintf(&msg, fmt, ap)) err(1, "formatting a message");
+	va_end(ap);
+	send_record(conn, ELFIMAGE_WARNING, msg, strlen(msg));
+	free(msg);
+	int32_t s = status;
+	send_record(conn, ELFTIN_SERVED_DONE, &s, sizeof s);
+	return status;
+}
+
+/* The messages elfimage would have printed for these, on our stderr. */
+static const char *open_failure(int status)
+{
+	switch (status)
+	{
+		case 2: return "could not open or copy";
+		case 3: return "could not stat";
+		case 4: return "could not mmap";
+		case 5: return "not an ELF file, or of an unknown class or byte order:";
+		default: return "could not open";
+	}
+}
+
+static int run_job(int conn)
+{
+	struct elftin_served_request req;
+	int fds[2] = { -1, -1 };
+	unsigned nfds = 0;
+	char cbuf[CMSG_SPACE(sizeof fds)];
+	struct iovec iov = { .iov_base = &req, .iov_len = sizeof req };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof cbuf
+	};
+	ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	if (n <= 0) return -1;
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+	{
+		if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+		unsigned nhere = (c->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+		for (unsigned i = 0; i < nhere; ++i)
+		{
+			int fd;
+			memcpy(&fd, CMSG_DATA(c) + i * sizeof (int), sizeof fd);
+			if (nfds < 2) fds[nfds++] = fd;
+			else close(fd);
+		}
+	}
+	int ret;
+	char *payload = NULL;
+	char **words = NULL;
+	struct elftin_pipeline p = { 0 };
+	if ((size_t) n < sizeof req && 0 != read_full(conn, (char *) &req + n, sizeof req - n))
+	{
+		ret = -1;
+		goto out;
+	}
+	if (req.magic != ELFTIN_SERVED_MAGIC || req.nfds < 1 || req.nfds > 2 || req.nfds != nfds
+		|| (msg.msg_flags & MSG_CTRUNC) || req.len == 0 || req.len > ELFTIN_SERVED_MAX_REQUEST)
+	{
+		ret = fail_job(conn, 1, "bad request");
+		goto out;
+	}
+	payload = malloc(req.len);
+	if (!payload) err(1, "allocating request");
+	if (0 != read_full(conn, payload, req.len) || payload[req.len - 1] != '\0')
+	{
+		ret = fail_job(conn, 1, "bad request");
+		goto out;
+	}
+	/* The name, then the words. */
+	unsigned nwords = 0;
+	for (char *w = payload; w < payload + req.len; w += strlen(w) + 1) ++nwords;
+	words = malloc(nwords * sizeof (char *));
+	if (!words) err(1, "allocating request words");
+	nwords = 0;
+	for (char *w = payload; w < payload + req.len; w += strlen(w) + 1) words[nwords++] = w;
+	const char *name = words[0];
+	p.nthreads = req.nthreads ? req.nthreads : 1;
+	if (0 != elftin_pipeline_add_args(&p, words + 1, nwords - 1, "command line") || !p.nsteps)
+	{
+		ret = fail_job(conn, 1, "%s", p.error ? p.error : "empty pipeline");
+		goto out;
+	}
+
+	_Bool partial = elftin_pipeline_partial_ok(&p);
+	struct elfimage img;
+	int out_fd = fds[nfds - 1];
+	if (nfds == 2 || !cache_take(out_fd, partial, &img))
+	{
+		ret = elfimage_open_fd(&img, fds[0], out_fd, name, partial);
+		fds[nfds - 1] = -1; // it's the image's now
+		if (ret)
+		{
+			ret = fail_job(conn, ret, "%s %s", open_failure(ret), name);
+			goto out;
+		}
+	}
+	else fds[nfds - 1] = -1; // cache_take closed it
+	/* A cached image still has the last job's counts and settings. */
+	img.stats = (struct elfimage_stats) { 0 };
+	img.verbosity = 0;
+	img.filename = name;
+	img.report = report_to_client;
+	img.report_arg = &conn;
+	ret = elftin_pipeline_run(&p, &img);
+	if (ret) elfimage_close(&img);
+	else cache_put(&img);
+	int32_t s = ret;
+	send_record(conn, ELFTIN_SERVED_DONE, &s, sizeof s);
+out:
+	for (unsigned i = 0; i < nfds; ++i) if (fds[i] != -1) close(fds[i]);
+	elftin_pipeline_destroy(&p);
+	free(words);
+	free(payload);
+	return ret;
+}
+
+static int listen_fd;
+static void *worker(void *arg)
+{
+	(void) arg;
+	for (;;)
+	{
+		int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (conn == -1)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			err(1, "accept");
+		}
+		/* The socket is only ours to use (see served.h). */
+		if (elftin_served_peer_is_us(conn)) run_job(conn);
+		close(conn);
+	}
+	return NULL;
+}
+
+static struct sockaddr_un addr;
+static void remove_socket(int sig)
+{
+	(void) sig;
+	unlink(addr.sun_path);
+	_exit(0);
+}
+
+int main(int argc, char **argv)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned nworkers = (ncpus > 0) ? ncpus : 1;
+	addr.sun_family = AF_UNIX;
+	elftin_served_socket_path(addr.sun_path, sizeof addr.sun_path);
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "j:c:s:")))
+	{
+		switch (opt)
+		{
+			case 'j':
+				nworkers = elftin_served_parse_count(optarg, ELFTIN_SERVED_MAX_THREADS);
+				break;
+			case 'c':
+				cache_size = elftin_served_parse_count(optarg, ELFTIN_SERVED_MAX_CACHED);
+				break;
+			case 's': snprintf(addr.sun_path, sizeof addr.sun_path, "%s", optarg); break;
+			default: usage(basename(argv[0])); return 1;
+		}
+	}
+	if (optind != argc || nworkers < 1 || cache_size < 1)
+	{
+		usage(basename(argv[0]));
+		return 1;
+	}
+	cache = calloc(cache_size, sizeof (struct cache_entry));
+	if (!cache) err(1, "allocating cache");
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1) err(1, "socket");
+	/* A socket file that nobody answers is left over from a dead server. */
+	if (0 == connect(listen_fd, (struct sockaddr *) &addr, sizeof addr))
+	{
+		errx(1, "a server is already listening on %s", addr.sun_path);
+	}
+	unlink(addr.sun_path);
+	mode_t old_umask = umask(077);
+	if (0 != bind(listen_fd, (struct sockaddr *) &addr, sizeof addr))
+	{
+		err(1, "could not bind %s", addr.sun_path);
+	}
+	umask(old_umask);
+	if (0 != listen(listen_fd, SOMAXCONN)) err(1, "listen");
+	signal(SIGINT, remove_socket);
+	signal(SIGTERM, remove_socket);
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_t *threads = calloc(nworkers, sizeof (pthread_t));
+	if (!threads) err(1, "allocating threads");
+	for (unsigned i = 0; i < nworkers; ++i)
+	{
+		int ret = pthread_create(&threads[i], NULL, worker, NULL);
+		if (ret) errx(1, "creating thread: %s", strerror(ret));
+	}
+	for (unsigned i = 0; i < nworkers; ++i) pthread_join(threads[i], NULL);
+	free(threads);
+	return 0;
+}
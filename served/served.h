@@ -0,0 +1,77 @@
+#ifndef ELFTIN_SERVED_H_
+#define ELFTIN_SERVED_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* The protocol between elftin-served and its clients, over a Unix stream
+ * socket. One connection carries one job.
+ *
+ * The client sends a request header, with the file descriptors attached
+ * (SCM_RIGHTS): either one, opened read-write, to rewrite in place, or
+ * two, the input and an empty output to copy it into first. After the
+ * header come 'len' bytes: the file's name (for messages), then the
+ * pipeline's words as for elftin-rewrite, each NUL-terminated.
+ *
+ * The server replies with any number of records, each a header and then
+ * 'len' bytes: a warning or note (ELFIMAGE_WARNING, ELFIMAGE_NOTE) as
+ * text, or finally ELFTIN_SERVED_DONE with the int32_t status. */
+
+#define ELFTIN_SERVED_MAGIC 0x656c6674u /* "elft" */
+#define ELFTIN_SERVED_DONE 0xffffffffu
+#define ELFTIN_SERVED_MAX_REQUEST (1u << 20)
+
+struct elftin_served_request
+{
+	uint32_t magic;
+	uint32_t nfds;
+	uint32_t nthreads;
+	uint32_t len;
+};
+struct elftin_served_record
+{
+	uint32_t kind;
+	uint32_t len;
+};
+
+/* Whether the other end of 'sock' runs as our user. Each end checks the
+ * other: a socket at a predictable path (/tmp) could be bound first by
+ * someone else, who would then be sent descriptors for our files, and a
+ * server must not rewrite files for whoever can reach its socket. */
+static inline _Bool elftin_served_peer_is_us(int sock)
+{
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+	return 0 == getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len)
+		&& len == sizeof cred && cred.uid == getuid();
+}
+
+/* Parse a count given as an option: a whole number from 1 to 'max'.
+ * Returns 0 if it is not one. */
+static inline unsigned elftin_served_parse_count(const char *arg, unsigned max)
+{
+	char *end;
+	errno = 0;
+	unsigned long n = strtoul(arg, &end, 10);
+	if (errno || end == arg || *end || *arg == '-' || n < 1 || n > max) return 0;
+	return n;
+}
+/* More threads than this is surely a mistake. */
+#define ELFTIN_SERVED_MAX_THREADS 1024
+#define ELFTIN_SERVED_MAX_CACHED 65536
+
+/* $ELFTIN_SOCKET, or else a per-user name in $XDG_RUNTIME_DIR or /tmp. */
+static inline void elftin_served_socket_path(char *buf, size_t size)
+{
+	const char *env = getenv("ELFTIN_SOCKET");
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (env && *env) snprintf(buf, size, "%s", env);
+	else if (dir && *dir) snprintf(buf, size, "%s/elftin-served.sock", dir);
+	else snprintf(buf, size, "/tmp/elftin-served-%u.sock", (unsigned) getuid());
+}
+
+#endif
@@ -0,0 +1,163 @@
+/* The parts of strmerge.c that read and write the tables, for one ELF
+ * class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static Elf64_Xword ELFN(ref_value)(const struct strref *ref)
+{ return ref->size == 8 ? GET(*(Elf64_Xword *) ref->where) : GET(*(Elf64_Word *) ref->where); }
+static void ELFN(set_ref)(const struct strref *ref, Elf64_Xword value)
+{
+	if (ref->size == 8) SET(*(Elf64_Xword *) ref->where, value);
+	else SET(*(Elf64_Word *) ref->where, value);
+}
+
+/* Find what points into string table 'strndx', and where DT_STRSZ is if
+ * it is the dynamic one. Returns 0, or -1 if a section we don't know of
+ * links to it. */
+static int ELFN(find_refs)(struct elfimage *img, unsigned strndx, struct strrefs *r,
+	struct strref *strsz)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	if (strndx == img->shstrndx)
+	{
+		for (unsigned i = 0; i < img->shnum; ++i) add_ref(r, &shdrs[i].sh_name, sizeof shdrs[i].sh_name);
+	}
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_link) != strndx || GET(shdr->sh_type) == SHT_NULL) continue;
+		char *data = SECTION_DATA(*shdr);
+		switch (GET(shdr->sh_type))
+		{
+			case SHT_SYMTAB:
+			case SHT_DYNSYM:
+			{
+				ElfN(Sym) *syms = (ElfN(Sym) *) data;
+				ElfN(Sym) *syms_end = (ElfN(Sym) *) (data + GET(shdr->sh_size));
+				for (ElfN(Sym) *sym = syms; sym < syms_end; ++sym) add_ref(r, &sym->st_name, sizeof sym->st_name);
+				break;
+			}
+			case SHT_DYNAMIC:
+			{
+				ElfN(Dyn) *dyns_end = (ElfN(Dyn) *) (data + GET(shdr->sh_size));
+				for (ElfN(Dyn) *d = (ElfN(Dyn) *) data; d < dyns_end && d->d_tag != DT_NULL; ++d)
+				{
+					if (is_string_tag(GET(d->d_tag))) add_ref(r, &d->d_un.d_val, sizeof d->d_un.d_val);
+					if (GET(d->d_tag) == DT_STRSZ) *strsz = (struct strref) { &d->d_un.d_val, sizeof d->d_un.d_val };
+				}
+				break;
+			}
+			case SHT_GNU_verneed:
+			{
+				char *vn_pos = data;
+				for (ElfN(Word) i = 0; i < GET(shdr->sh_info); ++i)
+				{
+					ElfN(Verneed) *vn = (ElfN(Verneed) *) vn_pos;
+					add_ref(r, &vn->vn_file, sizeof vn->vn_file);
+					char *aux_pos = vn_pos + GET(vn->vn_aux);
+					for (ElfN(Half) j = 0; j < GET(vn->vn_cnt); ++j)
+					{
+						ElfN(Vernaux) *aux = (ElfN(Vernaux) *) aux_pos;
+						add_ref(r, &aux->vna_name, sizeof aux->vna_name);
+						aux_pos += GET(aux->vna_next);
+					}
+					if (!vn->vn_next) break;
+					vn_pos += GET(vn->vn_next);
+				}
+				break;
+			}
+			case SHT_GNU_verdef:
+			{
+				char *vd_pos = data;
+				for (ElfN(Word) i = 0; i < GET(shdr->sh_info); ++i)
+				{
+					ElfN(Verdef) *vd = (ElfN(Verdef) *) vd_pos;
+					char *aux_pos = vd_pos + GET(vd->vd_aux);
+					for (ElfN(Half) j = 0; j < GET(vd->vd_cnt); ++j)
+					{
+						ElfN(Verdaux) *aux = (ElfN(Verdaux) *) aux_pos;
+						add_ref(r, &aux->vda_name, sizeof aux->vda_name);
+						aux_pos += GET(aux->vda_next);
+					}
+					if (!vd->vd_next) break;
+					vd_pos += GET(vd->vd_next);
+				}
+				break;
+			}
+			default:
+				if (ELFIMAGE_VERBOSE(img, 1))
+				{
+					elfimage_note(img, "leaving section %u's strings alone, since section %u "
+						"(type 0x%x) links to it", strndx, (unsigned) (shdr - shdrs),
+						(unsigned) GET(shdr->sh_type));
+				}
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int ELFN(strmerge_pass)(struct elfimage *img)
+{
+	double t = elfimage_clock();
+	unsigned long saved = 0;
+	for (unsigned strndx = 1; strndx < img->shnum; ++strndx)
+	{
+		ElfN(Shdr) *shdr = &((ElfN(Shdr) *) img->shdrs)[strndx];
+		if (GET(shdr->sh_type) != SHT_STRTAB || !shdr->sh_size) continue;
+		struct strrefs r = { 0 };
+		struct strref strsz = { 0 };
+		if (0 != ELFN(find_refs)(img, strndx, &r, &strsz) || !r.nrefs) goto next;
+		/* Are we sure which is the dynamic string table? */
+		if ((GET(shdr->sh_flags) & SHF_ALLOC) && img->dynamic_shdr && !strsz.where) goto next;
+		char *strtab = SECTION_DATA(*shdr);
+		if (strtab[GET(shdr->sh_size) - 1] != '\0')
+		{
+			elfimage_warnx(img, "section %u's strings are unterminated; leaving them alone", strndx);
+			goto next;
+		}
+		const char **strs = malloc(r.nrefs * sizeof (char*));
+		size_t *offsets = malloc(r.nrefs * sizeof (size_t));
+		if (!strs || !offsets) err(1, "allocating strings");
+		_Bool ok = 1;
+		for (size_t i = 0; i < r.nrefs; ++i)
+		{
+			Elf64_Xword off = ELFN(ref_value)(&r.refs[i]);
+			if (off >= GET(shdr->sh_size)) { ok = 0; break; }
+			strs[i] = strtab + off;
+		}
+		size_t new_size;
+		char *merged = ok ? strtab_merge_tails(strs, r.nrefs, offsets, &new_size) : NULL;
+		if (!ok)
+		{
+			elfimage_warnx(img, "something points past the end of section %u's strings; "
+				"leaving them alone", strndx);
+		}
+		else if (new_size < GET(shdr->sh_size))
+		{
+			for (size_t i = 0; i < r.nrefs; ++i)
+			{
+				ELFN(set_ref)(&r.refs[i], offsets[i]);
+			}
+			memcpy(strtab, merged, new_size);
+			memset(strtab + new_size, 0, GET(shdr->sh_size) - new_size);
+			elfimage_note(img, "%s: %lu bytes of strings now %lu",
+				&img->shstrtab[GET(shdr->sh_name)], (unsigned long) GET(shdr->sh_size),
+				(unsigned long) new_size);
+			saved += GET(shdr->sh_size) - new_size;
+			SET(shdr->sh_size, new_size);
+			if (strsz.where) ELFN(set_ref)(&strsz, new_size);
+		}
+		else if (ELFIMAGE_VERBOSE(img, 1))
+		{
+			elfimage_note(img, "%s: %lu bytes of strings, which is as few as we can make it",
+				&img->shstrtab[shdr->sh_name], (unsigned long) shdr->sh_size);
+		}
+		free(merged);
+		free(offsets);
+		free(strs);
+	next:
+		free(r.refs);
+	}
+	elfimage_count(img, ELFIMAGE_STRTAB_BYTES_SAVED, saved);
+	elfimage_phase(img, "merge_strings", &t);
+	return 0;
+}
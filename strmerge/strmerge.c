@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <libgen.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "elfimage.h"
+#include "batch.h"
+#include "strtab.h"
+#include "strmerge.h"
+
+/*
+ Here we compact an ELF file's string tables (.strtab, .shstrtab, .dynstr
+ and any others) in place, keeping only the strings that are used, and
+ storing each string that is the tail of another just once, inside it:
+ "bar" as the end of "foobar". Linkers merge some tails, but not all of
+ them, and tools that rename or add symbols (objcopy, sym2dyn) leave the
+ old names behind.
+
+ We rewrite everything that points into a table: section names, symbol
+ names, .dynamic's strings (DT_NEEDED, DT_SONAME, ...) and DT_STRSZ, and
+ symbol versions' names. If some section we don't know of links to a
+ table, it might point into it in ways we don't know of, so we leave
+ that table alone.
+
+ The tables shrink where they are, so nothing else moves, and the bytes
+ after them go dead. A loaded .dynstr takes up as much of its segment as
+ before, but ld.so has less of it to touch.
+ */
+
+#ifdef STRMERGE_AS_LIBRARY
+int strmerge(char *filename)
+{
+	struct elfimage img;
+	int ret = elfimage_open_partial(&img, filename, NULL);
+	if (ret) return ret;
+	ret = strmerge_pass(&img);
+	if (!ret) ret = elfimage_commit(&img);
+	elfimage_close(&img);
+	return ret;
+}
+#else
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-o <output>] [-F|--files-from <listfile>] "
+		"<filename>...\n", basename);
+}
+static int run_pass(struct elfimage *img, void *arg)
+{ (void) arg; return strmerge_pass(img); }
+int main(int argc, char **argv)
+{
+	struct elftin_batch batch = { .njobs = 1, .partial = 1, .pass = run_pass };
+	elftin_batch_stamp_word(&batch, "strmerge");
+	static const struct option longopts[] = { ELFTIN_BATCH_OPTIONS, { 0 } };
+	_Bool have_list = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+j:o:F:nSv", longopts, NULL)))
+	{
+		switch (opt)
+		{
+			case 'j': batch.njobs = atoi(optarg); break;
+			case 'o': batch.output = optarg; break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_list = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: usage(basename(argv[0])); return 1;
+		}
+	}
+	if (argc - optind < 1 && !have_list)
+	{
+		usage(basename(argv[0]));
+		return 1;
+	}
+
+	for (int i = optind; i < argc; ++i) elftin_batch_add(&batch, argv[i]);
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	return ret;
+}
+#endif
+
+#define SECTION_DATA(shdr) ELFN_SECTION_DATA(img, (shdr))
+
+/* Somewhere that holds an offset into the table, 'size' bytes wide: a
+ * Word, or (for .dynamic) a d_val, which in ELF64 is an Xword. */
+struct strref { void *where; unsigned char size; };
+struct strrefs { struct strref *refs; size_t nrefs; size_t refs_size; };
+static void add_ref(struct strrefs *r, void *where, unsigned char size)
+{
+	if (r->nrefs == r->refs_size)
+	{
+		r->refs_size = r->refs_size ? 2 * r->refs_size : 256;
+		r->refs = realloc(r->refs, r->refs_size * sizeof (struct strref));
+		if (!r->refs) err(1, "reallocating string references");
+	}
+	r->refs[r->nrefs++] = (struct strref) { where, size };
+}
+static _Bool is_string_tag(Elf64_Sxword tag)
+{
+	switch (tag)
+	{
+		case DT_NEEDED: case DT_SONAME: case DT_RPATH: case DT_RUNPATH:
+		case DT_AUXILIARY: case DT_FILTER: case DT_CONFIG: case DT_DEPAUDIT:
+		case DT_AUDIT:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "strmerge-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "strmerge-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "strmerge-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "strmerge-elfn.h"
+
+int strmerge_pass(struct elfimage *img)
+{
+	return ELFIMAGE_DISPATCH(img, strmerge_pass, img);
+}
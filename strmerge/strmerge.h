@@ -0,0 +1,9 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+int strmerge(char *filename);
+int strmerge_pass(struct elfimage *img);
+#ifdef __cplusplus
+}
+#endif
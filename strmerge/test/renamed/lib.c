@@ -0,0 +1,3 @@
+int lib_alpha(void) { return 1; }
+int lib_beta(void) { return 2; }
+int check(void) { return lib_alpha() == 1 && lib_beta() == 2; }
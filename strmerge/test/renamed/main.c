@@ -0,0 +1,13 @@
+#include <dlfcn.h>
+#include <stdio.h>
+
+/* The renamed symbols must be found by their new names. */
+int main(int argc, char **argv)
+{
+	void *handle = dlopen(argv[1], RTLD_NOW);
+	if (!handle) { fprintf(stderr, "%s\n", dlerror()); return 1; }
+	int (*check)(void) = (int (*)(void)) dlsym(handle, "check");
+	int (*alpha)(void) = (int (*)(void)) dlsym(handle, "alpha");
+	int (*beta)(void) = (int (*)(void)) dlsym(handle, "beta");
+	return !(check && check() && alpha && alpha() == 1 && beta && beta() == 2);
+}
@@ -0,0 +1,339 @@
+/* The parts of sym2dyn.c that read and write the symbols, for one ELF
+ * class and byte order; see elfn.h. */
+#include "elfn.h"
+
+/* Give 'dynsym' the same section as 'sym', which may be an extended index
+ * in either table. Both tables share the one section header table. */
+static void ELFN(copy_sym_section)(struct elfimage *img, const ElfN(Sym) *dynsyms, ElfN(Sym) *dynsym, ElfN(Word) *dynsym_xindex,
+	const ElfN(Sym) *syms, const ElfN(Sym) *sym, const ElfN(Word) *sym_xindex)
+{
+	if (GET(sym->st_shndx) != SHN_XINDEX)
+	{
+		dynsym->st_shndx = sym->st_shndx;
+		if (dynsym_xindex) dynsym_xindex[dynsym - dynsyms] = 0;
+		return;
+	}
+	if (0 != ELFN(elfimage_set_sym_section)(dynsyms, dynsym, dynsym_xindex,
+			ELFN(elfimage_sym_section)(syms, sym, sym_xindex)))
+	{
+		elfimage_warnx(img, "dynsym %ld needs an extended section index, but there is no "
+			"SHT_SYMTAB_SHNDX for the dynsym", (long)(dynsym - dynsyms));
+	}
+}
+
+/* Why we could not rebuild the hash tables if we renamed some dynsyms,
+ * or NULL if we could: each table must fit its bucket count, and what
+ * moves with the dynsyms (for .gnu.hash) must match them. We ask before
+ * renaming anything, since renamed dynsyms with stale tables, or moved
+ * dynsyms with an old .gnu.hash, would leave the file broken. */
+static const char *ELFN(hash_tables_problem)(struct elfimage *img, ElfN(Shdr) *dynsym_shdr,
+	ElfN(Shdr) *gnu_hash_shdr, ElfN(Shdr) *sysv_hash_shdr)
+{
+	Elf64_Word nsyms = GET(dynsym_shdr->sh_size) / sizeof (ElfN(Sym));
+	if (gnu_hash_shdr)
+	{
+		struct gnu_hash_header *hdr = ELFN_SECTION_DATA(img, *gnu_hash_shdr);
+		if (GET(gnu_hash_shdr->sh_size) < sizeof *hdr || GET(hdr->symoffset) > nsyms)
+		{
+			return "GNU hash table does not match the dynsym";
+		}
+		if (!gnu_hash_fits(img, GET(gnu_hash_shdr->sh_size), GET(hdr->nbuckets), GET(hdr->symoffset), nsyms))
+		{
+			return "GNU hash table is too small to rebuild";
+		}
+		if (!dynsym_permutable(img, dynsym_shdr - (ElfN(Shdr) *) img->shdrs))
+		{
+			return "symbol version or extended section index section does not match the dynsym";
+		}
+	}
+	if (sysv_hash_shdr)
+	{
+		Elf64_Word *words = ELFN_SECTION_DATA(img, *sysv_hash_shdr);
+		if (GET(sysv_hash_shdr->sh_size) < 2 * sizeof (Elf64_Word)
+			|| !sysv_hash_fits(GET(sysv_hash_shdr->sh_size), GET(words[0]), nsyms))
+		{
+			return "SysV hash table is too small to rebuild";
+		}
+	}
+	return NULL;
+}
+
+static int ELFN(sym2dyn_pass)(struct elfimage *img)
+{
+	int ret = 0;
+	double t = elfimage_clock();
+	_Bool must_recompute_hash_tables = 0;
+	/* First build hash tables of the symtab, by name and by address. */
+#define SECTION_DATA(shdr) ELFN_SECTION_DATA(img, (shdr))
+	ElfN(Shdr) *shdrs = img->shdrs;
+	ElfN(Shdr) *seen_symtab_shdr = NULL;
+	ElfN(Sym) *symtab_start = NULL;
+	ElfN(Word) *symtab_xindex = NULL;
+	struct name_table syms_by_name = { 0 };
+	struct addr_table syms_by_addr = { 0 };
+	char *strtab = NULL;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_SYMTAB)
+		{
+			assert(!seen_symtab_shdr);
+			seen_symtab_shdr = shdr;
+			symtab_start = SECTION_DATA(*shdr);
+			symtab_xindex = elfimage_symtab_xindex(img, shdr);
+			strtab = SECTION_DATA(shdrs[GET(shdr->sh_link)]);
+			name_table_init(&syms_by_name, GET(shdr->sh_size) / sizeof (ElfN(Sym)));
+			addr_table_init(&syms_by_addr, GET(shdr->sh_size) / sizeof (ElfN(Sym)));
+			for (ElfN(Sym) *sym = SECTION_DATA(*shdr);
+					sym != (ElfN(Sym) *) ((char*) SECTION_DATA(*shdr) + GET(shdr->sh_size));
+					++sym)
+			{
+				if (sym->st_name)
+				{
+					char *namestr = &strtab[GET(sym->st_name)];
+					// enter it into the sym table, detecting if it was already there
+					struct name_entry *by_name = name_table_enter(&syms_by_name, namestr);
+					if (!by_name->sym) by_name->sym = sym;
+					else
+					{
+						if (ELFIMAGE_VERBOSE(img, 1)) elfimage_warnx(img, "Found a duplicate symbol of name `%s'", namestr);
+						elfimage_count(img, ELFIMAGE_SYMBOLS_DUPLICATE, 1);
+						/* Duplicate symbols will confuse us, so we blacklist them */
+						by_name->dup = 1;
+					}
+					// also enter it, by address, into the address table
+					struct addr_entry *by_addr = addr_table_enter(&syms_by_addr, GET(sym->st_value));
+					if (!by_addr->sym) by_addr->sym = sym;
+					else
+					{
+						if (ELFIMAGE_VERBOSE(img, 1)) elfimage_warnx(img, "Found a duplicate symbol marking address 0x%lx (`%s' as well as `%s'",
+							(long) GET(sym->st_value),
+							&strtab[GET(((ElfN(Sym) *) by_addr->sym)->st_name)], namestr);
+						elfimage_count(img, ELFIMAGE_SYMBOLS_DUPLICATE, 1);
+						/* Duplicate addresses will confuse us, so we blacklist them */
+						by_addr->dup = 1;
+					}
+				}
+			}
+		}
+	}
+	if (!seen_symtab_shdr)
+	{
+		name_table_init(&syms_by_name, 0);
+		addr_table_init(&syms_by_addr, 0);
+	}
+	if (img->stats.counters[ELFIMAGE_SYMBOLS_DUPLICATE] && !ELFIMAGE_VERBOSE(img, 1))
+	{
+		elfimage_warnx(img, "ignoring %lu duplicate symbol names or addresses (-v to list them)",
+			img->stats.counters[ELFIMAGE_SYMBOLS_DUPLICATE]);
+	}
+	elfimage_phase(img, "index_symtab", &t);
+	ElfN(Sym) *dynsym_start = NULL;
+	ElfN(Shdr) *dynsym_shdr = NULL;
+	char *dynstr = NULL;
+	ElfN(Shdr) *sysv_hash_shdr = NULL;
+	ElfN(Shdr) *gnu_hash_shdr = NULL;
+	/* Names not yet in dynstr, to append, and which dynsyms want them. */
+	struct strtab_index dynstr_index = { 0 };
+	char *new_strs = NULL;
+	size_t new_strs_size = 0;
+	FILE *new_strs_f = open_memstream(&new_strs, &new_strs_size);
+	if (!new_strs_f) err(EXIT_FAILURE, "opening new strings buffer");
+	struct pending_rename { Elf64_Word dynsym_idx; size_t new_strs_offset; } *pending = NULL;
+	unsigned npending = 0;
+	/* The hash tables, which renaming means rebuilding. */
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_GNU_HASH) gnu_hash_shdr = shdr;
+		if (GET(shdr->sh_type) == SHT_HASH) sysv_hash_shdr = shdr;
+	}
+	/* Now we're looking for a dynsym. */
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) == SHT_DYNSYM)
+		{
+			dynsym_shdr = shdr;
+			dynstr = SECTION_DATA(shdrs[GET(shdr->sh_link)]);
+			const char *hash_problem = ELFN(hash_tables_problem)(img, shdr, gnu_hash_shdr, sysv_hash_shdr);
+			ElfN(Word) *dynsym_xindex = elfimage_symtab_xindex(img, shdr);
+			ElfN(Sym) *dynsym;
+			for (dynsym = dynsym_start = SECTION_DATA(*shdr);
+					dynsym != (ElfN(Sym) *) ((char*) SECTION_DATA(*shdr) + GET(shdr->sh_size));
+					++dynsym)
+			{
+				if (dynsym->st_name)
+				{
+					char *namestr = &dynstr[GET(dynsym->st_name)];
+					/* Did we blacklist this name? */
+					struct name_entry *by_name = name_table_find(&syms_by_name, namestr);
+					if (by_name && by_name->dup) /* found one */ continue;
+					/* OK, now look in the symbols table. */
+					if (by_name)
+					{
+						ElfN(Sym) *sym = by_name->sym;
+						/* Check consistency between this dynsym and the symtab entry. */
+						// 1a. definedness
+						if ((GET(dynsym->st_shndx) == SHN_UNDEF && GET(sym->st_shndx) != SHN_UNDEF)
+						||  (GET(sym->st_shndx) == SHN_UNDEF && GET(dynsym->st_shndx) != SHN_UNDEF))
+						{
+							if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "Different definedness, so patching: `%s'", namestr);
+							elfimage_count(img, ELFIMAGE_SYMBOLS_PATCHED, 1);
+							ELFN(copy_sym_section)(img, dynsym_start, dynsym, dynsym_xindex,
+								symtab_start, sym, symtab_xindex);
+							dynsym->st_value = sym->st_value; // also copy value
+							continue;
+						}
+						// 1b. absness
+						if ((GET(dynsym->st_shndx) == SHN_ABS && GET(sym->st_shndx) != SHN_ABS)
+						||  (GET(sym->st_shndx) == SHN_ABS && GET(dynsym->st_shndx) != SHN_ABS))
+						{
+							if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "Different absness, so patching: `%s'", namestr);
+							elfimage_count(img, ELFIMAGE_SYMBOLS_PATCHED, 1);
+							ELFN(copy_sym_section)(img, dynsym_start, dynsym, dynsym_xindex,
+								symtab_start, sym, symtab_xindex);
+							dynsym->st_value = sym->st_value;  // also copy value
+							continue;
+						}
+						// 2. same name but different vaddr, i.e. symbol was redefined in symtab
+						if (sym->st_value != dynsym->st_value)
+						{
+							if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "Different vaddr, so patching: `%s'", namestr);
+							elfimage_count(img, ELFIMAGE_SYMBOLS_PATCHED, 1);
+							dynsym->st_value = sym->st_value;
+							continue;
+						}
+					} /* end if by_name */
+					/* Also look in the address table. If a different-named symbol is the unique
+					 * marker of this address in the symtab, we assume it means that the symbol
+					 * was renamed in the symtab. We want to do the equivalent renaming here.
+					 *
+					 * Interaction: what if we just patched that symbol's value i.e. we've already
+					 * done a redefinition and now it's aliasing the address we're considering
+					 * here? Well, we just did 'continue' so we won't take both paths. Maybe
+					 * that's the best we can do. */
+					/* Did we blacklist this address? */
+					struct addr_entry *by_addr = addr_table_find(&syms_by_addr, GET(dynsym->st_value));
+					if (by_addr && by_addr->dup) continue;
+					char *found_name;
+					if (by_addr && 0 != strcmp(found_name = &strtab[GET(((ElfN(Sym) *) by_addr->sym)->st_name)],
+						namestr))
+					{
+						/* symtab has a unique and different name for this address.
+						 * Rename the symbol to that name. If it's not in dynstr,
+						 * we'll have to add it. */
+						if (hash_problem)
+						{
+							if (!ret) elfimage_warnx(img, "%s; not renaming any dynsyms", hash_problem);
+							ret = 6;
+							continue;
+						}
+						if (!dynstr_index.entries)
+						{
+							strtab_index_init(&dynstr_index, dynstr, GET(shdrs[GET(shdr->sh_link)].sh_size));
+						}
+						long found = strtab_index_find(&dynstr_index, found_name);
+						if (found == -1)
+						{
+							if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "Renaming `%s' to `%s' (a new string)", namestr, found_name);
+							pending = realloc(pending, (npending + 1) * sizeof *pending);
+							if (!pending) err(EXIT_FAILURE, "reallocating pending renames");
+							pending[npending++] = (struct pending_rename) {
+								.dynsym_idx = dynsym - dynsym_start,
+								.new_strs_offset = ftell(new_strs_f)
+							};
+							fputs(found_name, new_strs_f);
+							fputc('\0', new_strs_f);
+						}
+						else
+						{
+							if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "Renaming `%s' to `%s'", namestr, &dynstr[found]);
+							SET(dynsym->st_name, found);
+						}
+						elfimage_count(img, ELFIMAGE_SYMBOLS_RENAMED, 1);
+						must_recompute_hash_tables = 1;
+					}
+				} /* end if name */
+			} /* end for sym */
+		} /* end if dynsym */
+	} /* end for shdr */
+	fclose(new_strs_f);
+	elfimage_phase(img, "match_dynsyms", &t);
+	if (npending)
+	{
+		unsigned dynsym_shndx = dynsym_shdr - shdrs;
+		int gnu_hash_shndx = gnu_hash_shdr ? gnu_hash_shdr - shdrs : -1;
+		int sysv_hash_shndx = sysv_hash_shdr ? sysv_hash_shdr - shdrs : -1;
+		long base = dynstr_append(img, GET(dynsym_shdr->sh_link), new_strs, new_strs_size);
+		if (base == -1)
+		{
+			elfimage_warnx(img, "could not add %u new names to .dynstr", npending);
+			ret = 7;
+			goto out;
+		}
+		/* The file may have been remapped. */
+		shdrs = img->shdrs;
+		dynsym_shdr = &shdrs[dynsym_shndx];
+		dynsym_start = SECTION_DATA(*dynsym_shdr);
+		dynstr = SECTION_DATA(shdrs[GET(dynsym_shdr->sh_link)]);
+		gnu_hash_shdr = (gnu_hash_shndx == -1) ? NULL : &shdrs[gnu_hash_shndx];
+		sysv_hash_shdr = (sysv_hash_shndx == -1) ? NULL : &shdrs[sysv_hash_shndx];
+		for (unsigned i = 0; i < npending; ++i)
+		{
+			SET(dynsym_start[pending[i].dynsym_idx].st_name, base + pending[i].new_strs_offset);
+		}
+		elfimage_phase(img, "grow_dynstr", &t);
+	}
+	if (must_recompute_hash_tables && dynsym_shdr)
+	{
+		/* hash_tables_problem said these would all work. */
+		Elf64_Word nsyms = GET(dynsym_shdr->sh_size) / sizeof (ElfN(Sym));
+		unsigned dynsym_shndx = dynsym_shdr - shdrs;
+		if (gnu_hash_shdr)
+		{
+			struct gnu_hash_header *hdr = SECTION_DATA(*gnu_hash_shdr);
+			Elf64_Word nbuckets = GET(hdr->nbuckets);
+			Elf64_Word symoffset = GET(hdr->symoffset);
+			Elf64_Word *new_to_old = malloc(nsyms * sizeof (Elf64_Word));
+			if (!new_to_old) err(EXIT_FAILURE, "allocating dynsym permutation");
+			gnu_hash_order(img, dynsym_shndx, symoffset, nbuckets, new_to_old);
+			Elf64_Word nmoved = 0;
+			for (Elf64_Word i = 0; i < nsyms; ++i) nmoved += (new_to_old[i] != i);
+			if (nmoved)
+			{
+				if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "Moving %u dynsyms into GNU hash bucket order", (unsigned) nmoved);
+				if (0 != dynsym_permute(img, dynsym_shndx, new_to_old))
+				{
+					free(new_to_old);
+					ret = 6;
+					goto out;
+				}
+			}
+			free(new_to_old);
+			if (0 != gnu_hash_build(img, gnu_hash_shdr - shdrs, dynsym_shndx, nbuckets, symoffset))
+			{
+				elfimage_warnx(img, "GNU hash table is too small to rebuild");
+				ret = 6;
+				goto out;
+			}
+			elfimage_count(img, ELFIMAGE_HASH_TABLES_REBUILT, 1);
+		}
+		if (sysv_hash_shdr)
+		{
+			Elf64_Word *words = SECTION_DATA(*sysv_hash_shdr);
+			if (0 != sysv_hash_build(img, sysv_hash_shdr - shdrs, dynsym_shndx, GET(words[0])))
+			{
+				elfimage_warnx(img, "SysV hash table is too small to rebuild");
+				ret = 6;
+				goto out;
+			}
+			elfimage_count(img, ELFIMAGE_HASH_TABLES_REBUILT, 1);
+		}
+		elfimage_phase(img, "rebuild_hash_tables", &t);
+	}
+out:
+	free(pending);
+	free(new_strs);
+	strtab_index_destroy(&dynstr_index);
+	free(syms_by_name.entries);
+	free(syms_by_addr.entries);
+	return ret;
+}
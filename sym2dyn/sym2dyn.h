@@ -0,0 +1,9 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+int sym2dyn(char *filename);
+int sym2dyn_pass(struct elfimage *img);
+#ifdef __cplusplus
+}
+#endif
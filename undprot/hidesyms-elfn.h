@@ -0,0 +1,52 @@
+/* hidesyms_pass for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static int ELFN(hidesyms_pass)(struct elfimage *img, struct nameset *exports)
+{
+	ElfN(Ehdr) *ehdr = img->ehdr;
+	if (GET(ehdr->e_type) != ET_REL)
+	{
+		elfimage_warnx(img, "not a relocatable object, so too late to hide its symbols");
+		return 1;
+	}
+	ElfN(Shdr) *shdrs = img->shdrs;
+	unsigned long ndefined = 0, nhidden = 0;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)
+	{
+		if (GET(shdr->sh_type) != SHT_SYMTAB) continue;
+		const char *strtab = ELFN_SECTION_DATA(img, shdrs[GET(shdr->sh_link)]);
+		ElfN(Sym) *syms = ELFN_SECTION_DATA(img, *shdr);
+		ElfN(Sym) *syms_end = (ElfN(Sym) *) ((char*) syms + GET(shdr->sh_size));
+		/* The locals come first; sh_info is one past the last. */
+		for (ElfN(Sym) *sym = syms + GET(shdr->sh_info); sym < syms_end; ++sym)
+		{
+			unsigned char bind = ELFN_ST_BIND(sym->st_info);
+			unsigned char vis = ELFN_ST_VISIBILITY(sym->st_other);
+			/* STB_GNU_UNIQUE symbols have to stay visible to work. */
+			if ((bind != STB_GLOBAL && bind != STB_WEAK) || GET(sym->st_shndx) == SHN_UNDEF
+					|| !sym->st_name) continue;
+			++ndefined;
+			const char *name = &strtab[GET(sym->st_name)];
+			if (vis == STV_HIDDEN || vis == STV_INTERNAL) continue;
+			/* A .symver definition, "f@V1" or "f@@V1", says itself which
+			 * version exports it, and the linker holds it to the version
+			 * script; hidden, it would just vanish from .dynsym. So we
+			 * leave it alone, whether or not the script lists "f". */
+			if (strchr(name, '@'))
+			{
+				if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "leaving versioned `%s' alone", name);
+				continue;
+			}
+			if (nameset_contains(exports, name)) continue;
+			if (ELFIMAGE_VERBOSE(img, 1)) elfimage_note(img, "hiding `%s'", name);
+			sym->st_other = (sym->st_other & ~ELFN_ST_VISIBILITY(-1)) | STV_HIDDEN;
+			++nhidden;
+		}
+	}
+	elfimage_count(img, ELFIMAGE_SYMBOLS_PATCHED, nhidden);
+	if (ELFIMAGE_VERBOSE(img, 1))
+	{
+		elfimage_note(img, "hid %lu of %lu defined global symbols", nhidden, ndefined);
+	}
+	return 0;
+}
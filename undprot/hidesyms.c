@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <libgen.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "elfimage.h"
+#include "nameset.h"
+#include "batch.h"
+#include "hidesyms.h"
+
+/*
+ Here we rewrite relocatable objects, before they are linked into a
+ shared object, so that every global symbol they define is STV_HIDDEN,
+ unless it is to be exported. What is exported comes from export lists
+ (-f, one name or glob pattern per line) and/or linker version scripts
+ (-V, whose global: names count). This is the converse of undprot, and
+ does more good: the linker leaves hidden symbols out of .dynsym, and
+ binds references to them directly, with no PLT slot or symbolic dynamic
+ reloc -- just as if the code had been built with -fvisibility=hidden.
+ Versioned definitions (from .symver) are exported by the version they
+ name, so we never hide them.
+
+ Hiding a symbol that some other object of the same link uses is fine;
+ hiding one that the world outside the shared object uses is not, and
+ the link will not tell you. So the export list has to be complete.
+ */
+
+#ifdef HIDESYMS_AS_LIBRARY
+int hidesyms(char *filename, char **exports, unsigned nexports)
+{
+	struct nameset names = { .globs = 1 };
+	for (unsigned i = 0; i < nexports; ++i) nameset_add(&names, exports[i]);
+	struct elfimage img;
+	int ret = elfimage_open_partial(&img, filename, NULL);
+	if (!ret)
+	{
+		ret = hidesyms_pass(&img, &names);
+		if (!ret) ret = elfimage_commit(&img);
+		elfimage_close(&img);
+	}
+	nameset_destroy(&names);
+	return ret;
+}
+#else
+static void usage(const char *basename)
+{
+	fprintf(stderr, "Usage: %s [-f <exportlist>]... [-V|--version-script <script>]... [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] "
+		"[-o <output>] [-F|--files-from <listfile>] <filename>...\n", basename);
+}
+static int run_pass(struct elfimage *img, void *arg)
+{ return hidesyms_pass(img, arg); }
+int main(int argc, char **argv)
+{
+	struct nameset exports = { .globs = 1 };
+	struct elftin_batch batch = { .njobs = 1, .partial = 1, .pass = run_pass, .arg = &exports };
+	elftin_batch_stamp_word(&batch, "hidesyms");
+	static const struct option longopts[] = {
+		{ "version-script", required_argument, NULL, 'V' },
+		ELFTIN_BATCH_OPTIONS, { 0 }
+	};
+	_Bool have_list = 0, have_exports = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+f:V:j:o:F:nSv", longopts, NULL)))
+	{
+		switch (opt)
+		{
+			case 'f':
+				if (0 != nameset_add_file(&exports, optarg)) return 1;
+				have_exports = 1;
+				elftin_batch_stamp_word(&batch, "-f");
+				elftin_batch_stamp_word(&batch, optarg);
+				break;
+			case 'V':
+				if (0 != nameset_add_version_script(&exports, optarg)) return 1;
+				have_exports = 1;
+				elftin_batch_stamp_word(&batch, "-V");
+				elftin_batch_stamp_word(&batch, optarg);
+				break;
+			case 'j': batch.njobs = atoi(optarg); break;
+			case 'o': batch.output = optarg; break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_list = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: usage(basename(argv[0])); return 1;
+		}
+	}
+	/* With nothing to export we would hide everything, which is more
+	 * likely a mistake than not. */
+	if ((argc - optind < 1 && !have_list) || !have_exports)
+	{
+		usage(basename(argv[0]));
+		return 1;
+	}
+
+	for (int i = optind; i < argc; ++i) elftin_batch_add(&batch, argv[i]);
+	nameset_freeze(&exports); // the files may be done in parallel
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	nameset_destroy(&exports);
+	return ret;
+}
+#endif
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "hidesyms-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "hidesyms-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "hidesyms-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "hidesyms-elfn.h"
+/* Returns 1 for a file that is not a relocatable object: by then the
+ * linker has made what symbols it will dynamic. */
+int hidesyms_pass(struct elfimage *img, struct nameset *exports)
+{
+	return ELFIMAGE_DISPATCH(img, hidesyms_pass, img, exports);
+}
@@ -0,0 +1,10 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+struct nameset;
+int hidesyms(char *filename, char **exports, unsigned nexports);
+int hidesyms_pass(struct elfimage *img, struct nameset *exports);
+#ifdef __cplusplus
+}
+#endif
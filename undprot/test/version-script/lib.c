@@ -0,0 +1,6 @@
+/* 'exported' is in the version script, 'internal' is not, and 'vfn' is
+ * defined by .symver, as vfn@@V1, which the script also lists (as vfn). */
+int internal(void) { return 1; }
+int exported(void) { return internal() + 1; }
+int vfn_impl(void) { return internal() + 2; }
+__asm__(".symver vfn_impl, vfn@@V1");
@@ -0,0 +1,3 @@
+int exported(void);
+int vfn(void);
+int main(void) { return !(exported() == 2 && vfn() == 3); }
@@ -0,0 +1,28 @@
+/* undprot_pass for one ELF class and byte order; see elfn.h. */
+#include "elfn.h"
+
+static int ELFN(undprot_pass)(struct elfimage *img)
+{
+	ElfN(Shdr) *shdrs = img->shdrs;
+	for (ElfN(Shdr) *shdr = shdrs; shdr < shdrs + img->shnum; ++shdr)  // FIXME: respect entsz
+	{
+		if (GET(shdr->sh_type) == SHT_SYMTAB)
+		{
+			/* Let's walk the symbols and make sure any UNDs are given
+			 * protected visibility. */
+			ElfN(Sym) *syms = ELFN_SECTION_DATA(img, *shdr);
+			ElfN(Sym) *syms_end = (ElfN(Sym) *) ((char*) syms + GET(shdr->sh_size));
+			for (ElfN(Sym) *sym = syms; sym != syms_end; ++sym) // FIXME: respect entsz
+			{
+				if (GET(sym->st_shndx) == SHN_UNDEF &&
+					ELFN_ST_VISIBILITY(sym->st_other) != STV_HIDDEN &&
+					ELFN_ST_VISIBILITY(sym->st_other) != STV_PROTECTED)
+				{
+					sym->st_other = ELFN_ST_VISIBILITY(STV_PROTECTED);
+					elfimage_count(img, ELFIMAGE_SYMBOLS_PATCHED, 1);
+				}
+			}
+		}
+	}
+	return 0;
+}
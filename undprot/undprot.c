@@ -3,10 +3,6 @@
 #include <libgen.h>
 #include <elf.h>
 #include <stdio.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/mman.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <err.h>
@@ -15,71 +11,85 @@
 #include <alloca.h>
 #include <link.h> /* for ElfW */
 
+#include "elfimage.h"
+#include "batch.h"
+#include "undprot.h"
+
 /* Here we rewrite an ELF file's relocation section headers so that
  * they are just progbits.
  */
 
+#ifdef UNDPROT_AS_LIBRARY
+int undprot(char *filename)
+{
+	const char *output = NULL;
+	struct elfimage img;
+	int ret = elfimage_open_partial(&img, filename, output);
+	if (ret) return ret;
+	ret = undprot_pass(&img);
+	if (!ret) ret = elfimage_commit(&img);
+	elfimage_close(&img);
+	return ret;
+}
+#else
 static void usage(const char *basename)
 {
-	fprintf(stderr, "Usage: %s <filename>\n", basename);
+	fprintf(stderr, "Usage: %s [-j <njobs>] [-v] [--check] [--stamp] [--stats=json|text] [-o <output>] [-F|--files-from <listfile>] "
+		"<filename>...\n", basename);
 }
+static int run_pass(struct elfimage *img, void *arg)
+{ (void) arg; return undprot_pass(img); }
 int main(int argc, char **argv)
 {
-	if (argc != 2)
-	{
-		usage(basename(argv[0]));
-		return 1;
-	}
-
-	char *filename = argv[1];
-	int fd = open(filename, O_RDWR);
-	if (fd == -1)
+	struct elftin_batch batch = { .njobs = 1, .partial = 1, .pass = run_pass };
+	elftin_batch_stamp_word(&batch, "undprot");
+	static const struct option longopts[] = { ELFTIN_BATCH_OPTIONS, { 0 } };
+	_Bool have_list = 0;
+	int opt;
+	while (-1 != (opt = getopt_long(argc, argv, "+j:o:F:nSv", longopts, NULL)))
 	{
-		errx(2, "could not open %s", filename);
+		switch (opt)
+		{
+			case 'j': batch.njobs = atoi(optarg); break;
+			case 'o': batch.output = optarg; break;
+			case 'F':
+				if (0 != elftin_batch_add_list(&batch, optarg)) return 1;
+				have_list = 1;
+				break;
+			case 'n': batch.check = 1; break;
+			case 'S': batch.stamp = 1; break;
+			case 'v': ++batch.verbosity; break;
+			case ELFTIN_BATCH_STATS_OPTION:
+				if (0 != elftin_batch_set_stats(&batch, optarg)) return 1;
+				break;
+			default: usage(basename(argv[0])); return 1;
+		}
 	}
-
-	long page_size = sysconf(_SC_PAGESIZE);
-	struct stat buf;
-	int ret = fstat(fd, &buf);
-	if (ret)
+	if (argc - optind < 1 && !have_list)
 	{
-		errx(3, "could not stat %s", filename);
+		usage(basename(argv[0]));
+		return 1;
 	}
 
-	size_t length = (buf.st_size % page_size == 0) ? buf.st_size
-				: page_size * (buf.st_size / page_size + 1);
-
-	void *mapping = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-	if (mapping == MAP_FAILED)
-	{
-		errx(4, "could not mmap %s", filename);
-	}
-	/* FIXME: don't assume 64-bit and native-endianness. */
-	Elf64_Ehdr *ehdr = (Elf64_Ehdr *) mapping;
-	if (0 != strncmp(ehdr->e_ident, "\x7F""ELF", 4))
-	{
-		errx(5, "not an ELF file: %s", filename);
-	}
-	Elf64_Shdr *shdrs = (Elf64_Shdr *) (((uintptr_t) mapping) + ehdr->e_shoff);
-	for (Elf64_Shdr *shdr = shdrs; shdr < shdrs + ehdr->e_shnum; ++shdr)  // FIXME: respect entsz
-	{
-		if (shdr->sh_type == SHT_SYMTAB)
-		{
-			/* Let's walk the symbols and make sure any UNDs are given
-			 * protected visibility. */
-			Elf64_Sym *syms = (Elf64_Sym *) (((uintptr_t) mapping) + shdr->sh_offset);
-			Elf64_Sym *syms_end = (Elf64_Sym *) (((uintptr_t) mapping) + shdr->sh_offset + shdr->sh_size);
-			for (Elf64_Sym *sym = syms; sym != syms_end; ++sym) // FIXME: respect entsz
-			{
-				if (sym->st_shndx == SHN_UNDEF &&
-					ELF64_ST_VISIBILITY(sym->st_other) != STV_HIDDEN &&
-					ELF64_ST_VISIBILITY(sym->st_other) != STV_PROTECTED)
-				{
-					sym->st_other = ELF64_ST_VISIBILITY(STV_PROTECTED);
-				}
-			}
-		}
-	}
-	munmap(mapping, length);
-	close(fd);
+	for (int i = optind; i < argc; ++i) elftin_batch_add(&batch, argv[i]);
+	int ret = elftin_batch_run(&batch);
+	elftin_batch_destroy(&batch);
+	return ret;
+}
+#endif
+#define ELFN_BITS 64
+#define ELFN_SWAP 0
+#include "undprot-elfn.h"
+#define ELFN_BITS 64
+#define ELFN_SWAP 1
+#include "undprot-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 0
+#include "undprot-elfn.h"
+#define ELFN_BITS 32
+#define ELFN_SWAP 1
+#include "undprot-elfn.h"
+int undprot_pass(struct elfimage *img)
+{
+	return ELFIMAGE_DISPATCH(img, undprot_pass, img);
 }
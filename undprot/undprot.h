@@ -0,0 +1,9 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+struct elfimage;
+int undprot(char *filename);
+int undprot_pass(struct elfimage *img);
+#ifdef __cplusplus
+}
+#endif
@@ -62,6 +62,7 @@ extern "C" {
 }
 #include <malloc.h> /* for malloc_usable_size */
 #include "normrelocs.h"
+#include "elfimage.h"
 #include "elfmap.hh"
 #include "cmdline.hh"
 #include "plugin-api.hh"
@@ -183,25 +184,38 @@ struct xwrap_plugin : elftin::linker_plugin
 	mv "$newtmp" "$tmpname"
 
 			 */
-			// copy origname to tmpname
-			boost::filesystem::path origname_p(string(claimed_files.back().input_file->name));
+			// do normrelocs <syms...> on a copy of origname, in one pass for all syms,
+			// and put the result at tmpname. The copy is a reflink if the filesystem
+			// can do it, so we only pay for the pages normrelocs writes.
 			boost::filesystem::path tmpname_p(tmpname);
-			boost::filesystem::copy_file(origname_p, tmpname_p,
-				boost::filesystem::copy_options::overwrite_existing); // FIXME: error handling?
-
-			// for all syms, do normrelocs <sym> on file tmpname
+			vector<char*> symnames;
 			for (auto i_sym = claimed_files.back().syms.begin();
 				i_sym != claimed_files.back().syms.end();
 				++i_sym)
 			{
-				int ret = normrelocs((char*) tmpname.c_str(), (char*) i_sym->c_str());
+				symnames.push_back((char*) i_sym->c_str());
+			}
+			// With no symbols, normrelocs would take every zero-offset symbol,
+			// so then we leave the file as it is and 'ld -r' the original.
+			const char *relinput = claimed_files.back().input_file->name;
+			int ret;
+			if (!symnames.empty())
+			{
+				struct elfimage img;
+				ret = elfimage_open_copy(&img, claimed_files.back().input_file->name,
+					tmpname.c_str());
+				if (ret == 0) ret = normrelocs_pass(&img, symnames.data(), symnames.size(),
+					0 /* one thread per CPU */);
+				if (ret == 0) ret = elfimage_commit(&img);
+				elfimage_close(&img);
 				if (ret != 0) abort(); // FIXME: error reporting
+				relinput = tmpname.c_str();
 			}
 			// do ld -r `--defsym othersym` (for all othersyms in claimed_files.back().syms.begin())
 			pair<string, int> newtmp = new_temp_file("xwrap-ldplugin-ld-defsymd");
 			char *cmdstr;
-			int ret = asprintf(&cmdstr, "'%s' -r -o '%s' '%s'", job->ld_cmd.c_str(), newtmp.first.c_str(),
-				tmpname.c_str());
+			ret = asprintf(&cmdstr, "'%s' -r -o '%s' '%s'", job->ld_cmd.c_str(), newtmp.first.c_str(),
+				relinput);
 			if (ret < 0) abort();
 			size_t bufstrlen = ret;
 			assert(bufstrlen == strlen(cmdstr));
@@ -314,21 +328,14 @@ struct xwrap_plugin : elftin::linker_plugin
 		xwrapped_defined_symnames_by_input_file = classify_input_objects< set<string> >(
 			input_files,
 			[this](fmap const& f, off_t offset, string const& fname) -> set<string> {
-				set<pair< ElfW(Sym)*, string > > pairs = enumerate_symbols_matching(f, offset,
-					[this](ElfW(Sym)* sym, string const& name) -> bool {
-						return (ELFW_ST_TYPE(sym->st_info) == STT_OBJECT
-							  ||  ELFW_ST_TYPE(sym->st_info) == STT_FUNC)
-							  && (sym->st_shndx != SHN_UNDEF && sym->st_shndx != SHN_ABS)
+				return enumerate_symbols_matching(f, offset,
+					[this](auto t, auto *sym, string const& name) -> bool {
+						return (t.st_type(sym->st_info) == STT_OBJECT
+							  ||  t.st_type(sym->st_info) == STT_FUNC)
+							  && (t.get(sym->st_shndx) != SHN_UNDEF && t.get(sym->st_shndx) != SHN_ABS)
 							  && (std::find(job->options.begin(), job->options.end(), name)
 								!= job->options.end());
 					});
-				// we have a set of pairs... need to return a set of strings
-				set<string> ret;
-				for (auto i_pair = pairs.begin(); i_pair != pairs.end(); ++i_pair)
-				{
-					ret.insert(i_pair->second);
-				}
-				return ret;
 			}
 		);
 